@@ -9,6 +9,9 @@
 #include <vector>
 #include <algorithm>
 #include "trm/subs.h"
+#include "trm/array_expr.h"
+#include "trm/quantile.h"
+#include "trm/simd.h"
 #include "plplot.h"
 
 namespace Subs {
@@ -40,6 +43,9 @@ namespace Subs {
     //! Copy constructor
     Array1D(const Array1D& obj) : Buffer1D<X>(obj) {}
 
+    //! Move constructor
+    Array1D(Array1D&& obj) noexcept : Buffer1D<X>(std::move(obj)) {}
+
     //! Constructs an Array from a vector 
     template <class Y> 
     Array1D(const std::vector<Y>& vec);
@@ -55,9 +61,31 @@ namespace Subs {
     //! Constructor from a file
     Array1D(const std::string& file) : Buffer1D<X>(file) {};
 
+    //! Constructor from an array expression, which is evaluated
+    template <class E>
+    Array1D(const Array1D_Expr<E>& expr) : Buffer1D<X>(expr.size()) {
+      *this = expr;
+    }
+
+    //! Assignment
+    Array1D<X>& operator=(const Array1D<X>& obj){
+      Buffer1D<X>::operator=(obj);
+      return *this;
+    }
+
+    //! Move assignment
+    Array1D<X>& operator=(Array1D<X>&& obj) noexcept {
+      Buffer1D<X>::operator=(std::move(obj));
+      return *this;
+    }
+
     //! Assign to a constant
     Array1D<X>& operator=(const X& con);
 
+    //! Assign to an array expression
+    template <class E>
+    Array1D<X>& operator=(const Array1D_Expr<E>& expr);
+
     //! Addition of a constant, in place
     void operator+=(const X& con);
 
@@ -86,6 +114,22 @@ namespace Subs {
     template <class Y>
     void operator/=(const Array1D<Y>& vec);
 
+    //! Addition of an array expression, in place
+    template <class E>
+    void operator+=(const Array1D_Expr<E>& expr);
+
+    //! Subtraction of an array expression, in place
+    template <class E>
+    void operator-=(const Array1D_Expr<E>& expr);
+
+    //! Multiplication by an array expression, in place
+    template <class E>
+    void operator*=(const Array1D_Expr<E>& expr);
+
+    //! Division by an array expression, in place
+    template <class E>
+    void operator/=(const Array1D_Expr<E>& expr);
+
     //! Returns maximum value
     X max() const;
 
@@ -119,6 +163,9 @@ namespace Subs {
     //! Returns median (scrambles element order!)
     X median();
 
+    //! Returns a sketch for approximate percentiles
+    Quantile_sketch sketch(double compression=Quantile_sketch::COMPRESSION) const;
+
     //! Returns sum
     X sum() const;
 
@@ -184,26 +231,22 @@ namespace Subs {
   // Operations with constants  
   template <class X>
   void Array1D<X>::operator+=(const X& con){
-    for(int i=0; i<this->size(); i++)
-      this->buff[i] += con;
+    Simd::add_const(this->buff, con, this->size());
   }
 
   template <class X>
   void Array1D<X>::operator-=(const X& con){
-    for(int i=0; i<this->size(); i++)
-      this->buff[i] -= con;
+    Simd::sub_const(this->buff, con, this->size());
   }
 
   template <class X>
   void Array1D<X>::operator*=(const X& con){
-    for(int i=0; i<this->size(); i++)
-      this->buff[i] *= con;
+    Simd::mul_const(this->buff, con, this->size());
   }
 
   template <class X>
   void Array1D<X>::operator/=(const X& con){
-    for(int i=0; i<this->size(); i++)
-      this->buff[i] /= con;
+    Simd::div_const(this->buff, con, this->size());
   }
 
   // Returns maximum value
@@ -212,10 +255,7 @@ namespace Subs {
     if(this->size() == 0)
       throw Array1D_Error("X Array1D<X>::max(): null array, cannot take maximum");
     
-    X vmax = this->buff[0];
-    for(int i=1; i<this->size(); i++)
-      vmax = vmax < this->buff[i] ? this->buff[i] : vmax;
-    return vmax;
+    return Simd::max(this->buff, this->size());
   }
 
   // Returns minimum value
@@ -224,10 +264,7 @@ namespace Subs {
     if(this->size() == 0)
       throw Array1D_Error("X Array1D<X>::min(): null array, cannot take minimum");
     
-    X vmin = this->buff[0];
-    for(int i=1; i<this->size(); i++)
-      vmin = vmin > this->buff[i] ? this->buff[i] : vmin;
-    return vmin;
+    return Simd::min(this->buff, this->size());
   }
 
   /** This function returns the value of the k-th smallest element of an Array1D. It uses
@@ -268,6 +305,17 @@ namespace Subs {
     }
   }
 
+  /** This function summarises the array for approximate percentiles, without
+   * altering or copying it. Call quantile on the result.
+   * \param compression see Quantile_sketch
+   */
+  template <class X>
+  Quantile_sketch Array1D<X>::sketch(double compression) const {
+    Quantile_sketch qs(compression);
+    qs.add(this->buff, this->size());
+    return qs;
+  }
+
   /** This function computes the mean. It returns zero if there are no elements
    * 
    */
@@ -275,8 +323,7 @@ namespace Subs {
   X Array1D<X>::mean() const {
     X sum = 0;
     if(this->size()){
-      for(int i=0; i<this->size(); i++)
-	sum += this->buff[i];
+      sum = Simd::sum(this->buff, this->size());
       sum /= this->size();
     }
     return sum;
@@ -287,22 +334,14 @@ namespace Subs {
    */
   template <class X>
   X Array1D<X>::sum() const {
-      X sum = 0;
-      if(this->size()){
-	  for(int i=0; i<this->size(); i++)
-	      sum += this->buff[i];
-      }
-      return sum;
+      return Simd::sum(this->buff, this->size());
   }
 
   /** This function computes the length as the square root of the sum of squares
    */
   template <class X>
   X Array1D<X>::length() const {
-    X sum = 0;
-    for(int i=0; i<this->size(); i++)
-      sum += Subs::sqr(this->buff[i]);
-    return sqrt(sum);
+    return sqrt(Simd::sumsq(this->buff, this->size()));
   }
 
   // Operations with other arrays
@@ -312,8 +351,7 @@ namespace Subs {
     if(this->size() != vec.size())
       throw Array1D_Error("void Array1D<X>::operator+=(const Array1D<Y>& vec): incompatible numbers of elements, " + Subs::str(this->size()) + 
 			  " versus " + Subs::str(vec.size()) );
-    for(int i=0; i<this->size(); i++)
-      this->buff[i] += vec.buff[i];
+    Simd::add(this->buff, vec.ptr(), this->size());
   }
 
   template <class X>
@@ -322,8 +360,7 @@ namespace Subs {
     if(this->size() != vec.size())
       throw Array1D_Error("void Array1D<X>::operator-=(const Array1D<Y>& vec): incompatible numbers of elements, " + Subs::str(this->size()) + 
 			  " versus " + Subs::str(vec.size()));
-    for(int i=0; i<this->size(); i++)
-      this->buff[i] -= vec.buff[i];
+    Simd::sub(this->buff, vec.ptr(), this->size());
   }
 
   template <class X>
@@ -332,8 +369,7 @@ namespace Subs {
     if(this->size() != vec.size())
       throw Array1D_Error("void Array1D<X>::operator*=(const Array1D<Y>& vec): incompatible numbers of elements, " + Subs::str(this->size()) + 
 			  " versus " + Subs::str(vec.size()) );
-    for(int i=0; i<this->size(); i++)
-      this->buff[i] *= vec.buff[i];
+    Simd::mul(this->buff, vec.ptr(), this->size());
   }
 
   template <class X>
@@ -342,8 +378,66 @@ namespace Subs {
     if(this->size() != vec.size())
       throw Array1D_Error("void Array1D<X>::operator/=(const Array1D<Y>& vec): incompatible numbers of elements, " + Subs::str(this->size()) + 
 			  " versus " + Subs::str(vec.size()) );
+    Simd::div(this->buff, vec.ptr(), this->size());
+  }
+
+  /** Evaluates an array expression such as a*b + c - 2. in a single pass.
+   * The array is resized if need be. The array itself can appear in the
+   * expression, as in a = a + b, since each element is only read before
+   * it is written.
+   */
+  template <class X>
+  template <class E>
+  Array1D<X>& Array1D<X>::operator=(const Array1D_Expr<E>& expr){
+    if(this->size() != expr.size()) this->resize(expr.size());
+    const E& node = expr.node();
+    for(int i=0; i<this->size(); i++)
+      this->buff[i] = X(node[i]);
+    return *this;
+  }
+
+  template <class X>
+  template <class E>
+  void Array1D<X>::operator+=(const Array1D_Expr<E>& expr){
+    if(this->size() != expr.size())
+      throw Array1D_Error("void Array1D<X>::operator+=(const Array1D_Expr<E>& expr): incompatible numbers of elements, " + Subs::str(this->size()) + 
+			  " versus " + Subs::str(expr.size()) );
+    const E& node = expr.node();
+    for(int i=0; i<this->size(); i++)
+      this->buff[i] += node[i];
+  }
+
+  template <class X>
+  template <class E>
+  void Array1D<X>::operator-=(const Array1D_Expr<E>& expr){
+    if(this->size() != expr.size())
+      throw Array1D_Error("void Array1D<X>::operator-=(const Array1D_Expr<E>& expr): incompatible numbers of elements, " + Subs::str(this->size()) + 
+			  " versus " + Subs::str(expr.size()) );
+    const E& node = expr.node();
+    for(int i=0; i<this->size(); i++)
+      this->buff[i] -= node[i];
+  }
+
+  template <class X>
+  template <class E>
+  void Array1D<X>::operator*=(const Array1D_Expr<E>& expr){
+    if(this->size() != expr.size())
+      throw Array1D_Error("void Array1D<X>::operator*=(const Array1D_Expr<E>& expr): incompatible numbers of elements, " + Subs::str(this->size()) + 
+			  " versus " + Subs::str(expr.size()) );
+    const E& node = expr.node();
+    for(int i=0; i<this->size(); i++)
+      this->buff[i] *= node[i];
+  }
+
+  template <class X>
+  template <class E>
+  void Array1D<X>::operator/=(const Array1D_Expr<E>& expr){
+    if(this->size() != expr.size())
+      throw Array1D_Error("void Array1D<X>::operator/=(const Array1D_Expr<E>& expr): incompatible numbers of elements, " + Subs::str(this->size()) + 
+			  " versus " + Subs::str(expr.size()) );
+    const E& node = expr.node();
     for(int i=0; i<this->size(); i++)
-      this->buff[i] /= vec.buff[i];
+      this->buff[i] /= node[i];
   }
 
   template <class X>
@@ -412,26 +506,59 @@ namespace Subs {
   
   // Non-member functions
 
-  // Operations with other arrays
-  template <class X, class Y>
-  Array1D<X> operator-(const Array1D<X>& v1, const Array1D<Y>& v2){
-    if(v1.size() != v2.size())
-      throw Array1D_Error("void operator-=(const Array1D<X>&, const Array1D<Y>&): incompatible numbers of elements, " + Subs::str(v1.size()) 
-			  + " versus " + Subs::str(v2.size()) );
-    Array1D<X> temp = v1;
-    temp -= v2;
-    return temp;
+  namespace Expr {
+
+    //! Number of elements of a 1D operand, or -1 for a constant
+    template <class T>
+    typename std::enable_if<is_scalar<T>::value, int>::type
+    npix(const T&){return -1;}
+
+    template <class T>
+    typename std::enable_if<!is_scalar<T>::value, int>::type
+    npix(const T& t){return t.size();}
+
+    //! Type of the 1D expression combining A and B with Op
+    template <class Op, class A, class B>
+    struct binary_1d {
+      typedef Binary<Op, decltype(operand(std::declval<const A&>(), std::declval<const B&>())),
+		     decltype(operand(std::declval<const B&>(), std::declval<const A&>()))> node_t;
+      typedef Array1D_Expr<node_t> type;
+    };
+
+    //! Combines two operands into a 1D expression, checking their sizes
+    template <class Op, class A, class B>
+    typename binary_1d<Op,A,B>::type combine_1d(const A& a, const B& b, const char* func){
+      int na = npix(a), nb = npix(b);
+      if(na >= 0 && nb >= 0 && na != nb)
+	throw Array1D_Error(std::string(func) + ": incompatible numbers of elements, " + Subs::str(na) + " versus " + Subs::str(nb));
+      typedef typename binary_1d<Op,A,B>::node_t node_t;
+      return typename binary_1d<Op,A,B>::type(node_t(operand(a,b), operand(b,a)), na >= 0 ? na : nb);
+    }
+
   }
 
-  // Operations with other arrays
-  template <class X, class Y>
-  Array1D<X> operator+(const Array1D<X>& v1, const Array1D<Y>& v2){
-    if(v1.size() != v2.size())
-      throw Array1D_Error("void operator+=(const Array1D<X>&, const Array1D<Y>&): incompatible numbers of elements, " + Subs::str(v1.size()) 
-			  + " versus " + Subs::str(v2.size()) );
-    Array1D<X> temp = v1;
-    temp += v2;
-    return temp;
+  //! Adds two Array1Ds (or an Array1D and a constant) element by element, lazily
+  template <class A, class B, class = typename std::enable_if<Expr::is_1d_pair<A,B>::value>::type>
+  typename Expr::binary_1d<Expr::Add,A,B>::type operator+(const A& a, const B& b){
+    return Expr::combine_1d<Expr::Add>(a, b, "operator+(const A&, const B&)");
+  }
+
+  //! Subtracts two Array1Ds (or an Array1D and a constant) element by element, lazily
+  template <class A, class B, class = typename std::enable_if<Expr::is_1d_pair<A,B>::value>::type>
+  typename Expr::binary_1d<Expr::Sub,A,B>::type operator-(const A& a, const B& b){
+    return Expr::combine_1d<Expr::Sub>(a, b, "operator-(const A&, const B&)");
+  }
+
+  //! Multiplies two Array1Ds (or an Array1D and a constant) element by element, lazily
+  template <class A, class B, class = typename std::enable_if<Expr::is_1d_pair<A,B>::value>::type>
+  typename Expr::binary_1d<Expr::Mul,A,B>::type operator*(const A& a, const B& b){
+    return Expr::combine_1d<Expr::Mul>(a, b, "operator*(const A&, const B&)");
+  }
+
+  //! Divides two Array1Ds (or an Array1D and a constant) element by element, lazily
+  template <class A, class B, class = typename std::enable_if<Expr::is_1d_pair<A,B>::value>::type>
+  typename Expr::binary_1d<Expr::Div,A,B>::type operator/(const A& a, const B& b){
+    return Expr::combine_1d<Expr::Div>(a, b, "operator/(const A&, const B&)");
   }
 
   // Plotting routines
@@ -525,60 +652,92 @@ namespace Subs {
     return vec.min();
   }
 
-  //! Subtracts a constant to create a new Array1D
-  template <class X, class Y>
-  Array1D<X> operator-(const Array1D<X>& vec, const Y& con){
+  //! Takes cosine of array
+  template <class X>
+  Array1D<X> cos(const Array1D<X>& vec){
     Array1D<X> temp = vec;
-    temp -= con;
+    temp.cos();
     return temp;
   }
 
-  //! Pre-multiplies by a constant
-  template <class X, class Y>
-  Array1D<X> operator*(const Y& con, const Array1D<X>& vec){
-    Array1D<X> temp = vec;
-    temp *= con;
+  //! Takes cosine of an array which is about to disappear
+  template <class X>
+  Array1D<X> cos(Array1D<X>&& vec){
+    vec.cos();
+    return std::move(vec);
+  }
+
+  //! Takes cosine of an array expression
+  template <class E>
+  Array1D<typename Array1D_Expr<E>::value_type> cos(const Array1D_Expr<E>& expr){
+    Array1D<typename Array1D_Expr<E>::value_type> temp = expr;
+    temp.cos();
     return temp;
   }
 
-  //! Divides by a constant
-  template <class X, class Y>
-  Array1D<X> operator/(const Array1D<X>& vec, const Y& con){
+  //! Takes sine of array
+  template <class X>
+  Array1D<X> sin(const Array1D<X>& vec){
     Array1D<X> temp = vec;
-    temp /= con;
+    temp.sin();
     return temp;
   }
 
-  //! Mulitplies two Array1Ds, element by element
-  template <class X, class Y>
-  Array1D<X> operator*(const Array1D<X>& vec1, const Array1D<X>& vec2){
-    Array1D<X> temp = vec1;
-    temp *= vec2;
-    return temp;
+  //! Takes sine of an array which is about to disappear
+  template <class X>
+  Array1D<X> sin(Array1D<X>&& vec){
+    vec.sin();
+    return std::move(vec);
   }
 
-  //! Divides two Array1Ds, element by element
-  template <class X, class Y>
-  Array1D<X> operator/(const Array1D<X>& vec1, const Array1D<X>& vec2){
-    Array1D<X> temp = vec1;
-    temp /= vec2;
+  //! Takes sine of an array expression
+  template <class E>
+  Array1D<typename Array1D_Expr<E>::value_type> sin(const Array1D_Expr<E>& expr){
+    Array1D<typename Array1D_Expr<E>::value_type> temp = expr;
+    temp.sin();
     return temp;
   }
 
-  //! Takes cosine of array
-  template <class X>
-  Array1D<X> cos(const Array1D<X>& vec){
-    Array1D<X> temp = vec;
-    temp.cos();
-    return temp;
+  //! Returns the maximum value of an array expression
+  template <class E>
+  typename Array1D_Expr<E>::value_type max(const Array1D_Expr<E>& expr){
+    return expr.max();
   }
 
-  //! Takes sine of array
-  template <class X>
-  Array1D<X> sin(const Array1D<X>& vec){
-    Array1D<X> temp = vec;
-    temp.sin();
-    return temp;
+  //! Returns the minimum value of an array expression
+  template <class E>
+  typename Array1D_Expr<E>::value_type min(const Array1D_Expr<E>& expr){
+    return expr.min();
+  }
+
+  //! ASCII output of an array expression
+  template <class E>
+  std::ostream& operator<<(std::ostream& s, const Array1D_Expr<E>& expr){
+    return s << expr.eval();
+  }
+
+  //! Plots an array expression versus pixel number
+  template <class E>
+  void pgline(const Array1D_Expr<E>& expr){
+    pgline(expr.eval());
+  }
+
+  //! Plots two arrays, one or both expressions, against each other as a line
+  template <class A, class B, class = typename std::enable_if<Expr::is_1d_expr_pair<A,B>::value>::type>
+  void pgline(const A& x, const B& y){
+    pgline(Expr::eval(x), Expr::eval(y));
+  }
+
+  //! Plots two arrays, one or both expressions, against each other in bar form
+  template <class A, class B, class = typename std::enable_if<Expr::is_1d_expr_pair<A,B>::value>::type>
+  void pgbin(const A& x, const B& y){
+    pgbin(Expr::eval(x), Expr::eval(y));
+  }
+
+  //! Plots two arrays, one or both expressions, against each other as a set of points
+  template <class A, class B, class = typename std::enable_if<Expr::is_1d_expr_pair<A,B>::value>::type>
+  void pgpt(const A& x, const B& y, int symbol){
+    pgpt(Expr::eval(x), Expr::eval(y), symbol);
   }
 
   /** Sets an Array1D to a constant
@@ -5,8 +5,14 @@
 #include <new>
 #include <string>
 #include <iostream>
+#include <vector>
+#include <algorithm>
 #include "cpgplot.h"
 #include "trm/buffer2d.h"
+#include "trm/array_expr.h"
+#include "trm/quantile.h"
+#include "trm/simd.h"
+#include "trm/thread_pool.h"
 
 namespace Subs {
   
@@ -21,9 +27,6 @@ namespace Subs {
   template <class X>
   class Array2D;
 
-  template <class X>
-  Array2D<X> operator-(const X& con, const Array2D<X>& img);
-    
   template <class X>
   std::ostream& operator<<(std::ostream& ost, const Array2D<X>& img);
   
@@ -32,6 +35,10 @@ namespace Subs {
   /** This class is for representing numerical 2D arrays and matrices. Use it if
    * you want to be able to add, subtract etc with arrays, otherwise use Buffer2D
    * from which it is inherited.
+   *
+   * The reductions (sum, max, mean etc), sqrt, step and the arithmetic operators
+   * are split across threads on large arrays if enabled with Subs::set_nthreads.
+   * Reductions give the same result whatever the number of threads.
    */
   
   template <class X> 
@@ -45,12 +52,31 @@ namespace Subs {
     //! Constructs an ny rows by nx columns matrix
     Array2D(int ny, int nx) : Buffer2D<X>(ny,nx) {}
 
+    //! Copy constructor
+    Array2D(const Array2D& obj) : Buffer2D<X>(obj) {}
+
+    //! Move constructor
+    Array2D(Array2D&& obj) noexcept : Buffer2D<X>(std::move(obj)) {}
+
+    //! Constructor from an array expression, which is evaluated
+    template <class E>
+    Array2D(const Array2D_Expr<E>& expr) : Buffer2D<X>(expr.get_ny(), expr.get_nx()) {
+      *this = expr;
+    }
+
     //! Assignment to a constant
     Array2D& operator=(const X& con);
 
     //! Assignment to another Array2D
     Array2D& operator=(const Array2D<X>& obj);
 
+    //! Move assignment from another Array2D
+    Array2D& operator=(Array2D<X>&& obj) noexcept;
+
+    //! Assignment to an array expression
+    template <class E>
+    Array2D& operator=(const Array2D_Expr<E>& expr);
+
     // functions
 
     //! Returns minimum value
@@ -68,12 +94,27 @@ namespace Subs {
     //! Returns median value
     X median() const;
 
+    //! Returns median value, using caller-supplied workspace
+    X median(Buffer1D<X>& work) const;
+
     //! Returns a percentiles 
     X centile(float frac) const;
 
+    //! Returns a percentile, using caller-supplied workspace
+    X centile(float frac, Buffer1D<X>& work) const;
+
     //! Returns two percentiles 
     void centile(float frac1, float frac2, X& t1, X& t2) const;
 
+    //! Returns two percentiles, using caller-supplied workspace
+    void centile(float frac1, float frac2, X& t1, X& t2, Buffer1D<X>& work) const;
+
+    //! Returns any number of percentiles in one pass
+    void centile(int nfrac, const float* frac, X* t, Buffer1D<X>& work) const;
+
+    //! Returns a sketch for approximate percentiles
+    Quantile_sketch sketch(double compression=Quantile_sketch::COMPRESSION) const;
+
     //! Returns sum over all elements
     X sum() const;
 
@@ -106,6 +147,22 @@ namespace Subs {
 
     //! Division by an Array2D in place
     void operator/=(const Array2D<X>& img);
+
+    //! Addition of an array expression in place
+    template <class E>
+    void operator+=(const Array2D_Expr<E>& expr);
+
+    //! Subtraction of an array expression in place
+    template <class E>
+    void operator-=(const Array2D_Expr<E>& expr);
+
+    //! Multiplication by an array expression in place
+    template <class E>
+    void operator*=(const Array2D_Expr<E>& expr);
+
+    //! Division by an array expression in place
+    template <class E>
+    void operator/=(const Array2D_Expr<E>& expr);
     
     //! Binary output
     void write(std::ostream& ostr) const;
@@ -113,11 +170,31 @@ namespace Subs {
     //! Binary input
     void read(std::istream& istr);
     
-    //! Array2D = constant - Array2D
-    friend Array2D<X> operator-<>(const X& con, const Array2D<X>& img);
-    
     //! ASCII output
     friend std::ostream& operator<<<>(std::ostream& ost, const Array2D<X>& img);
+
+  private:
+
+    // Most elements of workspace kept by each thread between calls to centile
+    // and median; larger buffers are released once the call is over
+    static const int WORK_KEEP = 1 << 20;
+
+    // Workspace for centile and median owned by the calling thread
+    static Buffer1D<X>& work_buffer(){
+      static thread_local Buffer1D<X> work;
+      return work;
+    }
+
+    // Releases the thread's workspace when it goes out of scope if it has
+    // grown beyond WORK_KEEP elements, even if an exception is thrown
+    class Work_guard {
+    public:
+      Work_guard() : work(work_buffer()) {}
+      ~Work_guard(){
+	if(work.mem() > WORK_KEEP) work = Buffer1D<X>();
+      }
+      Buffer1D<X>& work;
+    };
     
   };
 
@@ -133,14 +210,38 @@ namespace Subs {
     return *this;
   }
 
+  template <class X>
+  Array2D<X>& Array2D<X>::operator=(Array2D<X>&& obj) noexcept {
+    this->Buffer2D<X>::operator=(std::move(obj));
+    return *this;
+  }
+
+  /** Evaluates an array expression such as a*b + c - 2. in a single pass
+   * over the data. The array is resized if need be. The array itself can
+   * appear in the expression, as in a = a + b, since each element is only
+   * read before it is written.
+   */
+  template <class X>
+  template <class E>
+  Array2D<X>& Array2D<X>::operator=(const Array2D_Expr<E>& expr){
+    if(this->get_ny() != expr.get_ny() || this->get_nx() != expr.get_nx())
+      this->resize(expr.get_ny(), expr.get_nx());
+    X* dptr = this->data();
+    const E& node = expr.node();
+    parallel_for(this->size(), [dptr,&node](int i1, int i2){
+	for(int i=i1; i<i2; i++)
+	  dptr[i] = X(node[i]);
+      });
+    return *this;
+  }
+
   template <class X>
   X Array2D<X>::max() const {
     if(this->get_ny()){
-      X t = this->ptr()[0][0];
-      for(int iy=0; iy<this->get_ny(); iy++)
-	for(int ix=0; ix<this->get_nx(); ix++)
-	  if(t < this->ptr()[iy][ix]) t = this->ptr()[iy][ix];
-      return t;
+      const X* dptr = this->data();
+      return parallel_reduce<X>(this->size(),
+				[dptr](int i1, int i2){return Simd::max(dptr+i1, i2-i1);},
+				[](const X& a, const X& b){return a < b ? b : a;});
     }else{
       throw Array2D_Error("X Array2D<X>::max(): operation undefined on null array");
     }
@@ -149,11 +250,10 @@ namespace Subs {
   template <class X>
   X Array2D<X>::min() const {
     if(this->get_ny()){
-      X t = this->ptr()[0][0];
-      for(int iy=0; iy<this->get_ny(); iy++)
-	for(int ix=0; ix<this->get_nx(); ix++)
-	  if(t > this->ptr()[iy][ix]) t = this->ptr()[iy][ix];
-      return t;
+      const X* dptr = this->data();
+      return parallel_reduce<X>(this->size(),
+				[dptr](int i1, int i2){return Simd::min(dptr+i1, i2-i1);},
+				[](const X& a, const X& b){return a > b ? b : a;});
     }else{
       throw Array2D_Error("X Array2D<X>::min(): operation undefined on null array");
     }
@@ -165,113 +265,157 @@ namespace Subs {
    */
   template <class X>
   X Array2D<X>::mean() const {
-    double t = 0;
-    for(int iy=0; iy<this->get_ny(); iy++)
-      for(int ix=0; ix<this->get_nx(); ix++)
-	t += double(this->ptr()[iy][ix]);
+    const X* dptr = this->data();
+    double t = parallel_reduce<double>(this->size(),
+				       [dptr](int i1, int i2){return Simd::sum_double(dptr+i1, i2-i1);},
+				       [](double a, double b){return a + b;});
     return X(t/this->size());
   }
 
   template <class X>
   X Array2D<X>::rms() const {
-    double t = 0, m = mean();
-    for(int iy=0; iy<this->get_ny(); iy++)
-      for(int ix=0; ix<this->get_nx(); ix++)
-	t += Subs::sqr(this->ptr()[iy][ix]-m);
+    const X* dptr = this->data();
+    const double m = mean();
+    double t = parallel_reduce<double>(this->size(),
+				       [dptr,m](int i1, int i2){return Simd::sumsq_dev(dptr+i1, i2-i1, m);},
+				       [](double a, double b){return a + b;});
     return std::sqrt(t/(std::max(this->size()-1,int(1))));
   }
 
+  /** This is the engine behind the other centile and median routines. The image
+   * is copied into the workspace and all the order statistics needed are
+   * selected in one multiselect pass. Percentiles between pixel values are
+   * interpolated linearly. Re-using the workspace between calls avoids
+   * allocating memory each time.
+   * \param nfrac number of percentiles
+   * \param frac  the percentiles, as fractions from 0 to 1
+   * \param t     returned with the values
+   * \param work  workspace, resized as need be
+   */
   template <class X>
-  X Array2D<X>::centile(float frac) const {
+  void Array2D<X>::centile(int nfrac, const float* frac, X* t, Buffer1D<X>& work) const {
     if(this->get_ny()){
 
-      unsigned long int nelem = this->size();
+      const int nelem = this->size();
 
-      X *ptr = new X[nelem];
-      this->get(ptr);
-
-      X t;
-      if(frac <= 0.f){
-	t = select(ptr, nelem, 0);
-      }else if(frac >= 1.f){
-	t = select(ptr, nelem, nelem-1);
-      }else{
-	double x = (nelem-1)*frac;
-	unsigned long int k = (unsigned long int)floor(x);
-	if(k == nelem-1){
-	  t = select(ptr, nelem, k);
+      // the ranks needed
+      std::vector<int> rank;
+      rank.reserve(2*nfrac);
+      for(int i=0; i<nfrac; i++){
+	if(frac[i] <= 0.f){
+	  rank.push_back(0);
+	}else if(frac[i] >= 1.f){
+	  rank.push_back(nelem-1);
 	}else{
-	  t = (k+1-x)*select(ptr, nelem, k) + (x-k)*select(ptr, nelem, k+1);
+	  int k = int(floor((nelem-1)*frac[i]));
+	  rank.push_back(k);
+	  if(k < nelem-1) rank.push_back(k+1);
+	}
+      }
+      std::sort(rank.begin(), rank.end());
+      rank.erase(std::unique(rank.begin(), rank.end()), rank.end());
+
+      work.resize(nelem);
+      std::copy(this->data(), this->data()+nelem, work.ptr());
+      const X* wptr = work.ptr();
+      multiselect(work.ptr(), nelem, rank.data(), rank.size());
+
+      for(int i=0; i<nfrac; i++){
+	if(frac[i] <= 0.f){
+	  t[i] = wptr[0];
+	}else if(frac[i] >= 1.f){
+	  t[i] = wptr[nelem-1];
+	}else{
+	  double x = (nelem-1)*frac[i];
+	  int k = int(floor(x));
+	  if(k == nelem-1){
+	    t[i] = wptr[k];
+	  }else{
+	    t[i] = (k+1-x)*wptr[k] + (x-k)*wptr[k+1];
+	  }
 	}
       }
-
-      delete[] ptr;
-      return t;
 
     }else{
-      throw Array2D_Error("X Array2D<X>::centile(float): operation undefined on null array");
+      throw Array2D_Error("void Array2D<X>::centile(int, const float*, X*, Buffer1D<X>&): operation undefined on null array");
     }
   }
 
+  /** Workspace of up to WORK_KEEP elements is kept by each thread between
+   * calls; larger workspace is freed after each call. Use the versions taking
+   * a workspace argument to control this.
+   */
   template <class X>
-  void Array2D<X>::centile(float frac1, float frac2, X& t1, X& t2) const {
-    if(this->nrow()){
-
-      unsigned long int nelem = this->size();
-
-      X *ptr = new X[nelem];
-      this->get(ptr);
+  X Array2D<X>::centile(float frac) const {
+    Work_guard guard;
+    return centile(frac, guard.work);
+  }
 
-      if(frac1 <= 0.f){
-	t1 = select(ptr, nelem, 0);
-      }else if(frac1 >= 1.f){
-	t1 = select(ptr, nelem, nelem-1);
-      }else{
-	double x1 = (nelem-1)*frac1;
-	unsigned long int k1 = (unsigned long int)floor(x1);
-	if(k1 == nelem-1){
-	  t1 = select(ptr, nelem, k1);
-	}else{
-	  t1 = (k1+1-x1)*select(ptr, nelem, k1) + (x1-k1)*select(ptr, nelem, k1+1);
-	}
-      }
+  template <class X>
+  X Array2D<X>::centile(float frac, Buffer1D<X>& work) const {
+    X t;
+    centile(1, &frac, &t, work);
+    return t;
+  }
 
-      if(frac2 <= 0.f){
-	t2 = select(ptr, nelem, 0);
-      }else if(frac2 >= 1.f){
-	t2 = select(ptr, nelem, nelem-1);
-      }else{
-	double x2 = (nelem-1)*frac2;
-	unsigned long int k2 = (unsigned long int)floor(x2);
-	if(k2 == nelem-1){
-	  t2 = select(ptr, nelem, k2);
-	}else{
-	  t2 = (k2+1-x2)*select(ptr, nelem, k2) + (x2-k2)*select(ptr, nelem, k2+1);
-	}
-      }
+  template <class X>
+  void Array2D<X>::centile(float frac1, float frac2, X& t1, X& t2) const {
+    Work_guard guard;
+    centile(frac1, frac2, t1, t2, guard.work);
+  }
 
-      delete[] ptr;
+  template <class X>
+  void Array2D<X>::centile(float frac1, float frac2, X& t1, X& t2, Buffer1D<X>& work) const {
+    float frac[2] = {frac1, frac2};
+    X t[2];
+    centile(2, frac, t, work);
+    t1 = t[0];
+    t2 = t[1];
+  }
 
-    }else{
-      throw Array2D_Error("X Array2D<X>::centile(float, float, X&, X&): operation undefined on null array");
-    }
+  /** For large images where exact percentiles are not needed (e.g. display
+   * scaling) this is faster than centile and needs no copy of the image. The
+   * image is summarised in blocks, in parallel if enabled, and the blocks
+   * merged, so the result does not depend upon the number of threads.
+   * \param compression see Quantile_sketch
+   * \return a sketch of the pixel values from which to call quantile
+   */
+  template <class X>
+  Quantile_sketch Array2D<X>::sketch(double compression) const {
+    const X* dptr = this->data();
+    return parallel_reduce<Quantile_sketch>(this->size(),
+					    [dptr,compression](int i1, int i2){
+					      Quantile_sketch qs(compression);
+					      qs.add(dptr+i1, i2-i1);
+					      return qs;
+					    },
+					    [](const Quantile_sketch& a, const Quantile_sketch& b){
+					      Quantile_sketch qs(a);
+					      qs.merge(b);
+					      return qs;
+					    });
   }
 
   template <class X>
   X Array2D<X>::median() const {
-    if(this->get_ny()){
-      unsigned long int nelem = this->size();
+    Work_guard guard;
+    return median(guard.work);
+  }
 
-      X *ptr = new X[nelem];
-      X med;
-      this->get(ptr);
+  template <class X>
+  X Array2D<X>::median(Buffer1D<X>& work) const {
+    if(this->get_ny()){
+      const int nelem = this->size();
+      work.resize(nelem);
+      std::copy(this->data(), this->data()+nelem, work.ptr());
+      X* wptr = work.ptr();
       if(nelem % 2 == 0){
-	med = (Subs::select(ptr, nelem, nelem/2-1) + Subs::select(ptr, nelem, nelem/2))/2;
+	int rank[2] = {nelem/2-1, nelem/2};
+	Subs::multiselect(wptr, nelem, rank, 2);
+	return (wptr[rank[0]] + wptr[rank[1]])/2;
       }else{
-	med = Subs::select(ptr, nelem, nelem/2);
+	return Subs::select(wptr, nelem, nelem/2);
       }
-      delete[] ptr;
-      return med;
     }else{
       throw Array2D_Error("X Array2D<X>::median(): operation undefined on null array");
     }
@@ -280,11 +424,10 @@ namespace Subs {
   template <class X>
   X Array2D<X>::sum() const {
     if(this->get_ny()){
-      X t = 0;
-      for(int iy=0; iy<this->get_ny(); iy++)
-	for(int ix=0; ix<this->get_nx(); ix++)
-	  t += this->ptr()[iy][ix];
-      return t;
+      const X* dptr = this->data();
+      return parallel_reduce<X>(this->size(),
+				[dptr](int i1, int i2){return Simd::sum(dptr+i1, i2-i1);},
+				[](const X& a, const X& b){return a + b;});
     }else{
       throw Array2D_Error("X Array2D<X>::sum(): operation undefined on null array");
     }
@@ -307,9 +450,8 @@ namespace Subs {
 
     template <class X>
     void Array2D<X>::sqrt(){
-	for(int iy=0; iy<this->get_ny(); iy++)
-	    for(int ix=0; ix<this->get_nx(); ix++)
-		this->ptr()[iy][ix] = std::sqrt(this->ptr()[iy][ix]);
+	X* dptr = this->data();
+	parallel_for(this->size(), [dptr](int i1, int i2){Simd::sqrt(dptr+i1, i2-i1);});
     }
 
     /** Converts all elements of the array to 0 or 1 depending on whether they are
@@ -319,39 +461,34 @@ namespace Subs {
      */
     template <class X>
     void Array2D<X>::step(const X& thresh) {
-	for(int iy=0; iy<this->get_ny(); iy++)
-	    for(int ix=0; ix<this->get_nx(); ix++)
-		this->ptr()[iy][ix] = this->ptr()[iy][ix] > thresh ? X(1) : X(0);
+	X* dptr = this->data();
+	parallel_for(this->size(), [dptr,&thresh](int i1, int i2){Simd::step(dptr+i1, i2-i1, thresh);});
     }
 
   // Arithematic
 
   template <class X>
   void Array2D<X>::operator+=(const X& con){
-    for(int iy=0; iy<this->get_ny(); iy++)
-      for(int ix=0; ix<this->get_nx(); ix++)
-	this->ptr()[iy][ix] += con;
+    X* dptr = this->data();
+    parallel_for(this->size(), [dptr,&con](int i1, int i2){Simd::add_const(dptr+i1, con, i2-i1);});
   }
 
   template <class X>
   void Array2D<X>::operator-=(const X& con){
-    for(int iy=0; iy<this->get_ny(); iy++)
-      for(int ix=0; ix<this->get_nx(); ix++)
-	this->ptr()[iy][ix] -= con;
+    X* dptr = this->data();
+    parallel_for(this->size(), [dptr,&con](int i1, int i2){Simd::sub_const(dptr+i1, con, i2-i1);});
   }
 
   template <class X>
   void Array2D<X>::operator*=(const X& con){
-    for(int iy=0; iy<this->get_ny(); iy++)
-      for(int ix=0; ix<this->get_nx(); ix++)
-	this->ptr()[iy][ix] *= con;
+    X* dptr = this->data();
+    parallel_for(this->size(), [dptr,&con](int i1, int i2){Simd::mul_const(dptr+i1, con, i2-i1);});
   }
 
   template <class X>
   void Array2D<X>::operator/=(const X& con){
-    for(int iy=0; iy<this->get_ny(); iy++)
-      for(int ix=0; ix<this->get_nx(); ix++)
-	this->ptr()[iy][ix] /= con;
+    X* dptr = this->data();
+    parallel_for(this->size(), [dptr,&con](int i1, int i2){Simd::div_const(dptr+i1, con, i2-i1);});
   }
 
   template <class X>
@@ -361,9 +498,9 @@ namespace Subs {
 			  + Subs::str(this->get_ny()) + "][" + Subs::str(this->get_nx()) + "] vs ["
 			  + Subs::str(img.get_ny()) + "][" + Subs::str(img.get_nx()) + "]");
     }else{
-      for(int iy=0; iy<this->get_ny(); iy++)
-	for(int ix=0; ix<this->get_nx(); ix++)
-	  this->ptr()[iy][ix] += img.ptr()[iy][ix];
+      X* dptr = this->data();
+      const X* iptr = img.data();
+      parallel_for(this->size(), [dptr,iptr](int i1, int i2){Simd::add(dptr+i1, iptr+i1, i2-i1);});
     }
   }
 
@@ -374,9 +511,9 @@ namespace Subs {
 			  + Subs::str(this->get_ny()) + "][" + Subs::str(this->get_nx()) + "] vs ["
 			  + Subs::str(img.get_ny()) + "][" + Subs::str(img.get_nx()) + "]");
     }else{
-      for(int iy=0; iy<this->get_ny(); iy++)
-	for(int ix=0; ix<this->get_nx(); ix++)
-	  this->ptr()[iy][ix] -= img.ptr()[iy][ix];
+      X* dptr = this->data();
+      const X* iptr = img.data();
+      parallel_for(this->size(), [dptr,iptr](int i1, int i2){Simd::sub(dptr+i1, iptr+i1, i2-i1);});
     }
   }
 
@@ -387,9 +524,9 @@ namespace Subs {
 			  + Subs::str(this->get_ny()) + "][" + Subs::str(this->get_nx()) + "] vs ["
 			  + Subs::str(img.get_ny()) + "][" + Subs::str(img.get_nx()) + "]");
     }else{
-      for(int iy=0; iy<this->get_ny(); iy++)
-	for(int ix=0; ix<this->get_nx(); ix++)
-	  this->ptr()[iy][ix] *= img.ptr()[iy][ix];
+      X* dptr = this->data();
+      const X* iptr = img.data();
+      parallel_for(this->size(), [dptr,iptr](int i1, int i2){Simd::mul(dptr+i1, iptr+i1, i2-i1);});
     }
   }
 
@@ -400,94 +537,143 @@ namespace Subs {
 			  + Subs::str(this->get_ny()) + "][" + Subs::str(this->get_nx()) + "] vs ["
 			  + Subs::str(img.get_ny()) + "][" + Subs::str(img.get_nx()) + "]");
     }else{
-      for(int iy=0; iy<this->get_ny(); iy++)
-	for(int ix=0; ix<this->get_nx(); ix++)
-	  this->ptr()[iy][ix] /= img.ptr()[iy][ix];
+      X* dptr = this->data();
+      const X* iptr = img.data();
+      parallel_for(this->size(), [dptr,iptr](int i1, int i2){Simd::div(dptr+i1, iptr+i1, i2-i1);});
     }
   }
 
-  // non-member arithematic functions
   template <class X>
-  Array2D<X> operator+(const Array2D<X>& img1, const Array2D<X>& img2){
-    Array2D<X> temp = img1;
-    temp += img2;
-    return temp;
+  template <class E>
+  void Array2D<X>::operator+=(const Array2D_Expr<E>& expr){
+    if(this->get_ny() != expr.get_ny() || this->get_nx() != expr.get_nx()){
+      throw Array2D_Error("void Array2D<X>::operator+=(const Array2D_Expr<E>&): mis-matching array dimensions; ["
+			  + Subs::str(this->get_ny()) + "][" + Subs::str(this->get_nx()) + "] vs ["
+			  + Subs::str(expr.get_ny()) + "][" + Subs::str(expr.get_nx()) + "]");
+    }else{
+      X* dptr = this->data();
+      const E& node = expr.node();
+      parallel_for(this->size(), [dptr,&node](int i1, int i2){
+	  for(int i=i1; i<i2; i++)
+	    dptr[i] += node[i];
+	});
+    }
   }
 
   template <class X>
-  Array2D<X> operator+(const Array2D<X>& img, const X& con){
-    Array2D<X> temp = img;
-    temp += con;
-    return temp;
+  template <class E>
+  void Array2D<X>::operator-=(const Array2D_Expr<E>& expr){
+    if(this->get_ny() != expr.get_ny() || this->get_nx() != expr.get_nx()){
+      throw Array2D_Error("void Array2D<X>::operator-=(const Array2D_Expr<E>&): mis-matching array dimensions; ["
+			  + Subs::str(this->get_ny()) + "][" + Subs::str(this->get_nx()) + "] vs ["
+			  + Subs::str(expr.get_ny()) + "][" + Subs::str(expr.get_nx()) + "]");
+    }else{
+      X* dptr = this->data();
+      const E& node = expr.node();
+      parallel_for(this->size(), [dptr,&node](int i1, int i2){
+	  for(int i=i1; i<i2; i++)
+	    dptr[i] -= node[i];
+	});
+    }
   }
 
   template <class X>
-  Array2D<X> operator+(const X& con, const Array2D<X>& img){
-    Array2D<X> temp = img;
-    temp += con;
-    return temp;
+  template <class E>
+  void Array2D<X>::operator*=(const Array2D_Expr<E>& expr){
+    if(this->get_ny() != expr.get_ny() || this->get_nx() != expr.get_nx()){
+      throw Array2D_Error("void Array2D<X>::operator*=(const Array2D_Expr<E>&): mis-matching array dimensions; ["
+			  + Subs::str(this->get_ny()) + "][" + Subs::str(this->get_nx()) + "] vs ["
+			  + Subs::str(expr.get_ny()) + "][" + Subs::str(expr.get_nx()) + "]");
+    }else{
+      X* dptr = this->data();
+      const E& node = expr.node();
+      parallel_for(this->size(), [dptr,&node](int i1, int i2){
+	  for(int i=i1; i<i2; i++)
+	    dptr[i] *= node[i];
+	});
+    }
   }
 
   template <class X>
-  Array2D<X> operator-(const Array2D<X>& img1, const Array2D<X>& img2){
-    Array2D<X> temp = img1;
-    temp -= img2;
-    return temp;
+  template <class E>
+  void Array2D<X>::operator/=(const Array2D_Expr<E>& expr){
+    if(this->get_ny() != expr.get_ny() || this->get_nx() != expr.get_nx()){
+      throw Array2D_Error("void Array2D<X>::operator/=(const Array2D_Expr<E>&): mis-matching array dimensions; ["
+			  + Subs::str(this->get_ny()) + "][" + Subs::str(this->get_nx()) + "] vs ["
+			  + Subs::str(expr.get_ny()) + "][" + Subs::str(expr.get_nx()) + "]");
+    }else{
+      X* dptr = this->data();
+      const E& node = expr.node();
+      parallel_for(this->size(), [dptr,&node](int i1, int i2){
+	  for(int i=i1; i<i2; i++)
+	    dptr[i] /= node[i];
+	});
+    }
   }
 
-  template <class X>
-  Array2D<X> operator-(const Array2D<X>& img, const X& con){
-    Array2D<X> temp = img;
-    temp -= con;
-    return temp;
-  }
+  // non-member arithematic functions. These return unevaluated expressions
+  // which are only computed when assigned to an Array2D; see array_expr.h
 
-  template <class X>
-  Array2D<X> operator-(const X& con, const Array2D<X>& img){
-    Array2D<X> temp(img.get_ny(),img.get_nx());
-    if(img.get_ny()){
-      for(int iy=0; iy<img.get_ny(); iy++)
-	for(int ix=0; ix<img.get_nx(); ix++)
-	  temp.ptr()[iy][ix] = con - img.ptr()[iy][ix];
-    }else{
-      throw Array2D_Error("X Array2D<X>::operator-(X& con, Array2D<X>): operation undefined on null array");
+  namespace Expr {
+
+    //! Dimensions of a 2D operand; returns false for a constant
+    template <class T>
+    typename std::enable_if<is_scalar<T>::value, bool>::type
+    dims(const T&, int&, int&){return false;}
+
+    template <class T>
+    typename std::enable_if<!is_scalar<T>::value, bool>::type
+    dims(const T& t, int& ny, int& nx){
+      ny = t.get_ny();
+      nx = t.get_nx();
+      return true;
+    }
+
+    //! Type of the 2D expression combining A and B with Op
+    template <class Op, class A, class B>
+    struct binary_2d {
+      typedef Binary<Op, decltype(operand(std::declval<const A&>(), std::declval<const B&>())),
+		     decltype(operand(std::declval<const B&>(), std::declval<const A&>()))> node_t;
+      typedef Array2D_Expr<node_t> type;
+    };
+
+    //! Combines two operands into a 2D expression, checking their dimensions
+    template <class Op, class A, class B>
+    typename binary_2d<Op,A,B>::type combine_2d(const A& a, const B& b, const char* func){
+      int nya, nxa, nyb, nxb;
+      bool ia = dims(a, nya, nxa), ib = dims(b, nyb, nxb);
+      if(ia && ib && (nya != nyb || nxa != nxb))
+	throw Array2D_Error(std::string(func) + ": mis-matching array dimensions; ["
+			    + Subs::str(nya) + "][" + Subs::str(nxa) + "] vs ["
+			    + Subs::str(nyb) + "][" + Subs::str(nxb) + "]");
+      typedef typename binary_2d<Op,A,B>::node_t node_t;
+      return typename binary_2d<Op,A,B>::type(node_t(operand(a,b), operand(b,a)), ia ? nya : nyb, ia ? nxa : nxb);
     }
-    return temp;
-  }
 
-  template <class X>
-  Array2D<X> operator*(const Array2D<X>& img, const X& con){
-    Array2D<X> temp = img;
-    temp *= con;
-    return temp;
   }
 
-  template <class X>
-  Array2D<X> operator*(const X& con, const Array2D<X>& img){
-    Array2D<X> temp = img;
-    temp *= con;
-    return temp;
+  //! Adds two Array2Ds (or an Array2D and a constant) element by element, lazily
+  template <class A, class B, class = typename std::enable_if<Expr::is_2d_pair<A,B>::value>::type>
+  typename Expr::binary_2d<Expr::Add,A,B>::type operator+(const A& a, const B& b){
+    return Expr::combine_2d<Expr::Add>(a, b, "operator+(const A&, const B&)");
   }
 
-  template <class X>
-  Array2D<X> operator*(const Array2D<X>& img1, const Array2D<X>& img2){
-    Array2D<X> temp = img1;
-    temp *= img2;
-    return temp;
+  //! Subtracts two Array2Ds (or an Array2D and a constant) element by element, lazily
+  template <class A, class B, class = typename std::enable_if<Expr::is_2d_pair<A,B>::value>::type>
+  typename Expr::binary_2d<Expr::Sub,A,B>::type operator-(const A& a, const B& b){
+    return Expr::combine_2d<Expr::Sub>(a, b, "operator-(const A&, const B&)");
   }
 
-  template <class X>
-  Array2D<X> operator/(const Array2D<X>& img, const X& con){
-    Array2D<X> temp = img;
-    temp /= con;
-    return temp;
+  //! Multiplies two Array2Ds (or an Array2D and a constant) element by element, lazily
+  template <class A, class B, class = typename std::enable_if<Expr::is_2d_pair<A,B>::value>::type>
+  typename Expr::binary_2d<Expr::Mul,A,B>::type operator*(const A& a, const B& b){
+    return Expr::combine_2d<Expr::Mul>(a, b, "operator*(const A&, const B&)");
   }
 
-  template <class X>
-  Array2D<X> operator/(const Array2D<X>& img1, const Array2D<X>& img2){
-    Array2D<X> temp = img1;
-    temp /= img2;
-    return temp;
+  //! Divides two Array2Ds (or an Array2D and a constant) element by element, lazily
+  template <class A, class B, class = typename std::enable_if<Expr::is_2d_pair<A,B>::value>::type>
+  typename Expr::binary_2d<Expr::Div,A,B>::type operator/(const A& a, const B& b){
+    return Expr::combine_2d<Expr::Div>(a, b, "operator/(const A&, const B&)");
   }
 
   template <class X>
@@ -543,13 +729,54 @@ namespace Subs {
     }
   }
 
+  //! ASCII output of an image expression
+  template <class E>
+  std::ostream& operator<<(std::ostream& ost, const Array2D_Expr<E>& expr){
+    return ost << expr.eval();
+  }
+
+  //! Returns the maximum value of an image expression
+  template <class E>
+  typename Array2D_Expr<E>::value_type max(const Array2D_Expr<E>& expr){
+    return expr.max();
+  }
+
+  //! Returns the minimum value of an image expression
+  template <class E>
+  typename Array2D_Expr<E>::value_type min(const Array2D_Expr<E>& expr){
+    return expr.min();
+  }
+
+  //! Returns the sum of an image expression
+  template <class E>
+  typename Array2D_Expr<E>::value_type sum(const Array2D_Expr<E>& expr){
+    return expr.sum();
+  }
+
+  //! Plots an image expression as a grey scale
+  template <class E>
+  void pggray(const Array2D_Expr<E>& expr, float a1, float a2, float* tr){
+    pggray(expr.eval(), a1, a2, tr);
+  }
+
+  //! Plots an image expression in colour
+  template <class E>
+  void pgimag(const Array2D_Expr<E>& expr, float a1, float a2, float tr[]){
+    pgimag(expr.eval(), a1, a2, tr);
+  }
+
+  //! Contours an image expression
+  template <class E>
+  void pgcont(const Array2D_Expr<E>& expr, float c[], int nc, float tr[]){
+    pgcont(expr.eval(), c, nc, tr);
+  }
+
   template <class X>
   void Array2D<X>::write(std::ostream& ostr) const {
     int ny = this->get_ny(), nx = this->get_nx();
     ostr.write((char*)&ny,sizeof(ny));
     ostr.write((char*)&nx,sizeof(nx));
-    for(int iy=0; iy<ny; iy++)
-      ostr.write((char*)this->ptr()[iy],sizeof(X[nx]));
+    ostr.write((char*)this->data(),sizeof(X)*this->size());
   }
 
   template <class X>
@@ -558,8 +785,73 @@ namespace Subs {
     istr.read((char*)&ny,sizeof(ny));
     istr.read((char*)&nx,sizeof(nx));
     this->resize(ny,nx);
-    for(int iy=0; iy<ny; iy++)
-      istr.read((char*)this->ptr()[iy],sizeof(X[nx]));
+    istr.read((char*)this->data(),sizeof(X)*this->size());
+  }
+
+  /** Median filter of an image over a box of wx by wy pixels, e.g. to make a
+   * background map. Near the edges the box is truncated, and the value returned
+   * is then the upper of the middle two if the number of pixels is even, as
+   * with the 1D medfilt. The box slides along each row with a Running_median,
+   * so the cost per pixel scales as wy log(wx wy) rather than wx wy log(wx wy).
+   * Rows are split across threads if enabled by set_nthreads.
+   * \param data the image to be filtered
+   * \param filt the filtered image, which can be data itself
+   * \param wx   width of the box in X (odd)
+   * \param wy   width of the box in Y (odd)
+   */
+  template <class X>
+  void medfilt(const Array2D<X>& data, Array2D<X>& filt, int wx, int wy){
+
+    if(wx % 2 == 0 || wy % 2 == 0)
+      throw Array2D_Error("void Subs::medfilt(const Array2D<X>&, Array2D<X>&, int, int): filter widths must be odd");
+
+    // each row is computed from the rows around it
+    if(&data == &filt){
+      Array2D<X> copy(data);
+      medfilt(copy, filt, wx, wy);
+      return;
+    }
+
+    const int nx = data.get_nx(), ny = data.get_ny();
+    const int hx = wx/2, hy = wy/2;
+    filt.resize(ny,nx);
+
+    // Filters rows iy1 to iy2-1
+    auto rows = [&](int iy1, int iy2){
+      Running_median<X> rmed(wx*wy);
+      for(int iy=iy1; iy<iy2; iy++){
+	const int y1 = std::max(iy-hy, 0), y2 = std::min(iy+hy+1, ny);
+	rmed.clear();
+	for(int jx=0; jx<std::min(hx, nx); jx++)
+	  for(int jy=y1; jy<y2; jy++)
+	    rmed.insert(wx*(jy % wy) + jx % wx, data[jy][jx]);
+	for(int ix=0; ix<nx; ix++){
+	  if(ix-hx-1 >= 0){
+	    const int jx = ix-hx-1;
+	    for(int jy=y1; jy<y2; jy++)
+	      rmed.remove(wx*(jy % wy) + jx % wx);
+	  }
+	  if(ix+hx < nx){
+	    const int jx = ix+hx;
+	    for(int jy=y1; jy<y2; jy++)
+	      rmed.insert(wx*(jy % wy) + jx % wx, data[jy][jx]);
+	  }
+	  filt[iy][ix] = rmed.median();
+	}
+      }
+    };
+
+    const int nthreads = get_nthreads();
+    if(nthreads > 1 && data.size() >= PARALLEL_MIN && ny > 1){
+      const int nchunk = std::min(4*nthreads, ny);
+      const int nper   = (ny+nchunk-1)/nchunk;
+      parallel_run(nchunk, [&](int ichunk){
+	  int iy1 = ichunk*nper, iy2 = std::min(ny, iy1+nper);
+	  if(iy1 < iy2) rows(iy1, iy2);
+	});
+    }else{
+      rows(0, ny);
+    }
   }
 
 };
@@ -0,0 +1,330 @@
+#ifndef TRM_SUBS_ARRAY_EXPR
+#define TRM_SUBS_ARRAY_EXPR
+
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+#include "trm/subs.h"
+#include "trm/quantile.h"
+
+namespace Subs {
+
+  //! Expression templates for Array1D and Array2D arithmetic
+
+  /** The non-member arithmetic operators of Array1D and Array2D do not
+   * compute anything. Instead they return lightweight objects which
+   * record the operation and refer to the operands. Only when such an
+   * object is assigned to (or used to construct) an array is the whole
+   * expression evaluated, in a single pass over the elements with no
+   * intermediate arrays. Thus a = b*c + d - 2. reads b, c and d once and
+   * writes a once.
+   *
+   * Expressions hold pointers to the data of their operands, so they should
+   * be evaluated within the statement that creates them and not stored.
+   */
+  namespace Expr {
+
+    //! Addition
+    struct Add {
+      template <class A, class B>
+      static auto apply(const A& a, const B& b) -> decltype(a+b) {return a+b;}
+    };
+
+    //! Subtraction
+    struct Sub {
+      template <class A, class B>
+      static auto apply(const A& a, const B& b) -> decltype(a-b) {return a-b;}
+    };
+
+    //! Multiplication
+    struct Mul {
+      template <class A, class B>
+      static auto apply(const A& a, const B& b) -> decltype(a*b) {return a*b;}
+    };
+
+    //! Division
+    struct Div {
+      template <class A, class B>
+      static auto apply(const A& a, const B& b) -> decltype(a/b) {return a/b;}
+    };
+
+    //! Leaf node referring to the elements of an array
+    template <class X>
+    class Leaf {
+    public:
+      typedef X value_type;
+      explicit Leaf(const X* ptr) : ptr(ptr) {}
+      const X& operator[](size_t i) const {return ptr[i];}
+    private:
+      const X* ptr;
+    };
+
+    //! Leaf node standing for a constant
+    template <class X>
+    class Scalar {
+    public:
+      typedef X value_type;
+      explicit Scalar(const X& val) : val(val) {}
+      const X& operator[](size_t) const {return val;}
+    private:
+      X val;
+    };
+
+    //! Node combining two others element by element
+    template <class Op, class L, class R>
+    class Binary {
+    public:
+      typedef decltype(Op::apply(std::declval<typename L::value_type>(),
+				 std::declval<typename R::value_type>())) value_type;
+      Binary(const L& l, const R& r) : l(l), r(r) {}
+      value_type operator[](size_t i) const {return Op::apply(l[i], r[i]);}
+    private:
+      L l;
+      R r;
+    };
+
+  }
+
+  //! An unevaluated 1D array expression
+  /** These are returned by the arithmetic operators of Array1D. Array1D
+   * can be constructed from, assigned from and updated in place with them.
+   * So that code written when the operators returned an Array1D still
+   * works, the members of Array1D that return a value and the free functions taking one,
+   * such as max and pgline, also accept expressions; these evaluate the
+   * expression into a temporary Array1D first.
+   */
+  template <class E>
+  class Array1D_Expr {
+  public:
+
+    //! Type of the elements
+    typedef typename E::value_type value_type;
+
+    //! Constructor from a node and the number of elements
+    Array1D_Expr(const E& node, int npix) : node_(node), npix(npix) {}
+
+    //! Returns the number of elements
+    int size() const {return npix;}
+
+    //! Returns the value of element i
+    value_type operator[](int i) const {return node_[i];}
+
+    //! Returns the top node of the expression
+    const E& node() const {return node_;}
+
+    //! Evaluates the expression into an Array1D
+    Array1D<value_type> eval() const {return Array1D<value_type>(*this);}
+
+    //! Returns maximum value
+    value_type max() const {return eval().max();}
+
+    //! Returns minimum value
+    value_type min() const {return eval().min();}
+
+    //! Determines whether values are monotonic
+    bool monotonic() const {return eval().monotonic();}
+
+    //! Return percentile (pcent from 0 to 100)
+    value_type centile(double pcent) const {return eval().centile(pcent);}
+
+    //! Return value of k-th smallest element
+    value_type select(int k) const {return eval().select(k);}
+
+    //! Returns median
+    value_type median() const {return eval().median();}
+
+    //! Returns a sketch for approximate percentiles
+    Quantile_sketch sketch(double compression=Quantile_sketch::COMPRESSION) const {return eval().sketch(compression);}
+
+    //! Returns sum
+    value_type sum() const {return eval().sum();}
+
+    //! Returns mean
+    value_type mean() const {return eval().mean();}
+
+    //! Returns length in Euclidean sense
+    value_type length() const {return eval().length();}
+
+  private:
+    E node_;
+    int npix;
+  };
+
+  //! An unevaluated 2D array expression
+  /** These are returned by the arithmetic operators of Array2D. Array2D
+   * can be constructed from, assigned from and updated in place with them.
+   * They are indexed by the position in the contiguous data block of Buffer2D.
+   * As with Array1D_Expr, the members of Array2D that return a value and the free
+   * functions taking one, such as max and pggray, also accept expressions,
+   * which are evaluated into a temporary Array2D first.
+   */
+  template <class E>
+  class Array2D_Expr {
+  public:
+
+    //! Type of the elements
+    typedef typename E::value_type value_type;
+
+    //! Constructor from a node and the dimensions
+    Array2D_Expr(const E& node, int ny, int nx) : node_(node), ny(ny), nx(nx) {}
+
+    //! Returns the number of rows
+    int get_ny() const {return ny;}
+
+    //! Returns the number of columns
+    int get_nx() const {return nx;}
+
+    //! Returns the number of elements
+    int size() const {return nx*ny;}
+
+    //! Returns the value of element i in the flattened array
+    value_type operator[](int i) const {return node_[i];}
+
+    //! Returns the top node of the expression
+    const E& node() const {return node_;}
+
+    //! Evaluates the expression into an Array2D
+    Array2D<value_type> eval() const {return Array2D<value_type>(*this);}
+
+    //! Returns minimum value
+    value_type min() const {return eval().min();}
+
+    //! Returns maximum value
+    value_type max() const {return eval().max();}
+
+    //! Returns mean value
+    value_type mean() const {return eval().mean();}
+
+    //! Returns RMS value
+    value_type rms() const {return eval().rms();}
+
+    //! Returns median value
+    value_type median() const {return eval().median();}
+
+    //! Returns a centile
+    value_type centile(float frac) const {return eval().centile(frac);}
+
+    //! Returns two centiles
+    void centile(float frac1, float frac2, value_type& t1, value_type& t2) const {eval().centile(frac1, frac2, t1, t2);}
+
+    //! Returns a sketch for approximate percentiles
+    Quantile_sketch sketch(double compression=Quantile_sketch::COMPRESSION) const {return eval().sketch(compression);}
+
+    //! Returns sum
+    value_type sum() const {return eval().sum();}
+
+  private:
+    E node_;
+    int ny, nx;
+  };
+
+  namespace Expr {
+
+    // Tests of whether a type can act as an operand of 1D or 2D expressions,
+    // including classes derived from Array1D such as Poly.
+    template <class X> std::true_type  is_1d_test(const Array1D<X>*);
+    template <class E> std::true_type  is_1d_test(const Array1D_Expr<E>*);
+    std::false_type is_1d_test(...);
+
+    template <class X> std::true_type  is_2d_test(const Array2D<X>*);
+    template <class E> std::true_type  is_2d_test(const Array2D_Expr<E>*);
+    std::false_type is_2d_test(...);
+
+    //! True for Array1D (and derived classes) and Array1D_Expr
+    template <class T>
+    struct is_1d : decltype(is_1d_test(std::declval<const T*>())) {};
+
+    //! True for Array2D (and derived classes) and Array2D_Expr
+    template <class T>
+    struct is_2d : decltype(is_2d_test(std::declval<const T*>())) {};
+
+    //! True for Array1D_Expr and Array2D_Expr
+    template <class T>
+    struct is_expr : std::false_type {};
+
+    template <class E>
+    struct is_expr<Array1D_Expr<E> > : std::true_type {};
+
+    template <class E>
+    struct is_expr<Array2D_Expr<E> > : std::true_type {};
+
+    //! True if functions of arrays A and B need forwarding because one is an expression
+    template <class A, class B>
+    struct is_1d_expr_pair : std::integral_constant<bool,
+      is_1d<A>::value && is_1d<B>::value && (is_expr<A>::value || is_expr<B>::value)> {};
+
+    //! Returns an array as it is, for functions of arrays that also take expressions
+    template <class X>
+    const Array1D<X>& eval(const Array1D<X>& vec){return vec;}
+
+    //! Returns an expression evaluated into an array
+    template <class E>
+    Array1D<typename E::value_type> eval(const Array1D_Expr<E>& expr){return expr.eval();}
+
+    //! True for the types allowed as constants in expressions
+    template <class T>
+    struct is_scalar : std::is_arithmetic<T> {};
+
+    //! Returns the node representing an Array1D
+    template <class X>
+    Leaf<X> node(const Array1D<X>& vec){
+      return Leaf<X>(vec.ptr());
+    }
+
+    //! Returns the node representing an Array2D
+    template <class X>
+    Leaf<X> node(const Array2D<X>& img){
+      return Leaf<X>(img.data());
+    }
+
+    //! Returns the top node of a 1D expression
+    template <class E>
+    const E& node(const Array1D_Expr<E>& expr){
+      return expr.node();
+    }
+
+    //! Returns the top node of a 2D expression
+    template <class E>
+    const E& node(const Array2D_Expr<E>& expr){
+      return expr.node();
+    }
+
+    //! Type of the node representing an operand
+    template <class T>
+    struct node_type {
+      typedef typename std::decay<decltype(node(std::declval<const T&>()))>::type type;
+    };
+
+    //! Type of the node representing a constant combined with an operand of type T
+    template <class T>
+    struct scalar_type {
+      typedef Scalar<typename node_type<T>::type::value_type> type;
+    };
+
+    //! Node of an operand which is an array or expression
+    template <class T, class O>
+    typename std::enable_if<!is_scalar<T>::value, node_type<T> >::type::type
+    operand(const T& t, const O&){return node(t);}
+
+    //! Node of a constant, converted to the element type of the other operand
+    template <class T, class O>
+    typename std::enable_if<is_scalar<T>::value, scalar_type<O> >::type::type
+    operand(const T& t, const O&){return typename scalar_type<O>::type(t);}
+
+    //! True if A and B can be combined into a 1D expression
+    template <class A, class B>
+    struct is_1d_pair : std::integral_constant<bool,
+      (is_1d<A>::value && (is_1d<B>::value || is_scalar<B>::value)) ||
+      (is_scalar<A>::value && is_1d<B>::value)> {};
+
+    //! True if A and B can be combined into a 2D expression
+    template <class A, class B>
+    struct is_2d_pair : std::integral_constant<bool,
+      (is_2d<A>::value && (is_2d<B>::value || is_scalar<B>::value)) ||
+      (is_scalar<A>::value && is_2d<B>::value)> {};
+
+  }
+
+}
+
+#endif
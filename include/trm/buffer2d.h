@@ -1,6 +1,8 @@
 #ifndef TRM_BUFFER2D
 #define TRM_BUFFER2D
 
+#include <new>
+#include <memory>
 #include "trm/subs.h"
 
 namespace Subs {
@@ -18,14 +20,23 @@ namespace Subs {
    * It creates pointers to the array which can then be used
    * in the usual way as a C-style 2D array. The big advantage is that
    * the pointers are automatically deleted when the Buffer2D goes out of scope. 
+   *
+   * The elements are held in a single contiguous block aligned on a cache line
+   * (ALIGN bytes), stored row by row, and the row pointers point into this block.
+   * data() returns the start of the block, and element [iy][ix] lives at
+   * data()[stride()*iy+ix]. Since there is no padding between rows, whole-array
+   * operations can be run as single loops over size() elements.
    * \sa Array2D for handling arithematic on arrays.
    */
   template <class X>
   class Buffer2D {
   public:
 
+    //! Alignment in bytes of the data block
+    static const size_t ALIGN = 64;
+
     //! Default constructor
-    Buffer2D() : nx_(0), ny_(0), buff(NULL) {}
+    Buffer2D() : nx_(0), ny_(0), buff(NULL), data_(NULL) {}
 
     //! Constructor grabbing space
     Buffer2D(int ny, int nx);
@@ -33,12 +44,22 @@ namespace Subs {
     //! Copy constructor
     Buffer2D(const Buffer2D& obj);
 
+    //! Move constructor
+    Buffer2D(Buffer2D&& obj) noexcept : nx_(obj.nx_), ny_(obj.ny_), buff(obj.buff), data_(obj.data_) {
+      obj.nx_ = obj.ny_ = 0;
+      obj.buff  = NULL;
+      obj.data_ = NULL;
+    }
+
     //! Assignment
     void operator=(const X& x);
 
     //! Assignment
     Buffer2D& operator=(const Buffer2D& obj);
 
+    //! Move assignment
+    Buffer2D& operator=(Buffer2D&& obj) noexcept;
+
     //! Destructor
     ~Buffer2D(){
       dealloc();
@@ -62,6 +83,15 @@ namespace Subs {
     //! Returns total number of elements
     int size() const {return nx_*ny_;}
 
+    //! Returns the number of elements between the starts of successive rows
+    int stride() const {return nx_;}
+
+    //! Returns pointer to the contiguous block of size() elements
+    X* data() {return data_;}
+
+    //! Returns pointer to the contiguous block of size() elements
+    const X* data() const {return data_;}
+
     //! Conversion to 2D C-type array
     operator X** const () const {return buff;}
 
@@ -105,6 +135,9 @@ namespace Subs {
 
     // The pointer (to an array of pointers)
     X** buff;
+
+    // The contiguous block that the row pointers point into
+    X* data_;
     
     // sets up memory buffers correctly (for first time)
     void alloc(int ny, int nx);
@@ -118,7 +151,8 @@ namespace Subs {
   void Buffer2D<X>::alloc(int ny, int nx) {
     if(nx == 0 && ny == 0){
       nx_ = ny_ = 0;
-      buff = NULL;
+      buff  = NULL;
+      data_ = NULL;
     }else{
       nx_ = nx;
       ny_ = ny;
@@ -126,27 +160,42 @@ namespace Subs {
 	  throw Buffer2D_Error("Subs::Buffer2D<>::alloc(int, int): nx,ny = " + Subs::str(nx) + ", " + Subs::str(ny));
       
       if((buff = new(std::nothrow) X* [ny]) == NULL){
-	buff = NULL;
+	buff  = NULL;
+	data_ = NULL;
 	throw Buffer2D_Error("Subs::Buffer2D<>::alloc(int, int): failed to allocate memory (1)");
       }
-      for(int iy=0; iy<ny; iy++){
-	if((buff[iy] = new(std::nothrow) X [nx]) == NULL){
-	  for(int jy=0; jy<iy; jy++)
-	    delete[] buff[jy];
-	  delete[] buff;	    
-	  buff = NULL;
-	  throw Buffer2D_Error("Subs::Buffer2D<>::alloc(int, int): failed to allocate memory (2)");
-	}
+
+      // One block for all the elements, aligned on a cache line
+      size_t nelem = size_t(nx)*size_t(ny);
+      if((data_ = static_cast<X*>(::operator new[](nelem*sizeof(X), std::align_val_t(ALIGN), std::nothrow))) == NULL){
+	delete[] buff;
+	buff = NULL;
+	throw Buffer2D_Error("Subs::Buffer2D<>::alloc(int, int): failed to allocate memory (2)");
+      }
+      try{
+	std::uninitialized_default_construct_n(data_, nelem);
+      }
+      catch(...){
+	::operator delete[](data_, std::align_val_t(ALIGN));
+	delete[] buff;
+	buff  = NULL;
+	data_ = NULL;
+	throw;
       }
+
+      for(int iy=0; iy<ny; iy++)
+	buff[iy] = data_ + size_t(nx)*iy;
     }
   }
 
   template <class X> 
   void Buffer2D<X>::dealloc() {
     if(buff != NULL){
-      for(int iy=0; iy<ny_; iy++)
-	delete[] buff[iy];
+      std::destroy_n(data_, size());
+      ::operator delete[](data_, std::align_val_t(ALIGN));
       delete[] buff;
+      buff  = NULL;
+      data_ = NULL;
     }
   }
 
@@ -184,9 +233,7 @@ namespace Subs {
     }
 
     // copy over data
-    for(int iy=0; iy<ny_; iy++)
-      for(int ix=0; ix<nx_; ix++)
-	buff[iy][ix] = obj.buff[iy][ix];
+    std::copy(obj.data_, obj.data_+size(), data_);
   }
 
   template <class X> 
@@ -206,9 +253,29 @@ namespace Subs {
     }
 	
     // copy over data
-    for(int iy=0; iy<ny_; iy++)
-      for(int ix=0; ix<nx_; ix++)
-	buff[iy][ix] = obj.buff[iy][ix];
+    std::copy(obj.data_, obj.data_+size(), data_);
+
+    return *this;
+  }
+
+  /** Takes over the memory of a Buffer2D that is about to disappear
+   * rather than copying it. The Buffer2D moved from is left empty.
+   */
+  template <class X> 
+  Buffer2D<X>& Buffer2D<X>::operator=(Buffer2D<X>&& obj) noexcept {
+
+    if(this == &obj) return *this;
+
+    dealloc();
+
+    nx_   = obj.nx_;
+    ny_   = obj.ny_;
+    buff  = obj.buff;
+    data_ = obj.data_;
+
+    obj.nx_ = obj.ny_ = 0;
+    obj.buff  = NULL;
+    obj.data_ = NULL;
 
     return *this;
   }
@@ -237,9 +304,7 @@ namespace Subs {
    */
   template <class X>
   void Buffer2D<X>::operator=(const X& x){
-    for(int iy=0; iy<ny_; iy++)
-      for(int ix=0; ix<nx_; ix++)
-	buff[iy][ix] = x;
+    std::fill(data_, data_+size(), x);
   }
 
   /** Copies all the array values into an ordinary C style 2D array
@@ -259,9 +324,9 @@ namespace Subs {
   template <class X> 
   template <class Y>
   void Buffer2D<X>::get(Y* ar) const {
-    for(int iy=0, k=0; iy<ny_; iy++)
-      for(int ix=0; ix<nx_; ix++, k++)
-	ar[k] = Y(buff[iy][ix]);
+    const int nelem = size();
+    for(int k=0; k<nelem; k++)
+      ar[k] = Y(data_[k]);
   }
 
   /** Copies all the values from an ordinary C style 1D array.
@@ -269,9 +334,9 @@ namespace Subs {
   template <class X> 
   template <class Y>
   void Buffer2D<X>::set(Y* ar) {
-    for(int iy=0, k=0; iy<ny_; iy++)
-      for(int ix=0; ix<nx_; ix++, k++)
-	buff[iy][ix] = X(ar[k]);
+    const int nelem = size();
+    for(int k=0; k<nelem; k++)
+      data_[k] = X(ar[k]);
   }
 
   //! ASCII output
@@ -0,0 +1,395 @@
+#ifndef TRM_SUBS_CONVOLVE
+#define TRM_SUBS_CONVOLVE
+
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "trm/subs.h"
+#include "trm/array2d.h"
+#include "trm/fft.h"
+#include "trm/filter.h"
+
+namespace Subs {
+
+  //! Convolution and cross-correlation of spectra and images
+
+  /** convolve and correlate give results the same size as the data, with the
+   * kernel centred on element nk/2 (in each dimension for images) and the
+   * data taken to be zero beyond their ends. Thus the convolution is
+   *
+   *   result[i] = sum_j kernel[j] data[i+nk/2-j]
+   *
+   * and the correlation
+   *
+   *   result[i] = sum_j kernel[j] data[i+j-nk/2]
+   *
+   * so that element i of a correlation is at lag i-nk/2.
+   *
+   * Three methods are available: direct summation, overlap-add, in which the
+   * data are cut into blocks each convolved by FFT, and a single FFT of the
+   * whole array. By default the one expected to be fastest is chosen from the
+   * sizes of the data and kernel: direct summation for small kernels,
+   * overlap-add for kernels much smaller than the data and one FFT otherwise.
+   * FFTs use Fft_plan and its thread-safe plan cache; images are transformed
+   * with fftr2d and the direct sums run over threads if set_nthreads has been
+   * called.
+   *
+   * When the same kernel is applied to many spectra of one length (e.g.
+   * cross-correlation against a template), make a Convolver once and call
+   * its apply method for each so that the kernel is transformed only once.
+   */
+
+  //! Methods of convolution
+  enum CONV_METHOD {
+    CONV_AUTO,        /**< Chooses whichever of the others should be fastest */
+    CONV_DIRECT,      /**< Direct summation */
+    CONV_OVERLAP_ADD, /**< FFTs of blocks of the data, added together */
+    CONV_FFT          /**< One FFT of all the data */
+  };
+
+  //! Convolves 1D data with a kernel
+  template <class X>
+  void convolve(const Buffer1D<X>& data, const Buffer1D<X>& kernel, Buffer1D<X>& result, CONV_METHOD method=CONV_AUTO);
+
+  //! Cross-correlates 1D data with a kernel
+  template <class X>
+  void correlate(const Buffer1D<X>& data, const Buffer1D<X>& kernel, Buffer1D<X>& result, CONV_METHOD method=CONV_AUTO);
+
+  //! Convolves an image with a kernel
+  template <class X>
+  void convolve(const Array2D<X>& data, const Array2D<X>& kernel, Array2D<X>& result, CONV_METHOD method=CONV_AUTO);
+
+  //! Cross-correlates an image with a kernel
+  template <class X>
+  void correlate(const Array2D<X>& data, const Array2D<X>& kernel, Array2D<X>& result, CONV_METHOD method=CONV_AUTO);
+
+  // Relative costs per point of an FFT pass and of one term of a direct sum,
+  // used to choose the method. An FFT-based convolution of a block of length
+  // l costs about CONV_FFT_COST*l*log2(l) for the forward and inverse
+  // transforms.
+  const double CONV_FFT_COST = 6.;
+
+  // Smallest even FFT length >= n
+  inline int conv_length(int n){
+    return 2*int(fft_size((n+1)/2));
+  }
+
+  // Chooses the FFT length l for blocks of data convolved with a kernel of nk
+  // points, n in all, returning the estimated cost. With full set, only the
+  // single block covering all the data is considered.
+  inline double conv_plan(int n, int nk, bool full, int& l){
+    l = conv_length(n+nk-1);
+    double best = CONV_FFT_COST*l*std::log2(double(l)) + 4.*l;
+    if(full) return best;
+    for(int block=16; block<n; block*=2){
+      if(block < nk) continue;
+      const int lb = conv_length(block+nk-1);
+      const int nblock = (n+lb-nk)/(lb-nk+1);
+      const double cost = nblock*(CONV_FFT_COST*lb*std::log2(double(lb)) + 4.*lb);
+      if(cost < best){
+	best = cost;
+	l    = lb;
+      }
+    }
+    return best;
+  }
+
+  //! Convolution or correlation of many 1D arrays of one length with one kernel
+
+  /** A Convolver holds the kernel, and its FFT if one is needed, for data of a
+   * given length. Its apply method is const and allocates its own workspace,
+   * so one Convolver can be shared by several threads.
+   */
+  template <class X>
+  class Convolver {
+
+  public:
+
+    //! Constructor
+    Convolver(const Buffer1D<X>& kernel, int n, bool correlate=false, CONV_METHOD method=CONV_AUTO);
+
+    //! Applies the kernel to n values
+    void apply(const X* data, X* result) const;
+
+    //! Applies the kernel to a Buffer1D of n values
+    void apply(const Buffer1D<X>& data, Buffer1D<X>& result) const {
+      if(data.size() != n)
+	throw Buffer1D_Error("void Subs::Convolver::apply(const Buffer1D<X>&, Buffer1D<X>&) const: data size = " +
+			     Subs::str(data.size()) + " does not match convolver size = " + Subs::str(n));
+      result.resize(n);
+      apply(data.ptr(), result.ptr());
+    }
+
+    //! Returns the method in use (never CONV_AUTO)
+    CONV_METHOD get_method() const {return method;}
+
+  private:
+
+    // number of data points and of the kernel, centre of the kernel
+    int n, nk, centre;
+
+    // method, FFT length and points per block
+    CONV_METHOD method;
+    int nfft, step;
+
+    // the kernel (reversed for correlation), and its FFT in the packed form
+    // of fftr, divided by nfft/2
+    std::vector<X> kern, kfft;
+
+    std::shared_ptr<const Fft_plan<X> > plan;
+
+  };
+
+  /** Sets up the kernel.
+   * \param kernel    the kernel
+   * \param n         the number of points of the data it will be applied to
+   * \param correlate true for correlation rather than convolution
+   * \param method    method to use
+   */
+  template <class X>
+  Convolver<X>::Convolver(const Buffer1D<X>& kernel, int n, bool correlate, CONV_METHOD method) :
+    n(n), nk(kernel.size()), method(method), nfft(0), step(0), kern(kernel.ptr(), kernel.ptr()+kernel.size()) {
+
+    if(nk == 0)
+      throw Buffer1D_Error("Subs::Convolver::Convolver(const Buffer1D<X>&, int, bool, CONV_METHOD): null kernel");
+    if(n < 0)
+      throw Buffer1D_Error("Subs::Convolver::Convolver(const Buffer1D<X>&, int, bool, CONV_METHOD): n = " + Subs::str(n) + " < 0");
+
+    // correlation is convolution with the reversed kernel
+    centre = nk/2;
+    if(correlate){
+      std::reverse(kern.begin(), kern.end());
+      centre = nk - 1 - nk/2;
+    }
+
+    if(n == 0) this->method = CONV_DIRECT;
+
+    if(this->method != CONV_DIRECT){
+      const double cost = conv_plan(n, nk, method == CONV_FFT, nfft);
+      if(method == CONV_AUTO)
+	this->method = cost < double(n)*nk ? (nfft >= n+nk-1 ? CONV_FFT : CONV_OVERLAP_ADD) : CONV_DIRECT;
+    }
+
+    if(this->method != CONV_DIRECT){
+      step = nfft - nk + 1;
+      plan = Fft_plan<X>::get(nfft/2);
+      kfft.resize(nfft, X(0));
+      std::copy(kern.begin(), kern.end(), kfft.begin());
+      plan->fftr(&kfft[0], 1);
+      for(int i=0; i<nfft; i++) kfft[i] *= X(2)/nfft;
+    }
+  }
+
+  /** Applies the kernel
+   * \param data   n values
+   * \param result n values for the convolution or correlation. This must not
+   * overlap data.
+   */
+  template <class X>
+  void Convolver<X>::apply(const X* data, X* result) const {
+
+    if(method == CONV_DIRECT){
+
+      // sums are accumulated over a block of outputs at a time, each term of
+      // the kernel adding a shifted copy of the data
+      const int NBLOCK = 4096;
+      std::vector<double> acc(std::min(n, NBLOCK));
+      for(int i1=0; i1<n; i1+=NBLOCK){
+	const int i2 = std::min(n, i1+NBLOCK);
+	std::fill(acc.begin(), acc.end(), 0.);
+	for(int j=0; j<nk; j++){
+	  const int shift = centre - j;
+	  const int ilo = std::max(i1, -shift), ihi = std::min(i2, n-shift);
+	  const double k = kern[j];
+	  for(int i=ilo; i<ihi; i++)
+	    acc[i-i1] += k*data[i+shift];
+	}
+	for(int i=i1; i<i2; i++)
+	  result[i] = X(acc[i-i1]);
+      }
+
+    }else{
+
+      std::fill(result, result+n, X(0));
+      std::vector<X> buff(nfft);
+      for(int s0=0; s0<n; s0+=step){
+	const int len = std::min(step, n-s0);
+	std::copy(data+s0, data+s0+len, buff.begin());
+	std::fill(buff.begin()+len, buff.end(), X(0));
+	plan->fftr(&buff[0], 1);
+	buff[0] *= kfft[0];
+	buff[1] *= kfft[1];
+	for(int k=2; k<nfft; k+=2){
+	  const X re = buff[k]*kfft[k] - buff[k+1]*kfft[k+1];
+	  buff[k+1]  = buff[k]*kfft[k+1] + buff[k+1]*kfft[k];
+	  buff[k]    = re;
+	}
+	plan->fftr(&buff[0], -1);
+
+	// element t of the block is element s0+t-centre of the result
+	const int tlo = std::max(0, centre-s0), thi = std::min(len+nk-1, n+centre-s0);
+	const int offset = s0 - centre;
+	for(int t=tlo; t<thi; t++)
+	  result[t+offset] += buff[t];
+      }
+    }
+  }
+
+  /** Convolves 1D data with a kernel, giving a result the same size as the data.
+   * \param data   the data
+   * \param kernel the kernel, centred on element kernel.size()/2
+   * \param result the convolution
+   * \param method method to use
+   */
+  template <class X>
+  void convolve(const Buffer1D<X>& data, const Buffer1D<X>& kernel, Buffer1D<X>& result, CONV_METHOD method){
+    Convolver<X> conv(kernel, data.size(), false, method);
+    Buffer1D<X> temp(data.size());
+    conv.apply(data.ptr(), temp.ptr());
+    result = std::move(temp);
+  }
+
+  /** Cross-correlates 1D data with a kernel, giving a result the same size as
+   * the data with element i at lag i-kernel.size()/2.
+   * \param data   the data
+   * \param kernel the kernel
+   * \param result the correlation
+   * \param method method to use
+   */
+  template <class X>
+  void correlate(const Buffer1D<X>& data, const Buffer1D<X>& kernel, Buffer1D<X>& result, CONV_METHOD method){
+    Convolver<X> conv(kernel, data.size(), true, method);
+    Buffer1D<X> temp(data.size());
+    conv.apply(data.ptr(), temp.ptr());
+    result = std::move(temp);
+  }
+
+  // Convolution of an image with a kernel centred on (cy,cx), reversed
+  // beforehand for correlation
+  template <class X>
+  void convolve_image(const Array2D<X>& data, const Array2D<X>& kernel, int cy, int cx,
+		      Array2D<X>& result, CONV_METHOD method){
+
+    const int ny = data.get_ny(), nx = data.get_nx();
+    const int nky = kernel.get_ny(), nkx = kernel.get_nx();
+    if(nky == 0 || nkx == 0)
+      throw Array2D_Error("void Subs::convolve_image(const Array2D<X>&, const Array2D<X>&, int, int, Array2D<X>&, CONV_METHOD): null kernel");
+
+    Array2D<X> temp(ny, nx);
+
+    // FFT lengths in each dimension, the blocks being chosen separately in Y
+    // and X. The cost of a block is that of the 2D FFT.
+    int ly = 0, lx = 0;
+    double cost = 0.;
+    if(method != CONV_DIRECT){
+      conv_plan(ny, nky, method == CONV_FFT, ly);
+      conv_plan(nx, nkx, method == CONV_FFT, lx);
+      const double nblock = double((ny+ly-nky)/(ly-nky+1))*((nx+lx-nkx)/(lx-nkx+1));
+      cost = nblock*(CONV_FFT_COST*double(ly)*lx*std::log2(double(ly)*lx) + 4.*ly*lx);
+      if(method == CONV_AUTO)
+	method = cost < double(ny)*nx*nky*nkx ? CONV_FFT : CONV_DIRECT;
+    }
+
+    if(method == CONV_DIRECT){
+
+      // each output row is the sum of rows of the data shifted in X and
+      // scaled by the kernel
+      filter_rows(ny, int(std::min(double(nx)*nky*nkx, double(PARALLEL_MIN))), [&](int iy1, int iy2){
+	  std::vector<double> acc(nx);
+	  for(int iy=iy1; iy<iy2; iy++){
+	    std::fill(acc.begin(), acc.end(), 0.);
+	    for(int jy=std::max(0, iy+cy-ny+1); jy<std::min(nky, iy+cy+1); jy++){
+	      const X* drow = data[iy+cy-jy];
+	      const X* krow = kernel[jy];
+	      for(int jx=0; jx<nkx; jx++){
+		const int shift = cx - jx;
+		const int ilo = std::max(0, -shift), ihi = std::min(nx, nx-shift);
+		const double k = krow[jx];
+		for(int ix=ilo; ix<ihi; ix++)
+		  acc[ix] += k*drow[ix+shift];
+	      }
+	    }
+	    X* out = temp[iy];
+	    for(int ix=0; ix<nx; ix++) out[ix] = X(acc[ix]);
+	  }
+	});
+
+    }else{
+
+      // kernel transform, divided by the number of points
+      Buffer2D<X> kpad(ly, lx), kfft, block(ly, lx), bfft;
+      kpad = X(0);
+      for(int iy=0; iy<nky; iy++)
+	std::copy(kernel[iy], kernel[iy]+nkx, kpad[iy]);
+      fftr2d(kpad, kfft, 1);
+      const X norm = X(1)/(double(lx)*ly);
+      X* kp = kfft.data();
+      for(int i=0; i<kfft.size(); i++) kp[i] *= norm;
+
+      temp = X(0);
+      const int sy = ly - nky + 1, sx = lx - nkx + 1;
+      for(int y0=0; y0<ny; y0+=sy){
+	const int leny = std::min(sy, ny-y0);
+	for(int x0=0; x0<nx; x0+=sx){
+	  const int lenx = std::min(sx, nx-x0);
+	  block = X(0);
+	  for(int iy=0; iy<leny; iy++)
+	    std::copy(data[y0+iy]+x0, data[y0+iy]+x0+lenx, block[iy]);
+	  fftr2d(block, bfft, 1);
+	  X* bp = bfft.data();
+	  for(int i=0; i<bfft.size(); i+=2){
+	    const X re = bp[i]*kp[i] - bp[i+1]*kp[i+1];
+	    bp[i+1] = bp[i]*kp[i+1] + bp[i+1]*kp[i];
+	    bp[i]   = re;
+	  }
+	  fftr2d(bfft, block, -1);
+
+	  // element (ty,tx) of the block is element (y0+ty-cy,x0+tx-cx) of the result
+	  const int tylo = std::max(0, cy-y0), tyhi = std::min(leny+nky-1, ny+cy-y0);
+	  const int txlo = std::max(0, cx-x0), txhi = std::min(lenx+nkx-1, nx+cx-x0);
+	  for(int ty=tylo; ty<tyhi; ty++){
+	    const X* bp = block[ty];
+	    X* rp = temp[y0+ty-cy];
+	    const int offset = x0 - cx;
+	    for(int tx=txlo; tx<txhi; tx++)
+	      rp[tx+offset] += bp[tx];
+	  }
+	}
+      }
+    }
+    result = std::move(temp);
+  }
+
+  /** Convolves an image with a kernel, giving a result the same size as the image.
+   * \param data   the image
+   * \param kernel the kernel, centred on pixel (ny/2,nx/2) of it
+   * \param result the convolution
+   * \param method method to use. CONV_OVERLAP_ADD and CONV_FFT are the same
+   * except that the latter always transforms the whole image at once.
+   */
+  template <class X>
+  void convolve(const Array2D<X>& data, const Array2D<X>& kernel, Array2D<X>& result, CONV_METHOD method){
+    convolve_image(data, kernel, kernel.get_ny()/2, kernel.get_nx()/2, result, method);
+  }
+
+  /** Cross-correlates an image with a kernel, giving a result the same size as
+   * the image with pixel (iy,ix) at a shift of (iy-ny/2,ix-nx/2) where nx, ny
+   * are the dimensions of the kernel.
+   * \param data   the image
+   * \param kernel the kernel
+   * \param result the correlation
+   * \param method method to use
+   */
+  template <class X>
+  void correlate(const Array2D<X>& data, const Array2D<X>& kernel, Array2D<X>& result, CONV_METHOD method){
+    const int nky = kernel.get_ny(), nkx = kernel.get_nx();
+    Array2D<X> rev(nky, nkx);
+    for(int iy=0; iy<nky; iy++)
+      std::reverse_copy(kernel[iy], kernel[iy]+nkx, rev[nky-1-iy]);
+    convolve_image(data, rev, nky-1-nky/2, nkx-1-nkx/2, result, method);
+  }
+
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef TRM_SUBS_FFT
+#define TRM_SUBS_FFT
+
+#include <vector>
+#include <memory>
+#include "trm/buffer2d.h"
+
+namespace Subs {
+
+  //! Precomputed tables for FFTs of one length
+
+  /** An Fft_plan holds the factorisation and twiddle factors for FFTs of a
+   * given number of points, in float or double precision, so that they are
+   * computed once rather than on every transform. Plans are immutable once made
+   * and so can be used from any number of threads at once. They are normally
+   * obtained from the cache with Fft_plan<X>::get, which each thread consults
+   * lock-free when it uses the same length as its previous call. The cache
+   * keeps the 32 plans most recently asked for, older ones being freed once
+   * nothing uses them, and can be emptied with clear_cache. Subs::fft,
+   * Subs::fftr and Subs::twofft all go through this cache.
+   *
+   * The transforms are Stockham autosort FFTs, which need no bit-reversal, made
+   * of passes of radix 4, 2, 3, 5 and 7. Lengths with any other prime factor
+   * are transformed with Bluestein's chirp-z algorithm, as a convolution
+   * computed with FFTs of the next length >= 2n-1 that factorises, so any
+   * length takes O(n log n) operations, although those of the form
+   * 2^a 3^b 5^c 7^d (see Subs::fft_size) are several times faster. They work
+   * on separate arrays of real and imaginary parts in a per-thread workspace,
+   * with the butterflies vectorised with the same instruction set as
+   * Subs::Simd. Real
+   * data are transformed as a complex array of half the length, the even and
+   * odd points being split straight into the real and imaginary workspace and
+   * the halves separated at the end in one pass.
+   *
+   * The conventions are those of Numerical Recipes: the forward transform
+   * (flag = 1) is sum_j x_j exp(+2 pi i j k/n), and the inverse (flag = -1)
+   * is not normalised.
+   */
+  template <class X>
+  class Fft_plan {
+
+  public:
+
+    //! Returns the plan for n points from the cache, making it if need be
+    static std::shared_ptr<const Fft_plan> get(unsigned long int n);
+
+    //! Empties the cache of plans
+    static void clear_cache();
+
+    //! Constructor of a plan for n points
+    explicit Fft_plan(unsigned long int n);
+
+    //! Returns the number of points
+    unsigned long int size() const {return n;}
+
+    //! FFT of n complex points, stored as alternate real and imaginary values
+    void fft(X* data, int flag) const;
+
+    //! FFT of n complex points held as separate real and imaginary arrays
+    void fft(X* real, X* imag, int flag) const;
+
+    //! FFT of 2n real points, in the packed format of Subs::fftr
+    void fftr(X* data, int flag) const;
+
+  private:
+
+    // Runs the passes over the workspace (ar,ai) and (br,bi), returning true if
+    // the result ends up in (br,bi)
+    bool transform(X* ar, X* ai, X* br, X* bi, int flag) const;
+
+    // Bluestein's algorithm, called by transform if need be
+    bool bluestein(X* ar, X* ai, X* br, X* bi, int flag) const;
+
+    // number of complex points
+    unsigned long int n;
+
+    // radices of the passes
+    std::vector<int> radix;
+
+    // cos and sin of 2 pi t/n, t = 0 to n-1: the twiddle factors of the passes
+    std::vector<X> cosine, sine;
+
+    // For Bluestein's algorithm: the plan of the convolution, the chirp
+    // exp(i pi t^2/n), t = 0 to n-1, and the transform of its conjugate,
+    // divided by the length of the convolution
+    std::shared_ptr<const Fft_plan> chirp_plan;
+    std::vector<X> chirpr, chirpi, kernelr, kerneli;
+
+    // cos and sin of pi k/n, k = 0 to n/2: those needed to separate the
+    // transforms of the even and odd points for real FFTs of 2n points
+    std::vector<X> rcosine, rsine;
+
+  };
+
+  /** The 2D transforms below work on the rows and columns of a Buffer2D (and
+   * so an Array2D). Complex data are stored along rows as alternate real and
+   * imaginary values, so that a row of nx values holds nx/2 complex points,
+   * as for Subs::fft, and each pair of columns 2j, 2j+1 holds one complex
+   * column. Rows, or blocks of columns, are spread across threads if enabled
+   * by set_nthreads. The columns are copied a block at a time into contiguous
+   * workspace to be transformed, so that they are read and written in whole
+   * cache lines. The sign conventions are those of Fft_plan and the inverse
+   * transforms are not normalised.
+   */
+
+  //! FFTs of every row of complex data
+  template <class X>
+  void fft_rows(Buffer2D<X>& data, int flag);
+
+  //! FFTs of every column of complex data
+  template <class X>
+  void fft_cols(Buffer2D<X>& data, int flag);
+
+  //! 2D FFT of complex data
+  template <class X>
+  void fft2d(Buffer2D<X>& data, int flag);
+
+  //! 2D FFT of real data
+  template <class X>
+  void fftr2d(const Buffer2D<X>& in, Buffer2D<X>& out, int flag);
+
+}
+
+#endif
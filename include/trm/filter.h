@@ -0,0 +1,368 @@
+#ifndef TRM_SUBS_FILTER
+#define TRM_SUBS_FILTER
+
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include "trm/subs.h"
+#include "trm/array2d.h"
+#include "trm/thread_pool.h"
+
+namespace Subs {
+
+  //! Smoothing filters whose cost does not depend upon their width
+
+  /** The boxcar filters here use sliding sums and the Gaussian filters the
+   * third-order recursive approximation of van Vliet, Young & Verbeek (1998,
+   * Proc. ICPR, 509), so all of them take a fixed number of operations per point however
+   * wide the kernel. The 2D filters are separable: each row is filtered, then
+   * the columns are filtered a whole row at a time so that the inner loops run
+   * along rows and can be vectorised. Rows, and strips of columns, are split
+   * across threads if enabled by set_nthreads.
+   *
+   * The 1D boxcar is Subs::boxcar.
+   */
+
+  //! Gaussian filter of a 1D array
+  template <class X>
+  void gauss_filter(const Buffer1D<X>& data, Buffer1D<X>& filt, double sigma);
+
+  //! Boxcar filter of an image
+  template <class X>
+  void boxcar(const Array2D<X>& data, Array2D<X>& filt, int hx, int hy);
+
+  //! Gaussian filter of an image
+  template <class X>
+  void gauss_filter(const Array2D<X>& data, Array2D<X>& filt, double sigx, double sigy);
+
+  //! Coefficients of the recursive Gaussian filter
+  class Recursive_gauss {
+
+  public:
+
+    //! Constructor from the RMS of the Gaussian, in pixels (>= 0.5)
+    Recursive_gauss(double sigma){
+      if(sigma < 0.5)
+	throw Subs_Error("Subs::Recursive_gauss::Recursive_gauss(double): sigma = " + Subs::str(sigma) +
+			 " is too small (< 0.5)");
+
+      // The poles of van Vliet, Young & Verbeek (1998) are scaled as d^(1/q),
+      // with q found by bisection so that the RMS of the forward plus
+      // backward response is exactly sigma.
+      const std::complex<double> D1(1.41650,1.00829), D3(1.86543,0.);
+      double qlo = 0.01, qhi = sigma + 10.;
+      for(int i=0; i<60; i++){
+	double q = std::sqrt(qlo*qhi);
+	if(variance(std::pow(D1,1./q), std::pow(D3,1./q)) < sigma*sigma)
+	  qlo = q;
+	else
+	  qhi = q;
+      }
+      const double q = std::sqrt(qlo*qhi);
+      const std::complex<double> p1 = 1./std::pow(D1,1./q), p2 = std::conj(p1), p3 = 1./std::pow(D3,1./q);
+      b1 =  (p1+p2+p3).real();
+      b2 = -(p1*p2+p1*p3+p2*p3).real();
+      b3 =  (p1*p2*p3).real();
+      B  = 1. - (b1+b2+b3);
+    }
+
+    //! Filters n values in place, treating the ends as constant
+    template <class X>
+    void apply(X* ptr, int n) const {
+      if(n == 0) return;
+      double w1 = ptr[0], w2 = w1, w3 = w1, w;
+      for(int i=0; i<n; i++){
+	w  = B*ptr[i] + b1*w1 + b2*w2 + b3*w3;
+	ptr[i] = X(w);
+	w3 = w2; w2 = w1; w1 = w;
+      }
+      w2 = w3 = w1;
+      for(int i=n-1; i>=0; i--){
+	w  = B*ptr[i] + b1*w1 + b2*w2 + b3*w3;
+	ptr[i] = X(w);
+	w3 = w2; w2 = w1; w1 = w;
+      }
+    }
+
+    //! Forward and backward coefficients
+    double B, b1, b2, b3;
+
+  private:
+
+    // RMS^2 of the forward plus backward response with poles d1, conj(d1) and d3
+    static double variance(const std::complex<double>& d1, const std::complex<double>& d3){
+      const std::complex<double> d2 = std::conj(d1);
+      return 2.*(d1/((d1-1.)*(d1-1.)) + d2/((d2-1.)*(d2-1.)) + d3/((d3-1.)*(d3-1.))).real();
+    }
+
+  };
+
+  /** This is Gaussian smoothing to good accuracy at a cost of a few operations
+   * per point for any sigma. The data are taken to be constant beyond each end.
+   * \param data  the data to be filtered
+   * \param filt  the filtered data
+   * \param sigma the RMS of the Gaussian, in pixels (>= 0.5)
+   */
+  template <class X>
+  void gauss_filter(const Buffer1D<X>& data, Buffer1D<X>& filt, double sigma){
+    Recursive_gauss rg(sigma);
+    filt = data;
+    rg.apply(filt.ptr(), filt.size());
+  }
+
+  //! A sliding sum that stays accurate however many values pass through it
+
+  /** Values are added and removed with Neumaier's compensated summation, so
+   * that a very large value leaves no error once it has gone. Non-finite
+   * values are counted rather than summed, making the sum NaN or infinite,
+   * as a direct sum would be, only while they are in the window. The boxcar
+   * filters also form their sums afresh every WINDOW_SYNC points or so.
+   */
+  class Window_sum {
+
+  public:
+
+    //! Constructor, to an empty window
+    Window_sum() {reset();}
+
+    //! Empties the window
+    void reset(){
+      s = c = 0.;
+      nnan = npinf = nminf = 0;
+    }
+
+    //! Adds a value to the window
+    void add(double x){
+      if(std::isfinite(x))
+	acc(x);
+      else
+	count(x, 1);
+    }
+
+    //! Removes a value added earlier
+    void sub(double x){
+      if(std::isfinite(x))
+	acc(-x);
+      else
+	count(x, -1);
+    }
+
+    //! Returns the sum of the values in the window
+    double value() const {
+      if(nnan || (npinf && nminf)) return std::numeric_limits<double>::quiet_NaN();
+      if(npinf) return std::numeric_limits<double>::infinity();
+      if(nminf) return -std::numeric_limits<double>::infinity();
+      return s + c;
+    }
+
+  private:
+
+    void acc(double x){
+      const double t = s + x;
+      if(std::fabs(s) >= std::fabs(x))
+	c += (s - t) + x;
+      else
+	c += (x - t) + s;
+      s = t;
+    }
+
+    void count(double x, int n){
+      if(std::isnan(x))
+	nnan += n;
+      else if(x > 0.)
+	npinf += n;
+      else
+	nminf += n;
+    }
+
+    double s, c;
+    int nnan, npinf, nminf;
+
+  };
+
+  //! Number of points between fresh sums of the boxcar filters (at least the width of the box)
+  const int WINDOW_SYNC = 1024;
+
+  /** Boxcar filter along a line of n values, each output being the mean of
+   * the inputs within hw of it, the box being truncated at the ends. out may
+   * not be in.
+   * \param in  the input values
+   * \param out the output values
+   * \param n   the number of values
+   * \param hw  the half-width of the box
+   */
+  template <class In, class Out>
+  void boxcar_line(const In* in, Out* out, int n, int hw){
+    const int nsync = std::max(WINDOW_SYNC, 2*hw+1);
+    Window_sum sum;
+    for(int j=0; j<n; j++){
+      const int i1 = std::max(j-hw, 0), i2 = std::min(j+hw, n-1);
+      if(j % nsync == 0){
+	sum.reset();
+	for(int i=i1; i<=i2; i++) sum.add(in[i]);
+      }else{
+	if(j+hw < n)    sum.add(in[j+hw]);
+	if(j-hw-1 >= 0) sum.sub(in[j-hw-1]);
+      }
+      out[j] = Out(sum.value()/(i2 - i1 + 1));
+    }
+  }
+
+  // Runs func(iy1, iy2) over rows 0 to ny-1, across threads if the image is large
+  template <class Func>
+  void filter_rows(int ny, int nx, const Func& func){
+    const int nthreads = get_nthreads();
+    if(nthreads > 1 && ny > 1 && double(nx)*ny >= PARALLEL_MIN){
+      const int nchunk = std::min(4*nthreads, ny);
+      const int nper   = (ny+nchunk-1)/nchunk;
+      parallel_run(nchunk, [&](int ichunk){
+	  int iy1 = ichunk*nper, iy2 = std::min(ny, iy1+nper);
+	  if(iy1 < iy2) func(iy1, iy2);
+	});
+    }else{
+      func(0, ny);
+    }
+  }
+
+  /** Each output pixel is the mean of the pixels within hx in X and hy in Y of it,
+   * the box being truncated at the edges, as with the 1D boxcar.
+   * \param data the image to be filtered
+   * \param filt the filtered image, which can be data itself
+   * \param hx   half-width of the box in X
+   * \param hy   half-width of the box in Y
+   */
+  template <class X>
+  void boxcar(const Array2D<X>& data, Array2D<X>& filt, int hx, int hy){
+
+    if(hx < 0 || hy < 0)
+      throw Array2D_Error("void Subs::boxcar(const Array2D<X>&, Array2D<X>&, int, int): half-widths must be >= 0");
+
+    // the rows are filtered from data into filt
+    if(&data == &filt){
+      Array2D<X> copy(data);
+      boxcar(copy, filt, hx, hy);
+      return;
+    }
+
+    const int nx = data.get_nx(), ny = data.get_ny();
+    filt.resize(ny,nx);
+
+    // rows: sliding sums along X, divided by the number of pixels
+    filter_rows(ny, nx, [&](int iy1, int iy2){
+	for(int iy=iy1; iy<iy2; iy++)
+	  boxcar_line(data[iy], filt[iy], nx, hx);
+      });
+
+    // columns: the sums over the rows in the box are carried a row at a time,
+    // so the inner loops run along X and vectorise. Each thread takes a strip
+    // of columns. Non-finite values are counted rather than summed, so that
+    // they leave nothing behind once out of the box, and columns with any in
+    // the box are summed directly. Fresh sums every nsync rows stop drift.
+    filter_rows(nx, ny, [&](int ix1, int ix2){
+	const int nstrip = ix2 - ix1;
+	const int nsync  = std::max(WINDOW_SYNC, 2*hy+1);
+	std::vector<double> sums(nstrip);
+	std::vector<int> counts(nstrip);
+	double* sum = &sums[0];
+	int* nbad = &counts[0];
+
+	// the rows leaving the box are overwritten, so keep hy+1 of them
+	std::vector<X> keep(nstrip*(hy+1));
+	auto row = [&](int jy, bool kept) -> const X* {
+	  return kept ? &keep[nstrip*(jy % (hy+1))] : filt[jy] + ix1;
+	};
+
+	// adds (n = 1) or removes (n = -1) a row, without branches
+	auto update = [&](const X* in, int n){
+	  for(int ix=0; ix<nstrip; ix++){
+	    const double v = in[ix];
+	    const bool ok = v - v == 0.;
+	    sum[ix]  += ok ? n*v : 0.;
+	    nbad[ix] += ok ? 0 : n;
+	  }
+	};
+
+	for(int iy=0; iy<ny; iy++){
+	  X* io = filt[iy] + ix1;
+	  const int iy1 = std::max(iy-hy, 0), iy2 = std::min(iy+hy, ny-1);
+	  if(iy % nsync == 0){
+	    std::fill(sum, sum+nstrip, 0.);
+	    std::fill(nbad, nbad+nstrip, 0);
+	    for(int jy=iy1; jy<=iy2; jy++)
+	      update(row(jy, jy < iy), 1);
+	  }else{
+	    if(iy+hy < ny)    update(row(iy+hy, false), 1);
+	    if(iy-hy-1 >= 0)  update(row(iy-hy-1, true), -1);
+	  }
+	  std::copy(io, io+nstrip, &keep[nstrip*(iy % (hy+1))]);
+
+	  const double norm = 1./(iy2 - iy1 + 1);
+	  for(int ix=0; ix<nstrip; ix++) io[ix] = X(norm*sum[ix]);
+	  for(int ix=0; ix<nstrip; ix++){
+	    if(nbad[ix]){
+	      double s = 0.;
+	      for(int jy=iy1; jy<=iy2; jy++) s += row(jy, jy <= iy)[ix];
+	      io[ix] = X(norm*s);
+	    }
+	  }
+	}
+      });
+  }
+
+  /** Separable Gaussian smoothing of an image with a fixed cost per pixel for
+   * any sigma. The image is taken to be constant beyond each edge.
+   * \param data the image to be filtered
+   * \param filt the filtered image
+   * \param sigx the RMS of the Gaussian in X, pixels (>= 0.5)
+   * \param sigy the RMS of the Gaussian in Y, pixels (>= 0.5)
+   */
+  template <class X>
+  void gauss_filter(const Array2D<X>& data, Array2D<X>& filt, double sigx, double sigy){
+
+    const Recursive_gauss rx(sigx), ry(sigy);
+    const int nx = data.get_nx(), ny = data.get_ny();
+    filt = data;
+
+    filter_rows(ny, nx, [&](int iy1, int iy2){
+	for(int iy=iy1; iy<iy2; iy++)
+	  rx.apply(filt[iy], nx);
+      });
+
+    // columns: the recursion is carried along whole rows, so the inner loops
+    // run along X. Each thread takes a strip of columns.
+    filter_rows(nx, ny, [&](int ix1, int ix2){
+	if(ny == 0) return;
+	const int nstrip = ix2 - ix1;
+	std::vector<double> buff(3*nstrip);
+	double *w1 = &buff[0], *w2 = w1 + nstrip, *w3 = w2 + nstrip;
+	std::copy(filt[0]+ix1, filt[0]+ix2, w1);
+	std::copy(w1, w1+nstrip, w2);
+	std::copy(w1, w1+nstrip, w3);
+	for(int iy=0; iy<ny; iy++){
+	  X* io = filt[iy] + ix1;
+	  for(int ix=0; ix<nstrip; ix++){
+	    w3[ix] = ry.B*io[ix] + ry.b1*w1[ix] + ry.b2*w2[ix] + ry.b3*w3[ix];
+	    io[ix] = X(w3[ix]);
+	  }
+	  std::swap(w2, w3);
+	  std::swap(w1, w2);
+	}
+	std::copy(w1, w1+nstrip, w2);
+	std::copy(w1, w1+nstrip, w3);
+	for(int iy=ny-1; iy>=0; iy--){
+	  X* io = filt[iy] + ix1;
+	  for(int ix=0; ix<nstrip; ix++){
+	    w3[ix] = ry.B*io[ix] + ry.b1*w1[ix] + ry.b2*w2[ix] + ry.b3*w3[ix];
+	    io[ix] = X(w3[ix]);
+	  }
+	  std::swap(w2, w3);
+	  std::swap(w1, w2);
+	}
+      });
+  }
+
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef TRM_SUBS_PERIOD_SEARCH
+#define TRM_SUBS_PERIOD_SEARCH
+
+#include <iostream>
+#include "trm/subs.h"
+#include "trm/ephem.h"
+
+namespace Subs {
+
+  //! Box least squares search for eclipses and transits
+
+  /** Bls searches for periodic dips by fitting a box-shaped eclipse, as in
+   * Kovacs, Zucker & Mazeh (2002, A&A, 391, 369), on the frequencies
+   * fmin + (fmax-fmin)*i/(nfreq-1), i = 0 to nfreq-1. At each frequency the
+   * data are folded into nbin phase bins holding the sums of the weights and
+   * of the weighted data, and their cumulative sums, wrapped round once, then
+   * give the fit of every box of from qmin to qmax in phase at every start
+   * bin in O(1). The cost per frequency is thus O(N) to fold and O(nbin
+   * nwidth) to search rather than O(N nbin nwidth) by direct sums.
+   * Frequencies are spread across the thread pool set up by set_nthreads.
+   *
+   * Phases follow Subs::Ephem, i.e. (t - T0)/P, with eclipses at integer
+   * phase, so the result at each frequency gives an ephemeris directly.
+   * Points with uncertainties <= 0 are ignored.
+   */
+  class Bls {
+
+  public:
+
+    //! Best box at one frequency
+    struct Box {
+      double dchisq; /**< reduction in chi**2 relative to a constant, 0 if no dip found */
+      double depth;  /**< depth of the box, mean out of eclipse minus mean in eclipse */
+      double t0;     /**< time of mid-eclipse, the first after the start of the data */
+      double width;  /**< width of the box, in phase */
+    };
+
+    //! Constructor
+    Bls(double fmin, double fmax, int nfreq, int nbin=200, double qmin=0.01, double qmax=0.1);
+
+    //! Returns the number of frequencies
+    int get_nfreq() const {return nfreq;}
+
+    //! Returns frequency i, cycles per unit x
+    double frequency(int i) const {return nfreq > 1 ? fmin + (fmax-fmin)*i/(nfreq-1) : fmin;}
+
+    //! Searches one light curve
+    void compute(const double* x, const float* y, const float* e, int n, Box* result) const;
+
+    //! Searches one light curve
+    void compute(const double* x, const float* y, const float* e, int n, Buffer1D<Box>& result) const;
+
+    //! Ephemeris of the box found at frequency i
+    Ephem ephem(int i, const Box& box, Ephem::TSCALE tscale) const;
+
+  private:
+
+    double fmin, fmax;
+    int nfreq, nbin;
+
+    // range of box widths in bins
+    int kmin, kmax;
+
+  };
+
+  //! ASCII output of a Bls::Box
+  std::ostream& operator<<(std::ostream& ost, const Bls::Box& box);
+
+  //! ASCII input of a Bls::Box
+  std::istream& operator>>(std::istream& ist, Bls::Box& box);
+
+  //! Phase dispersion minimisation
+
+  /** Pdm computes Stellingwerf's (1978, ApJ, 224, 953) theta statistic, the
+   * variance within phase bins over the total variance, on the frequencies
+   * fmin + (fmax-fmin)*i/(nfreq-1), i = 0 to nfreq-1. Periods show up as
+   * minima, falling towards 0 for noiseless data. There are nbin bins, each
+   * covered ncover times by bins offset by 1/(nbin ncover) in phase. The data
+   * at each frequency are folded into nbin x ncover fine bins holding sums
+   * of weights and weighted data and squares; cumulative sums of these then
+   * give each of the overlapping bins in O(1), so the cost per frequency is
+   * O(N) to fold and O(nbin ncover) to sum. Frequencies are spread across
+   * the thread pool set up by set_nthreads.
+   *
+   * Phases follow Subs::Ephem, i.e. (t - T0)/P. Points with uncertainties
+   * <= 0 are ignored; the others are weighted by their inverse variances.
+   */
+  class Pdm {
+
+  public:
+
+    //! Constructor
+    Pdm(double fmin, double fmax, int nfreq, int nbin=10, int ncover=5);
+
+    //! Returns the number of frequencies
+    int get_nfreq() const {return nfreq;}
+
+    //! Returns frequency i, cycles per unit x
+    double frequency(int i) const {return nfreq > 1 ? fmin + (fmax-fmin)*i/(nfreq-1) : fmin;}
+
+    //! Computes theta for one light curve
+    void compute(const double* x, const float* y, const float* e, int n, double* theta) const;
+
+    //! Computes theta for one light curve
+    void compute(const double* x, const float* y, const float* e, int n, Buffer1D<double>& theta) const;
+
+  private:
+
+    double fmin, fmax;
+    int nfreq, nbin, ncover;
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef TRM_SUBS_PERIODOGRAM
+#define TRM_SUBS_PERIODOGRAM
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include "trm/subs.h"
+#include "trm/buffer2d.h"
+#include "trm/fft.h"
+
+namespace Subs {
+
+  //! Fast periodograms of many light curves on one frequency grid
+
+  /** Periodogram computes Lomb-Scargle periodograms, or amplitude spectra, by
+   * Press & Rybicki's method as used by Subs::fasper and Subs::famp, on the
+   * frequencies fmax*(i+1)/nfreq, i = 0 to nfreq-1. It can also compute the
+   * generalised periodogram of Zechmeister & Kuerster (2009, A&A, 496, 577),
+   * which fits a floating mean along with the sinusoid, extended to fit nharm
+   * harmonics of each frequency at once as is better for eclipsing binaries
+   * and non-sinusoidal pulsators. The trigonometric sums it needs, of w exp(i
+   * m omega x) for m up to 2 nharm and of w y exp(i m omega x) for m up to
+   * nharm, are each extirpolated onto their own grid. The cost is thus
+   * O(nharm (N + nfreq log nfreq)) plus a small Cholesky solve per frequency,
+   * where fitting at every frequency, as Subs::sincos would, costs O(nharm^2
+   * N nfreq). The size of the extirpolation grid and its FFT plan are fixed
+   * when the object is made, and each thread keeps its own grids, allocated
+   * on first use and then reused, so there is no allocation per light curve.
+   * All methods are const, so one object can be used by many threads at once,
+   * and the batch version of compute spreads light curves across the thread
+   * pool set up by set_nthreads.
+   *
+   * Points with uncertainties <= 0 are ignored. The oversampling, nfreq
+   * divided by fmax times the span of the points used, must be at least 1 for
+   * each light curve.
+   *
+   * The grids need 16 x MACC x nfreq bytes or so per thread (times 3 x nharm
+   * / 2 for the generalised form), which becomes prohibitive for long
+   * baselines searched to high frequencies. The band version of compute works
+   * instead through the frequencies nband at a time, each band being shifted
+   * to zero frequency by multiplying the data by exp(-2 pi i f0 x), where f0
+   * is the centre of the band, and then computed with complex grids of about
+   * 4 x MACC x nband points. Memory is thus fixed by nband whatever the
+   * number of frequencies, at the cost of extirpolating the data once per
+   * band. Each band is passed to a function as it is finished; Top_peaks is
+   * one which keeps just the highest peaks.
+   */
+  class Periodogram {
+
+  public:
+
+    //! Types of spectrum
+    enum TYPE {
+      LOMB_SCARGLE, /**< Lomb-Scargle periodogram, as Subs::fasper */
+      AMPLITUDE,    /**< Amplitude of least-squares sinusoid fits, as Subs::famp */
+      GENERALISED   /**< Fraction of the variance about the mean removed by fits of a constant plus nharm harmonics, 0 to 1 */
+    };
+
+    //! Number of grid points each value is extirpolated onto (fixed by Simd::lagrange4)
+    static const int MACC = 4;
+
+    //! Constructor
+    Periodogram(double fmax, int nfreq, TYPE type=LOMB_SCARGLE, int nharm=1);
+
+    //! Returns the number of frequencies
+    int get_nfreq() const {return nfreq;}
+
+    //! Returns the maximum frequency
+    double get_fmax() const {return fmax;}
+
+    //! Returns the number of harmonics fitted
+    int get_nharm() const {return nharm;}
+
+    //! Returns frequency i, cycles per unit x
+    double frequency(int i) const {return fmax*(i+1)/nfreq;}
+
+    //! Computes the spectrum of one light curve
+    void compute(const double* x, const float* y, const float* e, int n, double* power) const;
+
+    //! Computes the spectrum of one light curve
+    void compute(const double* x, const float* y, const float* e, int n, Buffer1D<double>& power) const;
+
+    //! Computes the spectra of a batch of light curves
+    void compute(int ncurve, const double* const* x, const float* const* y, const float* const* e,
+		 const int* n, Buffer2D<double>& power) const;
+
+    //! Computes the spectrum of one light curve in bands of nband frequencies
+    void compute(const double* x, const float* y, const float* e, int n, int nband,
+		 const std::function<void(int, int, const double*)>& func) const;
+
+  private:
+
+    friend class Incremental_periodogram;
+
+    // lowest X of the points used, after checking the oversampling
+    double start(const double* x, const float* e, int n) const;
+
+    // extirpolate a block of points onto the grids
+    void spread(const double* u, const double* w, const double* wy, int n, double* grid) const;
+
+    // extirpolate a block of points onto the complex grids of the band version
+    void spread(const double* u, const double* w, const double* wy, const double* cp, const double* sp,
+		int n, double* grid, int mdim) const;
+
+    // the spectrum at one frequency from the sums of the grids
+    double spectrum(double wsum, double wy, double wyy, const double* sr, const double* si, double* work) const;
+
+    double fmax;
+    int nfreq;
+    TYPE type;
+    int nharm;
+
+    // number of points of the extirpolation grids
+    int ndim;
+
+    // one grid per sum needed: w y exp(i harm omega x) if data, else w exp(i harm omega x)
+    struct Grid {
+      int  harm;
+      bool data;
+    };
+    std::vector<Grid> layout;
+
+    // highest harmonic of any grid, and the extra workspace needed per thread
+    int maxharm, nwork;
+
+    std::shared_ptr<const Fft_plan<double> > plan;
+
+  };
+
+  //! A periodogram of a light curve that grows
+
+  /** Incremental_periodogram keeps the extirpolated grids of a Periodogram
+   * from one call to the next, so that points can be added as they arrive
+   * at a cost proportional to their number alone. Computing the spectrum
+   * then needs just the FFTs of the grids and the evaluation at each
+   * frequency, not a pass through all the data. Adding points in time order
+   * gives results identical to Periodogram::compute on all of them at once.
+   *
+   * The grids are kept between calls, so the memory needed is that of the
+   * grids of Periodogram, i.e. ~16 x MACC x nfreq bytes per sum, plus as
+   * much again for each thread computing spectra.
+   */
+  class Incremental_periodogram {
+
+  public:
+
+    //! Constructor
+    Incremental_periodogram(double fmax, int nfreq, Periodogram::TYPE type=Periodogram::LOMB_SCARGLE, int nharm=1);
+
+    //! Returns the Periodogram that sets the frequencies and type of spectrum
+    const Periodogram& get_periodogram() const {return pgram;}
+
+    //! Returns the number of points added so far
+    int get_npoint() const {return npoint;}
+
+    //! Adds points
+    void add(const double* x, const float* y, const float* e, int n);
+
+    //! Computes the spectrum of all points added so far
+    void compute(double* power) const;
+
+    //! Computes the spectrum of all points added so far
+    void compute(Buffer1D<double>& power) const;
+
+    //! Forgets all points
+    void reset();
+
+  private:
+
+    Periodogram pgram;
+
+    // the grids, before transforming
+    std::vector<double> grid;
+
+    // origin of X, set by the first point; range of X; sums of w, w y, w y^2
+    double x0, xmin, xmax, wsum, wysum, wyysum;
+    int npoint;
+
+  };
+
+  //! The highest peaks of a spectrum computed in bands
+
+  /** Top_peaks can be passed as the function to Periodogram::compute in its
+   * band version, or fed bands in order of frequency by hand. It keeps the
+   * npeak highest local maxima seen, a point being a maximum if it is higher
+   * than the point before it and no lower than the point after it. Peaks
+   * may span bands. The first and last points of the spectrum are judged on
+   * their one neighbour alone.
+   */
+  class Top_peaks {
+
+  public:
+
+    //! A peak
+    struct Peak {
+      int    index; /**< index of the frequency */
+      double power; /**< the value of the spectrum */
+    };
+
+    //! Constructor
+    Top_peaks(int npeak);
+
+    //! Adds the values power[i-i1], i = i1 to i2-1, following on from those before
+    void operator()(int i1, int i2, const double* power);
+
+    //! Returns the peaks, highest first
+    std::vector<Peak> peaks() const;
+
+    //! Forgets all values
+    void reset();
+
+  private:
+
+    // adds a peak
+    void add(int index, double power);
+
+    int npeak;
+
+    // min-heap of the peaks
+    std::vector<Peak> heap;
+
+    // the last two values added and the index of the last one, -1 if none
+    double last, before;
+    int ilast;
+
+  };
+
+}
+
+#endif
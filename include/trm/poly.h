@@ -39,6 +39,15 @@ namespace Subs {
     //! Copy constructor
     Poly(const Poly& obj);
 
+    //! Move constructor
+    Poly(Poly&& obj) noexcept : Array1D<double>(std::move(obj)), norm(obj.norm), middle(obj.middle), hrange(obj.hrange) {}
+
+    //! Assignment
+    Poly& operator=(const Poly& obj);
+
+    //! Move assignment
+    Poly& operator=(Poly&& obj) noexcept;
+
     //! Constructor of linear pixel scale running 1 to npix
     Poly(int npix);
 
@@ -0,0 +1,100 @@
+#ifndef TRM_SUBS_QUANTILE
+#define TRM_SUBS_QUANTILE
+
+#include <vector>
+#include "trm/subs.h"
+
+namespace Subs {
+
+  //! Approximate quantiles in one streaming pass
+
+  /** Quantile_sketch estimates quantiles of a stream of values without storing
+   * them, for cases such as display scaling or background estimation of large
+   * frames where exact percentiles are not needed. It is a "t-digest": the
+   * values are summarised by a set of centroids (mean and weight) which are
+   * kept small near the extremes of the distribution and larger towards the
+   * middle. The number of centroids, and hence the memory used, is of order
+   * the compression parameter whatever the number of values added.
+   *
+   * The rank error is roughly 1/compression in the middle of the
+   * distribution, falling to a fraction of this in the tails; with the
+   * default compression of 200 the median is typically good to a few tenths
+   * of a percent in rank, while the extreme percentiles are much better.
+   * The minimum and maximum are exact.
+   *
+   * Sketches are mergeable: separate threads or chunks of a frame can each
+   * build their own, which are then combined with merge. NaNs are ignored.
+   */
+  class Quantile_sketch {
+
+  public:
+
+    //! Default compression
+    static const int COMPRESSION = 200;
+
+    //! Constructor
+    Quantile_sketch(double compression=COMPRESSION);
+
+    //! Adds a value
+    void add(double x){
+      if(x == x){
+	if(int(buffer.size()) >= nbuffer) compress();
+	buffer.push_back(Centroid(x,1.));
+	if(x < vmin) vmin = x;
+	if(x > vmax) vmax = x;
+      }
+    }
+
+    //! Adds n values from an array
+    template <class X>
+    void add(const X* ptr, int n){
+      for(int i=0; i<n; i++) add(double(ptr[i]));
+    }
+
+    //! Merges in another sketch
+    void merge(const Quantile_sketch& sketch);
+
+    //! Returns the estimated quantile (frac from 0 to 1)
+    double quantile(double frac) const;
+
+    //! Returns the number of values added
+    double count() const;
+
+    //! Returns the smallest value added
+    double min() const;
+
+    //! Returns the largest value added
+    double max() const;
+
+    //! Returns the number of centroids in use
+    int size() const;
+
+    //! Clears the sketch ready for a new set of values
+    void reset();
+
+  private:
+
+    struct Centroid {
+      Centroid() : mean(0.), weight(0.) {}
+      Centroid(double m, double w) : mean(m), weight(w) {}
+      double mean, weight;
+      bool operator<(const Centroid& c) const {return mean < c.mean;}
+    };
+
+    // Merges the buffered values into the centroids
+    void compress() const;
+
+    double compression, vmin, vmax;
+
+    // Number of values buffered before each compression
+    int nbuffer;
+
+    // The centroids and the values yet to be merged into them; mutable
+    // so that quantile can compress first
+    mutable std::vector<Centroid> centroids, buffer;
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef TRM_SUBS_SIMD
+#define TRM_SUBS_SIMD
+
+#include <cmath>
+
+namespace Subs {
+
+  //! Vectorised kernels for elementwise operations and reductions
+
+  /** The routines in Subs::Simd carry out the inner loops of Array1D and
+   * Array2D. For float and double they are explicitly vectorised, with
+   * AVX-512 and AVX2 versions selected at run time according to what the
+   * CPU supports, and a portable version otherwise. Other types fall back
+   * to the templates below, which are plain loops. The choice of
+   * instruction set can be capped by setting the environment variable
+   * SUBS_SIMD to "generic" or "avx2" before the first call.
+   *
+   * Reductions are accumulated in several partial sums at once, so results
+   * can differ from a simple sequential loop in the last bits.
+   */
+  namespace Simd {
+
+    //! Returns the name of the instruction set in use ("avx512f", "avx2" or "generic")
+    const char* isa();
+
+    //! a[i] += b[i], i = 0 to n-1
+    void add(float* a, const float* b, int n);
+    void add(double* a, const double* b, int n);
+
+    //! a[i] -= b[i], i = 0 to n-1
+    void sub(float* a, const float* b, int n);
+    void sub(double* a, const double* b, int n);
+
+    //! a[i] *= b[i], i = 0 to n-1
+    void mul(float* a, const float* b, int n);
+    void mul(double* a, const double* b, int n);
+
+    //! a[i] /= b[i], i = 0 to n-1
+    void div(float* a, const float* b, int n);
+    void div(double* a, const double* b, int n);
+
+    //! a[i] += c, i = 0 to n-1
+    void add_const(float* a, float c, int n);
+    void add_const(double* a, double c, int n);
+
+    //! a[i] -= c, i = 0 to n-1
+    void sub_const(float* a, float c, int n);
+    void sub_const(double* a, double c, int n);
+
+    //! a[i] *= c, i = 0 to n-1
+    void mul_const(float* a, float c, int n);
+    void mul_const(double* a, double c, int n);
+
+    //! a[i] /= c, i = 0 to n-1
+    void div_const(float* a, float c, int n);
+    void div_const(double* a, double c, int n);
+
+    //! a[i] = sqrt(a[i]), i = 0 to n-1
+    void sqrt(float* a, int n);
+    void sqrt(double* a, int n);
+
+    //! a[i] = a[i] > thresh ? 1 : 0, i = 0 to n-1
+    void step(float* a, int n, float thresh);
+    void step(double* a, int n, double thresh);
+
+    //! Sum of a[i], i = 0 to n-1
+    float  sum(const float* a, int n);
+    double sum(const double* a, int n);
+
+    //! Sum of a[i], i = 0 to n-1, accumulated in double precision
+    double sum_double(const float* a, int n);
+    double sum_double(const double* a, int n);
+
+    //! Sum of a[i]*a[i], i = 0 to n-1
+    float  sumsq(const float* a, int n);
+    double sumsq(const double* a, int n);
+
+    //! Sum of (a[i]-m)^2, i = 0 to n-1, accumulated in double precision
+    double sumsq_dev(const float* a, int n, double m);
+    double sumsq_dev(const double* a, int n, double m);
+
+    //! Maximum of a[i], i = 0 to n-1; n must be > 0
+    float  max(const float* a, int n);
+    double max(const double* a, int n);
+
+    //! Minimum of a[i], i = 0 to n-1; n must be > 0
+    float  min(const float* a, int n);
+    double min(const double* a, int n);
+
+    //! Weights of 4-point Lagrange interpolation at offsets t[i] from the first point, i = 0 to n-1
+
+    /** wk[i] is the weight of point k (k = 0 to 3) for interpolation at t[i]
+     * from values at 0, 1, 2 and 3, and equally the fraction of a value at
+     * t[i] given to point k when spreading it over the four points.
+     */
+    void lagrange4(const float* t, int n, float* w0, float* w1, float* w2, float* w3);
+    void lagrange4(const double* t, int n, double* w0, double* w1, double* w2, double* w3);
+
+    //! Lower triangle of the rank-n update c += p^T p
+
+    /** p has n rows of m values, row i starting at p + i*ld, and c is m x m
+     * with rows ldc apart. Sets c[j*ldc+k] += sum_i p[i*ld+j]*p[i*ld+k] for
+     * 0 <= k <= j < m, leaving the upper triangle alone, as BLAS's SYRK.
+     */
+    void syrk(const float* p, int n, int m, int ld, float* c, int ldc);
+    void syrk(const double* p, int n, int m, int ld, double* c, int ldc);
+
+    //! Sums of a[i]*a[i], b[i]*b[i] and a[i]*b[i], i = 0 to n-1, in g[0], g[1] and g[2]
+    void gram(const float* a, const float* b, int n, float* g);
+    void gram(const double* a, const double* b, int n, double* g);
+
+    //! Plane rotation a[i] = c a[i] - s b[i], b[i] = s a[i] + c b[i], i = 0 to n-1
+    void rotate(float* a, float* b, int n, float c, float s);
+    void rotate(double* a, double* b, int n, double c, double s);
+
+    // Generic versions for other types
+
+    template <class X, class Y>
+    void add(X* a, const Y* b, int n){
+      for(int i=0; i<n; i++) a[i] += b[i];
+    }
+
+    template <class X, class Y>
+    void sub(X* a, const Y* b, int n){
+      for(int i=0; i<n; i++) a[i] -= b[i];
+    }
+
+    template <class X, class Y>
+    void mul(X* a, const Y* b, int n){
+      for(int i=0; i<n; i++) a[i] *= b[i];
+    }
+
+    template <class X, class Y>
+    void div(X* a, const Y* b, int n){
+      for(int i=0; i<n; i++) a[i] /= b[i];
+    }
+
+    template <class X>
+    void add_const(X* a, const X& c, int n){
+      for(int i=0; i<n; i++) a[i] += c;
+    }
+
+    template <class X>
+    void sub_const(X* a, const X& c, int n){
+      for(int i=0; i<n; i++) a[i] -= c;
+    }
+
+    template <class X>
+    void mul_const(X* a, const X& c, int n){
+      for(int i=0; i<n; i++) a[i] *= c;
+    }
+
+    template <class X>
+    void div_const(X* a, const X& c, int n){
+      for(int i=0; i<n; i++) a[i] /= c;
+    }
+
+    template <class X>
+    void sqrt(X* a, int n){
+      for(int i=0; i<n; i++) a[i] = std::sqrt(a[i]);
+    }
+
+    template <class X>
+    void step(X* a, int n, const X& thresh){
+      for(int i=0; i<n; i++) a[i] = a[i] > thresh ? X(1) : X(0);
+    }
+
+    template <class X>
+    X sum(const X* a, int n){
+      X t = 0;
+      for(int i=0; i<n; i++) t += a[i];
+      return t;
+    }
+
+    template <class X>
+    double sum_double(const X* a, int n){
+      double t = 0;
+      for(int i=0; i<n; i++) t += double(a[i]);
+      return t;
+    }
+
+    template <class X>
+    X sumsq(const X* a, int n){
+      X t = 0;
+      for(int i=0; i<n; i++) t += a[i]*a[i];
+      return t;
+    }
+
+    template <class X>
+    double sumsq_dev(const X* a, int n, double m){
+      double t = 0;
+      for(int i=0; i<n; i++) t += (a[i]-m)*(a[i]-m);
+      return t;
+    }
+
+    template <class X>
+    X max(const X* a, int n){
+      X t = a[0];
+      for(int i=1; i<n; i++) t = t < a[i] ? a[i] : t;
+      return t;
+    }
+
+    template <class X>
+    X min(const X* a, int n){
+      X t = a[0];
+      for(int i=1; i<n; i++) t = t > a[i] ? a[i] : t;
+      return t;
+    }
+
+  }
+
+}
+
+#endif
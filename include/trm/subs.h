@@ -11,7 +11,9 @@
 #include <sstream>
 #include <list>
 #include <vector>
+#include <algorithm>
 #include "plstream.h"
+#include "trm/thread_pool.h"
 
 //! Namespace for workhorse functions
 
@@ -329,21 +331,20 @@ namespace Subs {
     //! Simpson's rule integration routine
     float qsimp(float (*func)(float x), float a, float b);
 
-    //! Singular value decomposition
+    //! Singular value decomposition by one-sided Jacobi rotations, matrices stored by column
+    void svd_jacobi(int m, int n, double* a, double* w, double* v);
+
+    //! Singular value decomposition by Golub-Reinsch
     /**
-     * svdcmp performs singular value decomposition.
-     * Given an M x N matrix A this routine computes its
-     * singular value decomposition A = U.W.V^t. The matrix U
-     * replaces A on output. The diagonal matrix W is returned
-     * as a vector and the matrix V is returned in the last argument (not
-     * the transpose).
-     * \param a M x N matrix A. Declare e.g. a(M,N). M might be the number of data point and N the
-     * number of polynomials for example. Returns with elements of the matrix U.
+     * svdcmp_gr performs singular value decomposition by Householder
+     * bidiagonalisation and implicit QR iteration, as Numerical Recipes.
+     * It is used by svdcmp when there are fewer rows than columns.
+     * \param a M x N matrix A. Returns with elements of the matrix U.
      * \param w N element vector of diagonal elements of centre matrix W
      * \param v N by N elements of matrix V
      */
     template <class X>
-    void svdcmp(Buffer2D<X>& a,  Buffer1D<X>& w, Buffer2D<X>& v){
+    void svdcmp_gr(Buffer2D<X>& a,  Buffer1D<X>& w, Buffer2D<X>& v){
   
 	int m = a.nrow(), n = a.ncol();
 	w.resize(n);
@@ -524,6 +525,49 @@ namespace Subs {
 	    }
 	}
     }
+
+    //! Singular value decomposition
+    /**
+     * svdcmp performs singular value decomposition.
+     * Given an M x N matrix A this routine computes its
+     * singular value decomposition A = U.W.V^t. The matrix U
+     * replaces A on output. The diagonal matrix W is returned
+     * as a vector and the matrix V is returned in the last argument (not
+     * the transpose). When M >= N, A is copied by column into double
+     * precision and decomposed by svd_jacobi, which works along contiguous
+     * columns and can use several threads; otherwise svdcmp_gr is used.
+     * \param a M x N matrix A. Declare e.g. a(M,N). M might be the number of data point and N the
+     * number of polynomials for example. Returns with elements of the matrix U.
+     * \param w N element vector of diagonal elements of centre matrix W
+     * \param v N by N elements of matrix V
+     */
+    template <class X>
+    void svdcmp(Buffer2D<X>& a,  Buffer1D<X>& w, Buffer2D<X>& v){
+
+	const int m = a.nrow(), n = a.ncol();
+	if(m < n){
+	    svdcmp_gr(a, w, v);
+	    return;
+	}
+
+	w.resize(n);
+	v.resize(n,n);
+	std::vector<double> ac(m*n), wc(n), vc(n*n);
+	for(int i=0; i<m; i++)
+	    for(int j=0; j<n; j++)
+		ac[j*m+i] = a[i][j];
+
+	svd_jacobi(m, n, &ac[0], &wc[0], &vc[0]);
+
+	for(int i=0; i<m; i++)
+	    for(int j=0; j<n; j++)
+		a[i][j] = X(ac[j*m+i]);
+	for(int j=0; j<n; j++){
+	    w[j] = X(wc[j]);
+	    for(int i=0; i<n; i++)
+		v[i][j] = X(vc[j*n+i]);
+	}
+    }
 	
     //! Singular value decomposition, back substitution
     /** Solves u x = b for vectors x (N elements) and b (M elements),
@@ -575,6 +619,12 @@ namespace Subs {
 		  const Buffer1D<double>& cosine, const Buffer1D<double>& sine, 
 		  Buffer2D<float>& u, Buffer2D<float>& v, Buffer1D<float>& w);
 
+    //! QR decomposition fitting
+    double qrfit(const Buffer1D<rv>& data, Buffer1D<float>& a, const Buffer2D<float>& vect, double& cond);
+
+    //! QR decomposition fitting
+    double qrfit(const Buffer1D<ddat>& data, Buffer1D<double>& a, const Buffer2D<double>& vect, double& cond);
+
     //! Evaluates incomplete gamma function
     void  gser(double &gamser, double a, double x, double &gln);
 
@@ -606,6 +656,9 @@ namespace Subs {
     //! FFT of real double precision array
     void  fftr(double *data, unsigned long nump, int flag);
 
+    //! Fastest FFT length >= n
+    unsigned long int fft_size(unsigned long int n);
+
     //! Simultaneous FFT of two real double precision arrays
     void twofft(double data1[], double data2[], double fft1[], double fft2[], unsigned long int n);
 
@@ -618,6 +671,9 @@ namespace Subs {
     //! Amplitude spectrum, Press & Rybicki-type method
     void famp(double *x, float *y, float *e,  int n, double fmax, int nfreq, Subs::Buffer1D<double>& freq, Subs::Buffer1D<double>& amps);
 
+    //! Generalised (floating-mean, multi-harmonic) Lomb-Scargle periodogram, Press & Rybicki-type method
+    void glsper(double *x, float *y, float *e,  int n, double fmax, int nfreq, int nharm, Subs::Buffer1D<double>& freq, Subs::Buffer1D<double>& pgram);
+
     //! Burlisch-Stoer routine
     bool bsstep(double y[], double dydx[], int nv, double& xx, 
 		double htry, double eps, double yscal[], double &hdid, 
@@ -689,6 +745,18 @@ namespace Subs {
 
     //! Gauss-Jordan elimination
     void gaussj(double** a, int n, double** b, int m);
+
+    //! Cholesky factorisation of a symmetric positive definite matrix
+    void cholesky(double** a, int n);
+
+    //! Solution of linear equations after cholesky
+    void cholesky_solve(double** l, int n, double* b);
+
+    //! Inverse of a matrix after cholesky
+    void cholesky_invert(double** l, int n, double** inv);
+
+    //! Removes a point from a matrix after cholesky
+    bool cholesky_downdate(double** l, int n, double* x);
   
     //! Sigma clipping
     void sigma_reject(const float* data, int n, float thresh, bool careful,
@@ -1449,12 +1517,69 @@ namespace Subs {
     //! Find root of a function
     double rtsafe(const RTfunc& func, double x1, double x2, double xacc);
 
+    //! Partially orders arr[l..r] so that arr[k] is the value it would have if sorted
+    /**
+     * On exit arr[k] holds the value it would have were arr[l] to arr[r] sorted
+     * into ascending order, with no larger values before it and no smaller values
+     * after it. It uses the Floyd-Rivest algorithm, which for large ranges first
+     * selects within a small sample around the expected position of k to get
+     * pivots which bracket the target tightly, so that about n + min(k,n-k)
+     * comparisons are needed. Should the partitioning fail to make progress, as
+     * it can with adversarial input, it switches to the introselect of
+     * std::nth_element, so the worst case is bounded.
+     * \param arr array to select from. \b NB It is returned in a scrambled order!
+     * \param l first element of range
+     * \param r last element of range
+     * \param k the element to select, l <= k <= r
+     */
+    template <class T>
+    void select_range(T* arr, int l, int r, int k){
+	int budget = 64;
+	while(r > l){
+	    if(--budget == 0){
+		std::nth_element(arr+l, arr+k, arr+r+1);
+		return;
+	    }
+	    if(r - l > 600){
+		// Select within a sample around k to get good pivots
+		double n = r - l + 1;
+		double i = k - l + 1;
+		double z = std::log(n);
+		double s = 0.5*std::exp(2.*z/3.);
+		double sd = 0.5*std::sqrt(z*s*(n-s)/n)*(i < n/2 ? -1 : 1);
+		int ll = std::max(l, int(k - i*s/n + sd));
+		int rr = std::min(r, int(k + (n-i)*s/n + sd));
+		select_range(arr, ll, rr, k);
+	    }
+	    T t = arr[k];
+	    int i = l, j = r;
+	    std::swap(arr[l], arr[k]);
+	    if(arr[r] > t) std::swap(arr[r], arr[l]);
+	    while(i < j){
+		std::swap(arr[i], arr[j]);
+		i++;
+		j--;
+		while(arr[i] < t) i++;
+		while(arr[j] > t) j--;
+	    }
+	    if(arr[l] == t){
+		std::swap(arr[l], arr[j]);
+	    }else{
+		j++;
+		std::swap(arr[j], arr[r]);
+	    }
+	    if(j <= k) l = j + 1;
+	    if(k <= j) r = j - 1;
+	}
+    }
+
     //! Selects the k-th smallest value in an array arr[n].
     /**
      * 'select' finds the k-th smallest element of an array. Although
      * this can be done by sorting, it turns out that there is a speed
      * advantage in just going for the one element of interest. It scales
-     * linearly with the number of elements plus overheads.
+     * linearly with the number of elements plus overheads. See select_range
+     * for the method.
      * \param arr array to select from. \b NB It is returned in a scrambled order!
      * \param n number of elements
      * \param k the element to choose, starting with k=0 as the smallest,
@@ -1464,36 +1589,34 @@ namespace Subs {
     template <class T>
     T select(T* arr, int n, int k){
 	k = std::max(0, std::min(n-1, k));
-	int i, ir, j, l, mid;
-	T a;
-    
-	l  = 0;
-	ir = n-1;
-	for(;;){
-	    if(ir <= l+1){
-		if(ir == l+1 && arr[ir] < arr[l]) std::swap(arr[l],arr[ir]);
-		return arr[k];
-	    }else{
-		mid = (l+ir) >> 1;
-		std::swap(arr[mid],arr[l+1]);
-		if(arr[l] > arr[ir]) std::swap(arr[l],arr[ir]);
-		if(arr[l+1] > arr[ir]) std::swap(arr[l+1],arr[ir]);
-		if(arr[l] > arr[l+1]) std::swap(arr[l],arr[l+1]);
-		i = l+1;
-		j = ir;
-		a = arr[l+1];
-		for(;;){
-		    do i++; while(arr[i] < a);
-		    do j--; while(arr[j] > a);
-		    if(j < i) break;
-		    std::swap(arr[i],arr[j]);
-		}
-		arr[l+1] = arr[j];
-		arr[j]   = a;
-		if(j >= k) ir = j-1;
-		if(j <= k) l  = i;
-	    }
-	}
+	select_range(arr, 0, n-1, k);
+	return arr[k];
+    }
+
+    //! Selects several order statistics within arr[l..r]; see multiselect
+    template <class T>
+    void multiselect_range(T* arr, int l, int r, const int* k, int nk){
+	if(nk < 1 || r < l) return;
+	int m = nk/2;
+	select_range(arr, l, r, k[m]);
+	multiselect_range(arr, l, k[m]-1, k, m);
+	multiselect_range(arr, k[m]+1, r, k+m+1, nk-m-1);
+    }
+
+    //! Selects several order statistics of an array arr[n] at once.
+    /**
+     * On exit arr[k[i]] holds the k[i]-th smallest element for each i, as if
+     * 'select' had been called for each, but in one pass which recursively
+     * splits the array at the middle index requested. This is faster than
+     * separate calls to select when more than one value is wanted.
+     * \param arr array to select from. \b NB It is returned in a scrambled order!
+     * \param n number of elements
+     * \param k the elements to choose, in strictly ascending order from 0 to n-1
+     * \param nk the number of elements to choose
+     */
+    template <class T>
+    void multiselect(T* arr, int n, const int* k, int nk){
+	multiselect_range(arr, 0, n-1, k, nk);
     }
 
     //! Plot colours (PGPLOT)
@@ -1564,11 +1687,150 @@ namespace Subs {
 	}
     }
 
+    //! Running median of a sliding window
+
+    /** Running_median maintains the median of a set of values which changes by
+     * insertion and removal, as in a sliding window. The values are held in two
+     * heaps, a max-heap of the smaller half and a min-heap of the larger half,
+     * with each value's position in its heap tracked so that any can be removed.
+     * Insertion and removal each take O(log n) for n values in the window. Each
+     * value is identified by a slot number from 0 to nslot-1, which for a
+     * sliding window can be the pixel index modulo the window size.
+     */
+    template <class T>
+    class Running_median {
+
+    public:
+
+	//! Constructor, for slot numbers from 0 to nslot-1
+	Running_median(int nslot) : value(nslot), heap(nslot), pos(nslot) {
+	    low.reserve(nslot);
+	    high.reserve(nslot);
+	}
+
+	//! Adds value val in slot islot, which must not be in use
+	void insert(int islot, const T& val){
+	    value[islot] = val;
+	    if(high.empty() || !(val < value[high[0]])){
+		heap[islot] = 1;
+		pos[islot]  = high.size();
+		high.push_back(islot);
+		sift_up(high, 1, high.size()-1);
+	    }else{
+		heap[islot] = 0;
+		pos[islot]  = low.size();
+		low.push_back(islot);
+		sift_up(low, 0, low.size()-1);
+	    }
+	    balance();
+	}
+
+	//! Removes the value in slot islot
+	void remove(int islot){
+	    std::vector<int>& h = heap[islot] ? high : low;
+	    int ip = pos[islot];
+	    int il = h.back();
+	    h.pop_back();
+	    if(il != islot){
+		h[ip] = il;
+		pos[il] = ip;
+		sift_down(h, heap[islot], sift_up(h, heap[islot], ip));
+	    }
+	    balance();
+	}
+
+	//! Number of values held
+	int size() const {return low.size() + high.size();}
+
+	//! Returns the value of rank size()/2, i.e. the median for odd sizes, the upper of the middle two otherwise
+	const T& median() const {return value[high[0]];}
+
+	//! Clears all values
+	void clear(){
+	    low.clear();
+	    high.clear();
+	}
+
+    private:
+
+	// values by slot, which heap each slot is in (0 = low, 1 = high) and where
+	std::vector<T> value;
+	std::vector<int> heap, pos;
+
+	// slot numbers making up the max-heap 'low' and min-heap 'high'
+	std::vector<int> low, high;
+
+	// true if slot i should sit above slot j in heap h
+	bool before(int h, int i, int j) const {
+	    return h ? value[i] < value[j] : value[j] < value[i];
+	}
+
+	void place(std::vector<int>& hv, int ip, int islot){
+	    hv[ip] = islot;
+	    pos[islot] = ip;
+	}
+
+	int sift_up(std::vector<int>& hv, int h, int ip){
+	    int islot = hv[ip];
+	    while(ip > 0){
+		int ipar = (ip-1)/2;
+		if(!before(h, islot, hv[ipar])) break;
+		place(hv, ip, hv[ipar]);
+		ip = ipar;
+	    }
+	    place(hv, ip, islot);
+	    return ip;
+	}
+
+	void sift_down(std::vector<int>& hv, int h, int ip){
+	    int n = hv.size();
+	    int islot = hv[ip];
+	    for(;;){
+		int ic = 2*ip+1;
+		if(ic >= n) break;
+		if(ic+1 < n && before(h, hv[ic+1], hv[ic])) ic++;
+		if(!before(h, hv[ic], islot)) break;
+		place(hv, ip, hv[ic]);
+		ip = ic;
+	    }
+	    place(hv, ip, islot);
+	}
+
+	// move the top of one heap to the other
+	void move(std::vector<int>& from, int hfrom, std::vector<int>& to, int hto){
+	    int islot = from[0];
+	    int il = from.back();
+	    from.pop_back();
+	    if(!from.empty() && il != islot){
+		place(from, 0, il);
+		sift_down(from, hfrom, 0);
+	    }
+	    heap[islot] = hto;
+	    to.push_back(islot);
+	    pos[islot] = to.size()-1;
+	    sift_up(to, hto, to.size()-1);
+	}
+
+	// keep size()/2 values in low
+	void balance(){
+	    int ntarg = size()/2;
+	    while(int(low.size()) > ntarg)
+		move(low, 0, high, 1);
+	    while(int(low.size()) < ntarg)
+		move(high, 1, low, 0);
+	}
+
+    };
+
     //! Median filter
 
-    /* Median filter routine.
+    /* Median filter routine. Near the ends the window is truncated, and the
+     * value returned is then the upper of the middle two if the number of
+     * points is even. It uses a Running_median so the cost per point scales
+     * as log(width). Long inputs are split into overlapping chunks which are
+     * run in parallel if enabled by set_nthreads.
      * \param data the data to be filtered
-     * \param filt the output filtered data
+     * \param filt the output filtered data, which can be data itself
      * \param width the width in bins of the filter (odd)
      */
     template <class T>
@@ -1579,68 +1841,45 @@ namespace Subs {
 	    return;
 	}
 	
-	filt.resize(data.size());
-	
 	if(width % 2 == 0)
 	    throw Subs_Error("void Subs::medfilt(const Buffer1D<T>&, Buffer1D<T>&, int): filter width must be odd");
-	
-	// Get work space
-	unsigned long int *iptr = new unsigned long int[width];
-	T                 *tptr = new T[width];
-	
-	int np     = data.size();
-	int jstart = 0;
-	int jstop  = std::min(width/2, np-1);
-	unsigned long int nact = jstop+1;
-	
-	// Initialise, extending point at end which should not affect median.
-	for(size_t j=0; j<nact; j++)
-	    tptr[jstop+j] = data[j];
-	
-	Subs::heaprank(tptr+jstop, iptr, nact);
-	
-	// Sort
-	for(size_t j=0; j<nact; j++)
-	    tptr[j] = tptr[jstop+iptr[j]];
-	
-	filt[0] = tptr[nact/2];
-	for(int i=1; i<np; i++){
-      int jnew1 = std::max(i-width/2, 0);    
-      int jnew2 = std::min(i+width/2, np-1);
-	    
-      // Update key index: if start has changed, delete first point
-      if(jnew1 == jstart + 1){
-		nact--;
-		for(size_t j=0, jadd=0; j<nact; j++){
-          if(iptr[j] == 0) jadd = 1;
-          size_t jn = j + jadd;
-          iptr[j] = iptr[jn] - 1;
-          tptr[j] = tptr[jn];
-		}
-      }
-      
-      if(jnew2 == jstop + 1){
-		T test = data[jnew2];
-		int jtest   = locate(tptr, nact, test);
-		if(jtest == int(nact)){
-          iptr[nact] = nact;
-          tptr[nact] = test;
-		}else{
-          for(int j=nact; j>jtest; j--){
-			iptr[j] = iptr[j-1];
-			tptr[j] = tptr[j-1];
-          }
-          tptr[jtest] = test;
-          iptr[jtest] = nact;
-		}
-		nact++;
-      }
-      filt[i] = tptr[nact/2];
-      jstart = jnew1;
-      jstop  = jnew2;
+
+	// chunks read data on either side of the points they write
+	if(&data == &filt){
+	    Buffer1D<T> copy(data);
+	    medfilt(copy, filt, width);
+	    return;
+	}
+
+	filt.resize(data.size());
+
+	const int np = data.size();
+	const int hw = width/2;
+
+	// Filters points i1 to i2-1, starting with the window of point i1-1
+	auto chunk = [&](int i1, int i2){
+	    Running_median<T> rmed(width);
+	    for(int j=std::max(i1-hw-1, 0); j<std::min(i1+hw, np); j++)
+		rmed.insert(j % width, data[j]);
+	    for(int i=i1; i<i2; i++){
+		if(i-hw-1 >= 0) rmed.remove((i-hw-1) % width);
+		if(i+hw < np) rmed.insert((i+hw) % width, data[i+hw]);
+		filt[i] = rmed.median();
+	    }
+	};
+
+	const int nthreads = get_nthreads();
+	if(nthreads > 1 && np >= PARALLEL_MIN && np >= 16*width){
+	    // chunks long enough that refilling the window costs little
+	    const int nchunk = std::min(4*nthreads, np/(8*width));
+	    const int nper   = (np+nchunk-1)/nchunk;
+	    parallel_run(nchunk, [&](int ichunk){
+		    int i1 = ichunk*nper, i2 = std::min(np, i1+nper);
+		    if(i1 < i2) chunk(i1, i2);
+		});
+	}else{
+	    chunk(0, np);
 	}
-	delete[] iptr;
-	delete[] tptr;
     }
 
     //! Returns a double from a string
@@ -1743,9 +1982,15 @@ namespace Subs {
 	virtual ~Llfunc() {}
     };
 
+    //! Normal equations of a general linear least squares fit
+    void llsqr_normal(int ndata, const double* y, const float* e, int nfunc, double** func, double** alpha, double* beta);
+
     //! General linear least square fitter
     void llsqr(int ndata, const double* y, const float* e, int nfunc, double** func, double* coeff, double** covar);
 
+    //! General linear least square fits of many data vectors with the same functions
+    void llsqr(const Buffer2D<double>& y, const Buffer2D<float>& e, int nfunc, double** func, Buffer2D<double>& coeff);
+
     //! Evaluates Chi**2 after application of llsqr
     double llsqr_chisq(int ndata, const double* y, const float* e, int nfunc, double** func, const double* coeff);
 
@@ -1758,6 +2003,10 @@ namespace Subs {
     //! Carries out sigma clipping after llsqr
     int llsqr_reject(int ndata, const double* y, float* e, int nfunc, double** func, const double* coeff, double thresh, bool slow);
 
+    //! General linear least square fitter with iterative sigma clipping
+    int llsqr_clip(int ndata, const double* y, float* e, int nfunc, double** func, double thresh, bool slow, int ncycle,
+		   double* coeff, double** covar);
+
     //! General linear least square fitter
     void llsqr(int ndata, const double* x, const double* y, const float* e, const Llfunc& func, double* coeff, double** covar);
 
@@ -1773,6 +2022,10 @@ namespace Subs {
     //! Carries out sigma clipping after llsqr
     int llsqr_reject(int ndata, const double* x, const double* y, float* e, const Llfunc& func, const double* coeff, double thresh, bool slow);
 
+    //! General linear least square fitter with iterative sigma clipping
+    int llsqr_clip(int ndata, const double* x, const double* y, float* e, const Llfunc& func, double thresh, bool slow, int ncycle,
+		   double* coeff, double** covar);
+
 }; // end of subs namespace
 
 // 1D buffer template class
@@ -1829,6 +2082,12 @@ namespace Subs {
 	//! Copy constructor
 	Buffer1D(const Buffer1D& obj);
 
+	//! Move constructor
+	Buffer1D(Buffer1D&& obj) noexcept : buff(obj.buff), npix(obj.npix), nmem(obj.nmem) {
+	    obj.buff = NULL;
+	    obj.npix = obj.nmem = 0;
+	}
+
 	//! Constructor from a vector
 	Buffer1D(const std::vector<X>& obj);
 
@@ -1841,6 +2100,9 @@ namespace Subs {
 	//! Assignment
 	Buffer1D& operator=(const Buffer1D& obj);
 
+	//! Move assignment
+	Buffer1D& operator=(Buffer1D&& obj) noexcept;
+
 	//! Assignment
 	Buffer1D& operator=(const X& con);
 
@@ -2049,6 +2311,27 @@ namespace Subs {
 	return *this;
     }
 
+    /** Takes over the memory of a Buffer1D that is about to disappear
+     * rather than copying it. The Buffer1D moved from is left empty.
+     */
+    template <class X> 
+    Buffer1D<X>& Buffer1D<X>::operator=(Buffer1D<X>&& obj) noexcept {
+
+	if(this == &obj) return *this;
+
+	if(buff != NULL)
+	    delete[] buff;
+
+	buff = obj.buff;
+	npix = obj.npix;
+	nmem = obj.nmem;
+
+	obj.buff = NULL;
+	obj.npix = obj.nmem = 0;
+
+	return *this;
+    }
+
     /** Sets a Buffer1D to a constant
      */
     template <class X> 
@@ -0,0 +1,99 @@
+#ifndef TRM_SUBS_THREAD_POOL
+#define TRM_SUBS_THREAD_POOL
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+namespace Subs {
+
+  //! Parallel execution of array operations
+
+  /** Operations on large arrays (e.g. the reductions and in-place arithmetic
+   * of Array2D) can be split across a thread pool shared by the whole
+   * library. This is opt-in: by default everything runs in the calling
+   * thread. Call set_nthreads to enable it.
+   *
+   * Reductions are always formed from partial results over blocks of
+   * a fixed size which are then combined pairwise, so they give identical
+   * results whatever the number of threads.
+   *
+   * Parallel calls made from within a task, or while another thread is
+   * already using the pool, run serially in the calling thread.
+   */
+
+  //! Sets the number of threads for parallel operations
+  void set_nthreads(int nthreads);
+
+  //! Returns the number of threads for parallel operations
+  int get_nthreads();
+
+  //! Runs task(itask) for itask = 0 to ntask-1 across the thread pool
+  void parallel_run(int ntask, const std::function<void(int)>& task);
+
+  //! Minimum number of elements worth splitting across threads
+  const int PARALLEL_MIN = 32768;
+
+  //! Block size of the partial results of parallel_reduce
+  const int REDUCE_BLOCK = 65536;
+
+  //! Applies a function to ranges which cover 0 to n-1
+
+  /** func(i1, i2) is called on disjoint ranges i1 to i2-1 which together
+   * cover 0 to n-1. Arrays of fewer than PARALLEL_MIN elements are not split.
+   * \param n    number of elements
+   * \param func function object with signature void func(int i1, int i2)
+   */
+  template <class Func>
+  void parallel_for(int n, const Func& func){
+    const int nthreads = get_nthreads();
+    if(nthreads <= 1 || n < PARALLEL_MIN){
+      func(0, n);
+    }else{
+      // a few chunks per thread to even out the load
+      const int nchunk = std::min(4*nthreads, (n+PARALLEL_MIN/4-1)/(PARALLEL_MIN/4));
+      const int nper   = (n+nchunk-1)/nchunk;
+      parallel_run(nchunk, [&](int ichunk){
+	  int i1 = ichunk*nper, i2 = std::min(n, i1+nper);
+	  if(i1 < i2) func(i1, i2);
+	});
+    }
+  }
+
+  //! Reduces 0 to n-1 deterministically
+
+  /** The range is split into blocks of REDUCE_BLOCK elements, partial(i1, i2) is
+   * evaluated for each block, in parallel if enabled, and the results are
+   * combined pairwise with combine(a, b). The blocks and the order of
+   * combination depend only upon n, so the result does not depend upon the
+   * number of threads.
+   * \param n       number of elements, > 0
+   * \param partial function object with signature R partial(int i1, int i2)
+   * \param combine function object with signature R combine(const R& a, const R& b)
+   */
+  template <class R, class Partial, class Combine>
+  R parallel_reduce(int n, const Partial& partial, const Combine& combine){
+    const int nblock = (n+REDUCE_BLOCK-1)/REDUCE_BLOCK;
+    if(nblock <= 1) return partial(0, n);
+
+    std::vector<R> part(nblock);
+    auto block = [&](int ib){
+      part[ib] = partial(ib*REDUCE_BLOCK, std::min(n, (ib+1)*REDUCE_BLOCK));
+    };
+    if(get_nthreads() > 1){
+      parallel_run(nblock, block);
+    }else{
+      for(int ib=0; ib<nblock; ib++) block(ib);
+    }
+
+    for(int np=nblock; np>1; np=(np+1)/2){
+      for(int i=0; i<np/2; i++)
+	part[i] = combine(part[2*i], part[2*i+1]);
+      if(np % 2 == 1) part[np/2] = part[np-1];
+    }
+    return part[0];
+  }
+
+}
+
+#endif
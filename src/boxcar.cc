@@ -1,9 +1,14 @@
 #include "trm/subs.h"
+#include "trm/filter.h"
 
-/* Boxcar filter routine (Stu Littlefair)
+/* Boxcar filter routine (Stu Littlefair). Each output point is the mean of the
+ * input points from j-width to j+width, truncated at the ends. A running sum is
+ * kept, by Subs::Window_sum, so the cost per point does not depend upon width.
+ * For compatibility with earlier versions, width = 1 returns the data
+ * unfiltered rather than averaged over 3 points.
  * \param data the data to be filtered
- * \param filt the output filtered data
- * \param width the width in bins of the filter (odd)
+ * \param filt the output filtered data, which can be data itself
+ * \param width the half-width in bins of the filter
  */
 void Subs::boxcar(const Buffer1D<double>& data, Buffer1D<double>& filt, int width){
 
@@ -12,19 +17,13 @@ void Subs::boxcar(const Buffer1D<double>& data, Buffer1D<double>& filt, int widt
     return;
   }
 
-  filt.resize(data.size());
-  int np     = data.size();
-
-  for(int j=0; j<np; j++){
-    double sum=0.;
-    int npix=0;
-    for(int i=std::max(j-width,0); i<std::min(j+width+1,np); i++){
-      sum += data[i];
-      npix++;
-    }
-    filt[j]=sum/npix;
+  if(&data == &filt){
+    Buffer1D<double> copy(data);
+    boxcar(copy, filt, width);
+    return;
   }
 
-}
-
+  filt.resize(data.size());
+  boxcar_line(data.ptr(), filt.ptr(), data.size(), width);
 
+}
@@ -0,0 +1,130 @@
+#include <cmath>
+#include "trm/subs.h"
+#include "trm/buffer2d.h"
+
+/**
+ * cholesky computes the Cholesky factorisation A = L L^T of a symmetric,
+ * positive definite matrix. Only the lower triangle of a, a[j][k] with k <= j,
+ * is used, and it is overwritten by L, leaving the upper triangle alone. The
+ * rows of a are worked along, so each step is a dot product of contiguous
+ * values.
+ * \param a n by n matrix, returned with L in its lower triangle
+ * \param n dimension of a
+ * \exception Throws Subs::Subs_Error if a is not positive definite.
+ */
+
+void Subs::cholesky(double** a, int n){
+
+  if(n < 1)
+    throw Subs_Error("void Subs::cholesky(double**, int): n < 1");
+
+  for(int j=0; j<n; j++){
+    double* aj = a[j];
+    for(int k=0; k<j; k++){
+      const double* ak = a[k];
+      double sum = aj[k];
+      for(int l=0; l<k; l++) sum -= aj[l]*ak[l];
+      aj[k] = sum/ak[k];
+    }
+    double diag = aj[j];
+    for(int l=0; l<j; l++) diag -= aj[l]*aj[l];
+    if(diag <= 0.)
+      throw Subs_Error("void Subs::cholesky(double**, int): matrix not positive definite at row " + Subs::str(j));
+    aj[j] = sqrt(diag);
+  }
+}
+
+/**
+ * cholesky_solve solves A x = b given the factor L of A from cholesky.
+ * \param l n by n matrix from cholesky
+ * \param n dimension of l
+ * \param b vector of n values, returned as the solution x
+ */
+
+void Subs::cholesky_solve(double** l, int n, double* b){
+
+  // L y = b
+  for(int j=0; j<n; j++){
+    const double* lj = l[j];
+    double sum = b[j];
+    for(int k=0; k<j; k++) sum -= lj[k]*b[k];
+    b[j] = sum/lj[j];
+  }
+
+  // L^T x = y
+  for(int j=n-1; j>=0; j--){
+    b[j] /= l[j][j];
+    const double bj = b[j];
+    const double* lj = l[j];
+    for(int k=0; k<j; k++) b[k] -= lj[k]*bj;
+  }
+}
+
+/**
+ * cholesky_invert computes the inverse of A given its factor L from
+ * cholesky, as is needed for the covariances of least-squares fits.
+ * \param l   n by n matrix from cholesky; its lower triangle is left unchanged
+ * \param n   dimension of l
+ * \param inv n by n matrix, returned as the full, symmetric, inverse of A
+ */
+
+void Subs::cholesky_invert(double** l, int n, double** inv){
+
+  // U = L^-1 transposed, upper triangular, so that A^-1 = U U^T can be
+  // formed from dot products along rows of U
+  Buffer2D<double> u(n, n);
+  for(int k=0; k<n; k++){
+
+    // column k of L^-1, i.e. row k of U, from L z = e_k; z[j] = 0 for j < k
+    double* uk = u[k];
+    for(int j=0; j<k; j++) uk[j] = 0.;
+    uk[k] = 1./l[k][k];
+    for(int j=k+1; j<n; j++){
+      const double* lj = l[j];
+      double sum = 0.;
+      for(int m=k; m<j; m++) sum -= lj[m]*uk[m];
+      uk[j] = sum/lj[j];
+    }
+  }
+
+  for(int j=0; j<n; j++){
+    const double* uj = u[j];
+    for(int k=0; k<=j; k++){
+      const double* uk = u[k];
+      double sum = 0.;
+      for(int m=j; m<n; m++) sum += uj[m]*uk[m];
+      inv[j][k] = inv[k][j] = sum;
+    }
+  }
+}
+
+/**
+ * cholesky_downdate changes the factor L of A from cholesky to that of A -
+ * x x^T, as when a point is removed from the normal equations of a least
+ * squares fit, in O(n^2) rather than the O(n^3) of factorising again. It
+ * uses the hyperbolic rotations of LINPACK's dchdd, which can lose accuracy
+ * when A - x x^T is close to singular.
+ * \param l n by n matrix from cholesky, returned with the factor of A - x x^T
+ * \param n dimension of l
+ * \param x vector of n values; overwritten
+ * \return false if A - x x^T is not positive definite, in which case l is
+ * left part-way through and must be recomputed
+ */
+
+bool Subs::cholesky_downdate(double** l, int n, double* x){
+
+  for(int k=0; k<n; k++){
+    const double lkk = l[k][k];
+    const double r2  = (lkk-x[k])*(lkk+x[k]);
+    if(r2 <= 0.) return false;
+    const double r = sqrt(r2);
+    const double c = r/lkk, s = x[k]/lkk;
+    l[k][k] = r;
+    for(int j=k+1; j<n; j++){
+      double& ljk = l[j][k];
+      ljk  = (ljk - s*x[j])/c;
+      x[j] = c*x[j] - s*ljk;
+    }
+  }
+  return true;
+}
@@ -1,316 +1,708 @@
 #include <cstdlib>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iostream>
+#include <list>
+#include <mutex>
 #include "trm/subs.h"
 #include "trm/constants.h"
+#include "trm/simd.h"
+#include "trm/thread_pool.h"
+#include "trm/fft.h"
+#include "simd_ops.h"
+
+namespace {
+
+  // Passes of one element type and one instruction set, indexed by radix
+  template <class X>
+  struct Fft_kernels {
+    void (*pass[8])(const X*, const X*, X*, X*, long, long, int, const X*, const X*);
+  };
+
+  namespace kgeneric {
+#define SIMD_TARGET
+#include "fft_kernels.h"
+#undef SIMD_TARGET
+  }
 
-/**  FFT routine. 
- *  
- * \param data the data array. This must have alternate real and imaginary components (see NR for more
- *  details).
- * \param nump the number of points. This must be a power of 2; zero pad if necessary
- * \param flag flag  *  If flag = 1, data[nump] is replaced by it's discrete fourier transform.
- *  If flag =-1, data[nump] is replaced by it's inverse FT.
- */
-
-void Subs::fft(float* data, long unsigned int nump, int flag) {
-
-  unsigned long m, mmax, i, j, istep;
-  double wtemp, wr, wpr, wpi, wi, theta;
-  float rtemp, itemp;
+#ifdef TRM_SIMD_X86
 
-  // A few stupidity checks...
-  if((flag != 1) && (flag != -1)) throw Subs_Error("Input flag to Subs::fft must be +/-1!");
+  namespace kavx2 {
+#define SIMD_TARGET TRM_AVX2
+#include "fft_kernels.h"
+#undef SIMD_TARGET
+  }
 
-  // Keep shifting i until the msb goes off the end.
-  // If there is anything left, this wasn't 2^(int)!        
+  namespace kavx512 {
+#define SIMD_TARGET TRM_AVX512
+#include "fft_kernels.h"
+#undef SIMD_TARGET
+  }
 
-  i = nump << 1;
-  j = nump;
-  while(i > j) {
-    j = i;
-    i <<= 1;
+#endif
+
+  // The passes use the instruction set chosen by Subs::Simd
+  template <class X>
+  Fft_kernels<X> make_kernels(){
+    Fft_kernels<X> kernels;
+#ifdef TRM_SIMD_X86
+    const char* isa = Subs::Simd::isa();
+    if(std::strcmp(isa, "avx512f") == 0){
+      kavx512::fill<Avx512<X> >(kernels);
+      return kernels;
+    }else if(std::strcmp(isa, "avx2") == 0){
+      kavx2::fill<Avx2<X> >(kernels);
+      return kernels;
+    }
+#endif
+    kgeneric::fill<Generic<X> >(kernels);
+    return kernels;
   }
-  if(i != 0) throw Subs_Error(Subs::str(nump) + " is not an integer power of 2!");
 
-  // because we are manipulating the data alot, it is
-  // more efficient to do in a normal array.
-  // Bit reversal (part of FFT algorithm)
+  template <class X>
+  const Fft_kernels<X>& kernels(){
+    static const Fft_kernels<X> kern = make_kernels<X>();
+    return kern;
+  }
 
-  j=1;
-  for(i=1; i<nump; i+=2) {
-    if(j > i) {
-      std::swap(data[j-1], data[i-1]);
-      std::swap(data[j],   data[i]);
+  // Most elements of workspace kept by each thread between transforms;
+  // larger buffers are released once the transform is over
+  const unsigned long int WORK_KEEP = 1 << 20;
+
+  // Per-thread workspace of at least n elements, released when the guard
+  // goes out of scope if it has grown beyond WORK_KEEP elements, even if an
+  // exception is thrown. Bluestein's algorithm uses slot 1 while the
+  // transforms it calls use slot 0.
+  template <class X>
+  class Work_guard {
+  public:
+    Work_guard(unsigned long int n, int slot=0) : work(buffer(slot)) {
+      if(work.size() < n) work.resize(n);
+    }
+    ~Work_guard(){
+      if(work.capacity() > WORK_KEEP) std::vector<X>().swap(work);
     }
-    m = nump >> 1;
-    while((m >= 2) && (j > m)) {
-      j -= m;
-      m >>= 1;
+    X* ptr(){return &work[0];}
+  private:
+    static std::vector<X>& buffer(int slot){
+      static thread_local std::vector<X> work[2];
+      return work[slot];
+    }
+    std::vector<X>& work;
+  };
+
+  // Runs func(i1, i2) over batches 0 to n-1, across threads if there are
+  // enough elements in all
+  template <class Func>
+  void run_batches(int n, double nelem, const Func& func){
+    const int nthreads = Subs::get_nthreads();
+    if(nthreads > 1 && n > 1 && nelem >= Subs::PARALLEL_MIN){
+      const int nchunk = std::min(4*nthreads, n);
+      const int nper   = (n+nchunk-1)/nchunk;
+      Subs::parallel_run(nchunk, [&](int ichunk){
+	  int i1 = ichunk*nper, i2 = std::min(n, i1+nper);
+	  if(i1 < i2) func(i1, i2);
+	});
+    }else{
+      func(0, n);
     }
-    j += m;
   }
 
-  // Blame Daniel and Lanczos for this bit...
-  // Some kind of trigonometric recurrence (must be done
-  // in double precision) 
-
-  mmax = 2;
-  while(nump > mmax) {
-    istep = mmax << 1;
-    theta = flag * (Constants::TWOPI/(double)mmax); /* Inverse or forward? */
-    wtemp = sin(0.5 * theta);
-    wpr = -2.0 * sqr(wtemp);
-    wpi = sin(theta);
-    wr = 1.0;
-    wi = 0.0;
-    for(m=1; m<mmax; m+=2) {
-      for(i=m; i<=nump; i+=istep) {
-	j = i+mmax;
-	rtemp = wr*data[j-1] - wi*data[j];
-	itemp = wr*data[j] + wi*data[j-1];
-	data[j-1] = data[i-1] - rtemp;
-	data[j] = data[i] - itemp;
-	data[i-1] += rtemp;
-	data[i] += itemp;
-      }
-      wtemp = wr;
-      wr = wr*wpr - wi*wpi + wr;
-      wi = wi*wpr + wtemp*wpi + wi;
+  // Number of complex columns copied at a time by fft_cols
+  const int COL_BLOCK = 16;
+
+  // Most plans of each precision kept by Fft_plan::get
+  const size_t PLAN_CACHE = 32;
+
+  // The plans kept by Fft_plan::get, most recently used first
+  template <class X>
+  struct Plan_cache {
+    typedef std::list<std::shared_ptr<const Subs::Fft_plan<X> > > List;
+    std::mutex mutex;
+    List plans;
+    static Plan_cache& instance(){
+      static Plan_cache cache;
+      return cache;
     }
-    mmax = istep;
+  };
+
+  // Removes the factors of 2, 3, 5 and 7 from n
+  unsigned long int rough_part(unsigned long int n){
+    if(n == 0) return 0;
+    const unsigned long int primes[] = {2, 3, 5, 7};
+    for(int i=0; i<4; i++)
+      while(n % primes[i] == 0) n /= primes[i];
+    return n;
   }
-} 
 
-/** FFT routine for real data. Output data is in real, imag, real, imag form as per 
- * normal except for data[1] which is f_(N/2) since both this and f_0 are real, not complex.
- *
- * \param data real array of data
- * \param nump the number of points, a power of 2
- * \param flag flag=1, data[nump] is replaced by it's discrete fourier transform.
- * If flag=-1, data[nump] is replaced by it's inverse FT .(Multiply by 2/n to get
- * back original data)
+}
+
+/** Returns the plan for a given number of points. The PLAN_CACHE plans most
+ * recently asked for are kept; older ones are dropped from the cache, and
+ * freed once no transform is using them. The most recent plan used by each
+ * thread is also remembered so that repeated transforms of one length need
+ * no locking.
+ * \param n the number of complex points
  */
+template <class X>
+std::shared_ptr<const Subs::Fft_plan<X> > Subs::Fft_plan<X>::get(unsigned long int n){
+
+  static thread_local std::shared_ptr<const Fft_plan> last;
+  if(last && last->size() == n) return last;
+
+  Plan_cache<X>& cache = Plan_cache<X>::instance();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  typename Plan_cache<X>::List& plans = cache.plans;
+  typename Plan_cache<X>::List::iterator it = plans.begin();
+  while(it != plans.end() && (*it)->size() != n) ++it;
+  if(it == plans.end()){
+    plans.push_front(std::make_shared<const Fft_plan>(n));
+    if(plans.size() > PLAN_CACHE) plans.pop_back();
+  }else if(it != plans.begin()){
+    plans.splice(plans.begin(), plans, it);
+  }
+  last = plans.front();
+  return last;
+}
 
-void Subs::fftr(float* data, unsigned long int nump, int flag) {
+/** Empties the cache of plans, which are then freed once no transform is
+ * using them, apart from the last plan used by each thread, which is kept
+ * until that thread asks for another length.
+ */
+template <class X>
+void Subs::Fft_plan<X>::clear_cache(){
+  Plan_cache<X>& cache = Plan_cache<X>::instance();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.plans.clear();
+}
+
+/** Constructs the tables for a given number of points
+ * \param n the number of complex points
+ */
+template <class X>
+Subs::Fft_plan<X>::Fft_plan(unsigned long int n) : n(n), rcosine(n/2+1), rsine(n/2+1) {
 
-  unsigned long int i,i1,i2,i3,i4,np1;
-  float c1=0.5,c2,h1r,h1i,h2r,h2i;
-  double wr,wi,wpr,wpi,wtemp,theta;
- 
-  theta = Constants::PI/(double) (nump>>1);
-  if (flag == 1) {
-    c2 = -0.5;
-    fft(data,nump,1);
-  } else {
-    c2=0.5;
-    theta = -theta;
+  for(unsigned long int k=0; k<=n/2; k++){
+    double theta = Constants::PI*k/n;
+    rcosine[k] = X(std::cos(theta));
+    rsine[k]   = X(std::sin(theta));
   }
-  wtemp=sin(0.5*theta);
-  wpr = -2.0*wtemp*wtemp;
-  wpi=sin(theta);
-  wr=1.0+wpr;
-  wi=wpi;
-  np1=nump+1;
-  for (i=1;i<(nump>>2);i++) {
-    i4=1+(i3=np1-(i2=1+(i1=i+i)));
-    h1r=c1*(data[i1]+data[i3]);
-    h1i=c1*(data[i2]-data[i4]);
-    h2r = -c2*(data[i2]+data[i4]);
-    h2i=c2*(data[i1]-data[i3]);
-    data[i1]=h1r+wr*h2r-wi*h2i;
-    data[i2]=h1i+wr*h2i+wi*h2r;
-    data[i3]=h1r-wr*h2r+wi*h2i;
-    data[i4] = -h1i+wr*h2i+wi*h2r;
-    wr=(wtemp=wr)*wpr-wi*wpi+wr;
-    wi=wi*wpr+wtemp*wpi+wi;
+
+  if(n < 2) return;
+
+  if(rough_part(n) == 1){
+
+    // radix-4 passes, then one of radix 2 if need be, then the odd radices
+    unsigned long int m = n;
+    while(m % 4 == 0){
+      radix.push_back(4);
+      m /= 4;
+    }
+    const int odd[] = {2, 3, 5, 7};
+    for(int i=0; i<4; i++){
+      while(m % odd[i] == 0){
+	radix.push_back(odd[i]);
+	m /= odd[i];
+      }
+    }
+
+    cosine.resize(n);
+    sine.resize(n);
+    for(unsigned long int t=0; t<n; t++){
+      double theta = Constants::TWOPI*t/n;
+      cosine[t] = X(std::cos(theta));
+      sine[t]   = X(std::sin(theta));
+    }
+
+  }else{
+
+    // sum_j x_j exp(2 pi i j k/n) = c_k sum_j (x_j c_j) conj(c_{k-j}) with
+    // c_t = exp(i pi t^2/n), a convolution which is done with FFTs of length
+    // nc >= 2n-1. t^2 is reduced modulo 2n to keep the angles accurate.
+    const unsigned long int nc = fft_size(2*n-1);
+    chirp_plan = std::make_shared<const Fft_plan>(nc);
+
+    chirpr.resize(n);
+    chirpi.resize(n);
+    for(unsigned long int t=0; t<n; t++){
+      double theta = Constants::PI*double((t*t) % (2*n))/n;
+      chirpr[t] = X(std::cos(theta));
+      chirpi[t] = X(std::sin(theta));
+    }
+
+    std::vector<X> kern(2*nc, X(0));
+    kern[0] = chirpr[0];
+    kern[1] = -chirpi[0];
+    for(unsigned long int t=1; t<n; t++){
+      kern[2*t]        = kern[2*(nc-t)]   =  chirpr[t];
+      kern[2*t+1]      = kern[2*(nc-t)+1] = -chirpi[t];
+    }
+    chirp_plan->fft(&kern[0], 1);
+
+    kernelr.resize(nc);
+    kerneli.resize(nc);
+    for(unsigned long int k=0; k<nc; k++){
+      kernelr[k] = kern[2*k]/nc;
+      kerneli[k] = kern[2*k+1]/nc;
+    }
   }
-  if (flag == 1) {
-    data[0] = (h1r=data[0])+data[1];
-    data[1] = h1r-data[1];
-  } else {
-    data[0]=c1*((h1r=data[0])+data[1]);
-    data[1]=c1*(h1r-data[1]);
-    fft(data,nump,-1);
+}
+
+template <class X>
+bool Subs::Fft_plan<X>::transform(X* ar, X* ai, X* br, X* bi, int flag) const {
+  if(chirp_plan) return bluestein(ar, ai, br, bi, flag);
+  const Fft_kernels<X>& kern = kernels<X>();
+  long m = n, s = 1;
+  bool inb = false;
+  for(size_t i=0; i<radix.size(); i++){
+    m /= radix[i];
+    kern.pass[radix[i]](ar, ai, br, bi, m, s, flag, &cosine[0], &sine[0]);
+    s *= radix[i];
+    std::swap(ar, br);
+    std::swap(ai, bi);
+    inb = !inb;
   }
-} 
+  return inb;
+}
 
-/**  FFT routine. 
- *  
- * \param data the data array. This must have alternate real and imaginary components (see NR for more
- *  details).
- * \param nump the number of points. This must be a power of 2; zero pad if necessary
- * \param flag flag  *  If flag = 1, data[nump] is replaced by it's discrete fourier transform.
- *  If flag =-1, data[nump] is replaced by it's inverse FT. 
+/* The inverse is found from the forward transform of the conjugate chirp,
+ * which comes to the same as conjugating the chirp and the transform of the
+ * kernel, the latter being the transform of a symmetric sequence. The result
+ * always ends up in (br,bi).
  */
+template <class X>
+bool Subs::Fft_plan<X>::bluestein(X* ar, X* ai, X* br, X* bi, int flag) const {
 
-void Subs::fft(double* data, long unsigned int nump, int flag) {
+  const unsigned long int nc = chirp_plan->size();
+  Work_guard<X> guard(4*nc, 1);
+  X *ur = guard.ptr(), *ui = ur + nc, *vr = ui + nc, *vi = vr + nc;
+
+  for(unsigned long int j=0; j<n; j++){
+    const X cr = chirpr[j], ci = flag*chirpi[j];
+    ur[j] = ar[j]*cr - ai[j]*ci;
+    ui[j] = ar[j]*ci + ai[j]*cr;
+  }
+  std::fill(ur+n, ur+nc, X(0));
+  std::fill(ui+n, ui+nc, X(0));
 
-  unsigned long m, mmax, i, j, istep;
-  double wtemp, wr, wpr, wpi, wi, theta;
-  double rtemp, itemp;
+  if(chirp_plan->transform(ur, ui, vr, vi, 1)){
+    std::swap(ur, vr);
+    std::swap(ui, vi);
+  }
+
+  for(unsigned long int k=0; k<nc; k++){
+    const X kr = kernelr[k], ki = flag*kerneli[k];
+    const X tr = ur[k]*kr - ui[k]*ki;
+    ui[k] = ur[k]*ki + ui[k]*kr;
+    ur[k] = tr;
+  }
+
+  if(chirp_plan->transform(ur, ui, vr, vi, -1)){
+    std::swap(ur, vr);
+    std::swap(ui, vi);
+  }
 
-  // A few stupidity checks...
+  for(unsigned long int k=0; k<n; k++){
+    const X cr = chirpr[k], ci = flag*chirpi[k];
+    br[k] = ur[k]*cr - ui[k]*ci;
+    bi[k] = ur[k]*ci + ui[k]*cr;
+  }
+  return true;
+}
+
+/** In-place complex FFT
+ * \param data the data array, of n complex values with alternate real and imaginary components
+ * \param flag 1 for the forward transform, -1 for the inverse
+ */
+template <class X>
+void Subs::Fft_plan<X>::fft(X* data, int flag) const {
 
   if((flag != 1) && (flag != -1)) throw Subs_Error("Input flag to Subs::fft must be +/-1!");
+  if(n < 2) return;
 
-  // Keep shifting i until the msb goes off the end.
-  // If there is anything left, this wasn't 2^(int)!        
+  Work_guard<X> guard(4*n);
+  X *ar = guard.ptr(), *ai = ar + n, *br = ai + n, *bi = br + n;
+  for(unsigned long int j=0; j<n; j++){
+    ar[j] = data[2*j];
+    ai[j] = data[2*j+1];
+  }
 
-  i = nump << 1;
-  j = nump;
-  while(i > j) {
-    j = i;
-    i <<= 1;
+  if(transform(ar, ai, br, bi, flag)){
+    ar = br;
+    ai = bi;
   }
-  if(i != 0) throw Subs_Error(Subs::str(nump) + " is not an integer power of 2!");
 
-  // because we are manipulating the data a lot, it is
-  // more efficient to do in a normal array.
-  // Bit reversal (part of FFT algorithm)
+  for(unsigned long int j=0; j<n; j++){
+    data[2*j]   = ar[j];
+    data[2*j+1] = ai[j];
+  }
+}
+
+/** In-place complex FFT of separate real and imaginary parts
+ * \param real the n real parts
+ * \param imag the n imaginary parts
+ * \param flag 1 for the forward transform, -1 for the inverse
+ */
+template <class X>
+void Subs::Fft_plan<X>::fft(X* real, X* imag, int flag) const {
+
+  if((flag != 1) && (flag != -1)) throw Subs_Error("Input flag to Subs::fft must be +/-1!");
+  if(n < 2) return;
+
+  Work_guard<X> guard(2*n);
+  X *br = guard.ptr(), *bi = br + n;
+  if(transform(real, imag, br, bi, flag)){
+    std::copy(br, br+n, real);
+    std::copy(bi, bi+n, imag);
+  }
+}
 
-  j=1;
-  for(i=1; i<nump; i+=2) {
-    if(j > i) {
-      std::swap(data[j-1], data[i-1]);
-      std::swap(data[j],   data[i]);
+/** In-place FFT of real data, using a complex FFT of half the length.
+ * \param data 2n real values. On output of the forward transform, data[0] and
+ * data[1] are the real values at zero and the Nyquist frequency, followed by
+ * real, imaginary pairs for frequencies 1 to n-1.
+ * \param flag 1 for the forward transform, -1 for the inverse (which should be
+ * multiplied by 1/n to get back the original data)
+ */
+template <class X>
+void Subs::Fft_plan<X>::fftr(X* data, int flag) const {
+
+  if((flag != 1) && (flag != -1)) throw Subs_Error("Input flag to Subs::fftr must be +/-1!");
+  if(n < 1) return;
+
+  Work_guard<X> guard(4*n);
+  X *ar = guard.ptr(), *ai = ar + n, *br = ai + n, *bi = br + n;
+
+  if(flag == 1){
+
+    // even and odd points as real and imaginary parts
+    for(unsigned long int j=0; j<n; j++){
+      ar[j] = data[2*j];
+      ai[j] = data[2*j+1];
     }
-    m = nump >> 1;
-    while((m >= 2) && (j > m)) {
-      j -= m;
-      m >>= 1;
+
+    if(transform(ar, ai, br, bi, 1)){
+      ar = br;
+      ai = bi;
+    }
+
+    // Separate the transforms E and O of the even and odd points, then
+    // F_k = E_k + exp(i pi k/n) O_k and F_{n-k} = conj(E_k - exp(i pi k/n) O_k)
+    data[0] = ar[0] + ai[0];
+    data[1] = ar[0] - ai[0];
+    for(unsigned long int k=1, nk=n-1; k<=nk; k++, nk--){
+      const X er = (ar[k]+ar[nk])/2, ei = (ai[k]-ai[nk])/2;
+      const X orr = (ai[k]+ai[nk])/2, oi = (ar[nk]-ar[k])/2;
+      const X wr = rcosine[k], wi = rsine[k];
+      const X tr = wr*orr - wi*oi, ti = wr*oi + wi*orr;
+      data[2*k]    =  er + tr;
+      data[2*k+1]  =  ei + ti;
+      data[2*nk]   =  er - tr;
+      data[2*nk+1] = -ei + ti;
+    }
+
+  }else{
+
+    // Form Z_k = E_k + i O_k from E_k = (F_k + conj F_{n-k})/2 and
+    // O_k = exp(-i pi k/n) (F_k - conj F_{n-k})/2
+    ar[0] = (data[0]+data[1])/2;
+    ai[0] = (data[0]-data[1])/2;
+    for(unsigned long int k=1, nk=n-1; k<=nk; k++, nk--){
+      const X fr = data[2*k], fi = data[2*k+1], gr = data[2*nk], gi = data[2*nk+1];
+      const X er = (fr+gr)/2, ei = (fi-gi)/2;
+      const X dr = (fr-gr)/2, di = (fi+gi)/2;
+      const X wr = rcosine[k], wi = rsine[k];
+      const X orr = wr*dr + wi*di, oi = wr*di - wi*dr;
+      ar[k]  = er - oi;
+      ai[k]  = ei + orr;
+      ar[nk] = er + oi;
+      ai[nk] = orr - ei;
+    }
+
+    if(transform(ar, ai, br, bi, -1)){
+      ar = br;
+      ai = bi;
+    }
+
+    for(unsigned long int j=0; j<n; j++){
+      data[2*j]   = ar[j];
+      data[2*j+1] = ai[j];
     }
-    j += m;
   }
+}
+
+template class Subs::Fft_plan<float>;
+template class Subs::Fft_plan<double>;
+
+/** Transforms each row of a 2D array in place.
+ * \param data the array. Each row of nx values holds nx/2 complex points as
+ * alternate real and imaginary values; nx must be even.
+ * \param flag 1 for the forward transform, -1 for the inverse
+ */
+template <class X>
+void Subs::fft_rows(Buffer2D<X>& data, int flag){
+
+  if((flag != 1) && (flag != -1))
+    throw Buffer2D_Error("void Subs::fft_rows(Buffer2D<X>&, int): flag = " + Subs::str(flag) + " must be +/-1");
+  const int nx = data.get_nx(), ny = data.get_ny();
+  if(nx % 2)
+    throw Buffer2D_Error("void Subs::fft_rows(Buffer2D<X>&, int): nx = " + Subs::str(nx) + " must be even");
+  if(nx == 0 || ny == 0) return;
+
+  std::shared_ptr<const Fft_plan<X> > plan = Fft_plan<X>::get(nx/2);
+  run_batches(ny, double(nx)*ny, [&](int iy1, int iy2){
+      for(int iy=iy1; iy<iy2; iy++)
+	plan->fft(data[iy], flag);
+    });
+}
 
-  // Blame Daniel and Lanczos for this bit...
-  // Some kind of trigonometric recurrence (must be done
-  // in double precision) 
-
-  mmax = 2;
-  while(nump > mmax) {
-    istep = mmax << 1;
-    theta = flag * (Constants::TWOPI/(double)mmax); /* Inverse or forward? */
-    wtemp = sin(0.5 * theta);
-    wpr = -2.0 * sqr(wtemp);
-    wpi = sin(theta);
-    wr = 1.0;
-    wi = 0.0;
-    for(m=1; m<mmax; m+=2) {
-      for(i=m; i<=nump; i+=istep) {
-	j = i+mmax;
-	rtemp = wr*data[j-1] - wi*data[j];
-	itemp = wr*data[j] + wi*data[j-1];
-	data[j-1] = data[i-1] - rtemp;
-	data[j] = data[i] - itemp;
-	data[i-1] += rtemp;
-	data[i]   += itemp;
+/** Transforms each column of a 2D array of complex data in place.
+ * \param data the array. Columns 2j and 2j+1 hold the real and imaginary
+ * parts of complex column j; nx must be even.
+ * \param flag 1 for the forward transform, -1 for the inverse
+ */
+template <class X>
+void Subs::fft_cols(Buffer2D<X>& data, int flag){
+
+  if((flag != 1) && (flag != -1))
+    throw Buffer2D_Error("void Subs::fft_cols(Buffer2D<X>&, int): flag = " + Subs::str(flag) + " must be +/-1");
+  const int nx = data.get_nx(), ny = data.get_ny();
+  if(nx % 2)
+    throw Buffer2D_Error("void Subs::fft_cols(Buffer2D<X>&, int): nx = " + Subs::str(nx) + " must be even");
+  if(nx == 0 || ny < 2) return;
+
+  std::shared_ptr<const Fft_plan<X> > plan = Fft_plan<X>::get(ny);
+  const int ncol = nx/2, nblock = (ncol+COL_BLOCK-1)/COL_BLOCK;
+  run_batches(nblock, double(nx)*ny, [&](int ib1, int ib2){
+      std::vector<X> work(2*COL_BLOCK*size_t(ny));
+      X *re = &work[0], *im = re + COL_BLOCK*size_t(ny);
+      for(int ib=ib1; ib<ib2; ib++){
+	const int j1 = COL_BLOCK*ib, nc = std::min(COL_BLOCK, ncol-j1);
+	for(int iy=0; iy<ny; iy++){
+	  const X* row = data[iy] + 2*j1;
+	  for(int ic=0; ic<nc; ic++){
+	    re[size_t(ny)*ic+iy] = row[2*ic];
+	    im[size_t(ny)*ic+iy] = row[2*ic+1];
+	  }
+	}
+	for(int ic=0; ic<nc; ic++)
+	  plan->fft(re+size_t(ny)*ic, im+size_t(ny)*ic, flag);
+	for(int iy=0; iy<ny; iy++){
+	  X* row = data[iy] + 2*j1;
+	  for(int ic=0; ic<nc; ic++){
+	    row[2*ic]   = re[size_t(ny)*ic+iy];
+	    row[2*ic+1] = im[size_t(ny)*ic+iy];
+	  }
+	}
       }
-      wtemp = wr;
-      wr = wr*wpr - wi*wpi + wr;
-      wi = wi*wpr + wtemp*wpi + wi;
+    });
+}
+
+/** 2D FFT in place of complex data, stored as for fft_rows.
+ * \param data the array, with an even number of columns
+ * \param flag 1 for the forward transform, -1 for the inverse
+ */
+template <class X>
+void Subs::fft2d(Buffer2D<X>& data, int flag){
+  fft_rows(data, flag);
+  fft_cols(data, flag);
+}
+
+/** 2D FFT of real data. The forward transform of ny by nx real values
+ * (nx even) gives ny by nx+2 values, which hold the complex transform for
+ * x-frequencies 0 to nx/2 as real, imaginary pairs along each row and all ny
+ * y-frequencies down the columns. The rest of the transform follows from its
+ * Hermitian symmetry. The inverse takes this back to ny by nx real values
+ * multiplied by nx*ny.
+ * \param in   the data to transform
+ * \param out  the transform. This can be the same object as in.
+ * \param flag 1 for the forward transform, -1 for the inverse
+ */
+template <class X>
+void Subs::fftr2d(const Buffer2D<X>& in, Buffer2D<X>& out, int flag){
+
+  if((flag != 1) && (flag != -1))
+    throw Buffer2D_Error("void Subs::fftr2d(const Buffer2D<X>&, Buffer2D<X>&, int): flag = " + Subs::str(flag) + " must be +/-1");
+
+  const int ny = in.get_ny();
+
+  if(flag == 1){
+
+    const int nx = in.get_nx();
+    if(nx < 2 || nx % 2)
+      throw Buffer2D_Error("void Subs::fftr2d(const Buffer2D<X>&, Buffer2D<X>&, int): nx = " + Subs::str(nx) + " must be even and at least 2");
+
+    if(&in == &out){
+      Buffer2D<X> copy(in);
+      fftr2d(copy, out, flag);
+      return;
     }
-    mmax = istep;
+
+    out.resize(ny, nx+2);
+    std::shared_ptr<const Fft_plan<X> > plan = Fft_plan<X>::get(nx/2);
+    run_batches(ny, double(nx)*ny, [&](int iy1, int iy2){
+	for(int iy=iy1; iy<iy2; iy++){
+	  X* row = out[iy];
+	  std::copy(in[iy], in[iy]+nx, row);
+	  plan->fftr(row, 1);
+	  // unpack the Nyquist frequency
+	  row[nx]   = row[1];
+	  row[nx+1] = row[1] = X(0);
+	}
+      });
+    fft_cols(out, 1);
+
+  }else{
+
+    const int nx = in.get_nx() - 2;
+    if(nx < 2 || nx % 2)
+      throw Buffer2D_Error("void Subs::fftr2d(const Buffer2D<X>&, Buffer2D<X>&, int): nx = " + Subs::str(nx+2) + " must be even and at least 4");
+
+    Buffer2D<X> work(in);
+    fft_cols(work, -1);
+
+    out.resize(ny, nx);
+    std::shared_ptr<const Fft_plan<X> > plan = Fft_plan<X>::get(nx/2);
+    run_batches(ny, double(nx)*ny, [&](int iy1, int iy2){
+	for(int iy=iy1; iy<iy2; iy++){
+	  X* row = work[iy];
+	  row[1] = row[nx];
+	  plan->fftr(row, -1);
+	  X* orow = out[iy];
+	  for(int ix=0; ix<nx; ix++)
+	    orow[ix] = 2*row[ix];
+	}
+      });
   }
-} 
+}
 
-/** FFT routine for real data. Output data is in real, imag, real, imag form as per 
+template void Subs::fft_rows(Buffer2D<float>&, int);
+template void Subs::fft_rows(Buffer2D<double>&, int);
+template void Subs::fft_cols(Buffer2D<float>&, int);
+template void Subs::fft_cols(Buffer2D<double>&, int);
+template void Subs::fft2d(Buffer2D<float>&, int);
+template void Subs::fft2d(Buffer2D<double>&, int);
+template void Subs::fftr2d(const Buffer2D<float>&, Buffer2D<float>&, int);
+template void Subs::fftr2d(const Buffer2D<double>&, Buffer2D<double>&, int);
+
+/** Returns the smallest number of points >= n of the form 2^a 3^b 5^c 7^d.
+ * FFTs of such lengths are done directly by mixed-radix passes; others need
+ * Bluestein's algorithm which is several times slower. Use this to size
+ * zero-padded arrays.
+ * \param n the minimum number of points
+ */
+unsigned long int Subs::fft_size(unsigned long int n) {
+  if(n < 2) return n;
+  while(rough_part(n) != 1) n++;
+  return n;
+}
+
+/**  FFT routine.
+ *
+ * \param data the data array. This must have alternate real and imaginary components (see NR for more
+ *  details).
+ * \param nump the number of elements of data, i.e. twice the number of complex points.
+ *  Any number of points can be transformed, but see Subs::fft_size for those which are fastest
+ * \param flag flag  *  If flag = 1, data[nump] is replaced by it's discrete fourier transform.
+ *  If flag =-1, data[nump] is replaced by it's inverse FT.
+ */
+
+void Subs::fft(float* data, long unsigned int nump, int flag) {
+  if(nump % 2 == 1 && nump > 1) throw Subs_Error("Subs::fft: number of elements = " + Subs::str(nump) + " must be even");
+  Fft_plan<float>::get(nump/2)->fft(data, flag);
+}
+
+/** FFT routine for real data. Output data is in real, imag, real, imag form as per
  * normal except for data[1] which is f_(N/2) since both this and f_0 are real, not complex.
  *
  * \param data real array of data
- * \param nump the number of points, a power of 2
+ * \param nump the number of points, which must be even
+ * \param flag flag=1, data[nump] is replaced by it's discrete fourier transform.
+ * If flag=-1, data[nump] is replaced by it's inverse FT .(Multiply by 2/n to get
+ * back original data)
+ */
+
+void Subs::fftr(float* data, unsigned long int nump, int flag) {
+  if((flag != 1) && (flag != -1)) throw Subs_Error("Input flag to Subs::fftr must be +/-1!");
+  if(nump < 2 || nump % 2) throw Subs_Error("Subs::fftr: number of points = " + Subs::str(nump) + " must be even and at least 2");
+  Fft_plan<float>::get(nump/2)->fftr(data, flag);
+}
+
+/**  FFT routine.
+ *
+ * \param data the data array. This must have alternate real and imaginary components (see NR for more
+ *  details).
+ * \param nump the number of elements of data, i.e. twice the number of complex points.
+ *  Any number of points can be transformed, but see Subs::fft_size for those which are fastest
+ * \param flag flag  *  If flag = 1, data[nump] is replaced by it's discrete fourier transform.
+ *  If flag =-1, data[nump] is replaced by it's inverse FT.
+ */
+
+void Subs::fft(double* data, long unsigned int nump, int flag) {
+  if(nump % 2 == 1 && nump > 1) throw Subs_Error("Subs::fft: number of elements = " + Subs::str(nump) + " must be even");
+  Fft_plan<double>::get(nump/2)->fft(data, flag);
+}
+
+/** FFT routine for real data. Output data is in real, imag, real, imag form as per
+ * normal except for data[1] which is f_(N/2) since both this and f_0 are real, not complex.
+ *
+ * \param data real array of data
+ * \param nump the number of points, which must be even
  * \param flag flag=1, data[nump] is replaced by it's discrete fourier transform.
  * If flag=-1, data[nump] is replaced by it's inverse FT. (Multiply by 2/n to get
  * back original data)
  */
 
 void Subs::fftr(double* data, unsigned long int nump, int flag) {
-
-  unsigned long int i,i1,i2,i3,i4,np1;
-  double c1=0.5,c2,h1r,h1i,h2r,h2i;
-  double wr,wi,wpr,wpi,wtemp,theta;
- 
-  theta = Constants::PI/(double) (nump>>1);
-  if (flag == 1) {
-    c2 = -0.5;
-    fft(data,nump,1);
-  } else {
-    c2=0.5;
-    theta = -theta;
-  }
-  wtemp=sin(0.5*theta);
-  wpr = -2.0*wtemp*wtemp;
-  wpi = sin(theta);
-  wr  = 1.0+wpr;
-  wi  = wpi;
-  np1=nump+1;
-  for (i=1;i<(nump>>2);i++) {
-    i4=1+(i3=np1-(i2=1+(i1=i+i)));
-    h1r =  c1*(data[i1]+data[i3]);
-    h1i =  c1*(data[i2]-data[i4]);
-    h2r = -c2*(data[i2]+data[i4]);
-    h2i =  c2*(data[i1]-data[i3]);
-    data[i1] = h1r+wr*h2r-wi*h2i;
-    data[i2] = h1i+wr*h2i+wi*h2r;
-    data[i3] = h1r-wr*h2r+wi*h2i;
-    data[i4] = -h1i+wr*h2i+wi*h2r;
-    wr=(wtemp=wr)*wpr-wi*wpi+wr;
-    wi=wi*wpr+wtemp*wpi+wi;
-  }
-  if (flag == 1) {
-    data[0] = (h1r=data[0])+data[1];
-    data[1] = h1r-data[1];
-  } else {
-    data[0]=c1*((h1r=data[0])+data[1]);
-    data[1]=c1*(h1r-data[1]);
-    fft(data,nump,-1);
-  }
-} 
+  if((flag != 1) && (flag != -1)) throw Subs_Error("Input flag to Subs::fftr must be +/-1!");
+  if(nump < 2 || nump % 2) throw Subs_Error("Subs::fftr: number of points = " + Subs::str(nump) + " must be even and at least 2");
+  Fft_plan<double>::get(nump/2)->fftr(data, flag);
+}
 
 
 /** FFT of 2 real functions simultaneously. This is useful for convolutions.
+ * The two are packed as the real and imaginary parts of one complex array
+ * which is transformed and then separated using the symmetries of the
+ * transforms of real data.
  *
  * \param data1 first array of data, of length n
  * \param data2 second array of data, of length n
  * \param fft1  first FFT, of length 2*n
  * \param fft2  second FFT, of length 2*n
- * \param n     the number of points, a power of 2
+ * \param n     the number of points
  */
 
 void Subs::twofft(double data1[], double data2[], double fft1[], double fft2[], unsigned long int n) {
 
   // Pack two arrays into one complex array
-  for(unsigned long int j=0, jj=1; j<n; j++, jj+=2){
-    fft1[jj-1] = data1[j];
-    fft2[jj]   = data2[j];
+  for(unsigned long int j=0; j<n; j++){
+    fft1[2*j]   = data1[j];
+    fft1[2*j+1] = data2[j];
   }
 
-  fft(fft1, n, 1);
+  Fft_plan<double>::get(n)->fft(fft1, 1);
 
   fft2[0] = fft1[1];
-  fft1[1] = fft2[1] = 0.;
-
-  unsigned long int nn2 = n + n;
-  unsigned long int nn3 = 1 + nn2;
+  fft2[1] = fft1[1] = 0.;
 
-  for(unsigned long int j=2; j<=n; j+=2){
+  for(unsigned long int j=1; j<=n/2; j++){
 
-    double rep = 0.5*(fft1[j]+fft1[nn2-j]);
-    double rem = 0.5*(fft1[j]-fft1[nn2-j]);
-    double aip = 0.5*(fft1[j+1]+fft1[nn3-j]);
-    double aim = 0.5*(fft1[j+1]-fft1[nn3-j]);
+    const unsigned long int k = 2*j, kc = 2*(n-j);
+    double rep = 0.5*(fft1[k]+fft1[kc]);
+    double rem = 0.5*(fft1[k]-fft1[kc]);
+    double aip = 0.5*(fft1[k+1]+fft1[kc+1]);
+    double aim = 0.5*(fft1[k+1]-fft1[kc+1]);
 
-    fft1[j]     =  rep;
-    fft1[j+1]   =  aim;
-    fft1[nn2-j] =  rep;
-    fft1[nn3-j] = -aim;
+    fft1[k]    =  rep;
+    fft1[k+1]  =  aim;
+    fft1[kc]   =  rep;
+    fft1[kc+1] = -aim;
 
-    fft2[j]     =  aip;
-    fft2[j+1]   = -rem;
-    fft2[nn2-j] =  aip;
-    fft2[nn3-j] =  rem;
+    fft2[k]    =  aip;
+    fft2[k+1]  = -rem;
+    fft2[kc]   =  aip;
+    fft2[kc+1] =  rem;
 
   }
 }
-
-
@@ -0,0 +1,208 @@
+// Butterfly passes of fft.cc, written once in terms of a class S of vector
+// operations (see simd_ops.h) and compiled for each instruction set by
+// including this file in a separate namespace with SIMD_TARGET defined to the
+// matching target attribute. Do not include this anywhere else.
+//
+// Each pass is one step of a Stockham autosort FFT on split real and
+// imaginary arrays. A pass of radix r takes the transforms of length l = r*m
+// at stride s held in x and puts them in y as
+//
+//   y[q+s*(r*p+k)] = w^(p*k) sum_j x[q+s*(p+j*m)] exp(flag 2 pi i j*k/r)
+//
+// for p = 0 to m-1, q = 0 to s-1, where w = exp(flag 2 pi i/l). The twiddle
+// w^(p*k) is entry p*k*s of the tables cs, sn of cos and sin of 2 pi t/n, and
+// exp(2 pi i j*k/r) is entry (j*k mod r)*m*s. The vectors run along q, with
+// any remainder, and all of the first pass (s = 1), done one element at a time.
+
+// Complex multiplication of (ur,ui) by (wr,wi), with nwi = -wi
+template <class S> SIMD_TARGET inline
+void cmul(typename S::V& ur, typename S::V& ui, typename S::V wr, typename S::V wi, typename S::V nwi){
+  typename S::V t = S::madd(ur, wi, S::mul(ui, wr));
+  ur = S::madd(ur, wr, S::mul(ui, nwi));
+  ui = t;
+}
+
+template <class S> SIMD_TARGET inline
+void butterfly2(const typename S::T* xr, const typename S::T* xi, typename S::T* yr, typename S::T* yi,
+		long q, long m, long s, const typename S::V* w){
+  typedef typename S::V V;
+  V a0r = S::load(xr+q),     a0i = S::load(xi+q);
+  V a1r = S::load(xr+q+s*m), a1i = S::load(xi+q+s*m);
+  S::store(yr+q, S::add(a0r, a1r));
+  S::store(yi+q, S::add(a0i, a1i));
+  V br = S::sub(a0r, a1r), bi = S::sub(a0i, a1i);
+  cmul<S>(br, bi, w[0], w[1], w[2]);
+  S::store(yr+q+s, br);
+  S::store(yi+q+s, bi);
+}
+
+template <class S> SIMD_TARGET inline
+void butterfly4(const typename S::T* xr, const typename S::T* xi, typename S::T* yr, typename S::T* yi,
+		long q, long m, long s, const typename S::V* w, typename S::V vf, typename S::V vnf){
+  typedef typename S::V V;
+  V a0r = S::load(xr+q),       a0i = S::load(xi+q);
+  V a1r = S::load(xr+q+s*m),   a1i = S::load(xi+q+s*m);
+  V a2r = S::load(xr+q+2*s*m), a2i = S::load(xi+q+2*s*m);
+  V a3r = S::load(xr+q+3*s*m), a3i = S::load(xi+q+3*s*m);
+
+  V t0r = S::add(a0r, a2r), t0i = S::add(a0i, a2i);
+  V t1r = S::sub(a0r, a2r), t1i = S::sub(a0i, a2i);
+  V t2r = S::add(a1r, a3r), t2i = S::add(a1i, a3i);
+  // (a1-a3) times flag*i
+  V t3r = S::mul(vnf, S::sub(a1i, a3i)), t3i = S::mul(vf, S::sub(a1r, a3r));
+
+  S::store(yr+q, S::add(t0r, t2r));
+  S::store(yi+q, S::add(t0i, t2i));
+
+  V br = S::add(t1r, t3r), bi = S::add(t1i, t3i);
+  cmul<S>(br, bi, w[0], w[1], w[2]);
+  S::store(yr+q+s, br);
+  S::store(yi+q+s, bi);
+
+  br = S::sub(t0r, t2r);
+  bi = S::sub(t0i, t2i);
+  cmul<S>(br, bi, w[3], w[4], w[5]);
+  S::store(yr+q+2*s, br);
+  S::store(yi+q+2*s, bi);
+
+  br = S::sub(t1r, t3r);
+  bi = S::sub(t1i, t3i);
+  cmul<S>(br, bi, w[6], w[7], w[8]);
+  S::store(yr+q+3*s, br);
+  S::store(yi+q+3*s, bi);
+}
+
+template <class S> SIMD_TARGET
+void pass2(const typename S::T* xr, const typename S::T* xi, typename S::T* yr, typename S::T* yi,
+	   long m, long s, int flag, const typename S::T* cs, const typename S::T* sn){
+  typedef typename S::T T;
+  typedef Generic<T> G;
+  for(long p=0; p<m; p++){
+    const T wr = cs[p*s], wi = flag*sn[p*s];
+    const typename S::V w[3] = {S::set1(wr), S::set1(wi), S::set1(-wi)};
+    const T ws[3] = {wr, wi, -wi};
+    const T *x0r = xr+s*p, *x0i = xi+s*p;
+    T *y0r = yr+2*s*p, *y0i = yi+2*s*p;
+    long q = 0;
+    for(; q+S::W<=s; q+=S::W)
+      butterfly2<S>(x0r, x0i, y0r, y0i, q, m, s, w);
+    for(; q<s; q++)
+      butterfly2<G>(x0r, x0i, y0r, y0i, q, m, s, ws);
+  }
+}
+
+template <class S> SIMD_TARGET
+void pass4(const typename S::T* xr, const typename S::T* xi, typename S::T* yr, typename S::T* yi,
+	   long m, long s, int flag, const typename S::T* cs, const typename S::T* sn){
+  typedef typename S::T T;
+  typedef Generic<T> G;
+  const typename S::V vf = S::set1(T(flag)), vnf = S::set1(T(-flag));
+  for(long p=0; p<m; p++){
+    T ws[9];
+    for(int k=1; k<4; k++){
+      ws[3*k-3] = cs[p*k*s];
+      ws[3*k-2] = flag*sn[p*k*s];
+      ws[3*k-1] = -ws[3*k-2];
+    }
+    typename S::V w[9];
+    for(int i=0; i<9; i++) w[i] = S::set1(ws[i]);
+    const T *x0r = xr+s*p, *x0i = xi+s*p;
+    T *y0r = yr+4*s*p, *y0i = yi+4*s*p;
+    long q = 0;
+    for(; q+S::W<=s; q+=S::W)
+      butterfly4<S>(x0r, x0i, y0r, y0i, q, m, s, w, vf, vnf);
+    for(; q<s; q++)
+      butterfly4<G>(x0r, x0i, y0r, y0i, q, m, s, ws, T(flag), T(-flag));
+  }
+}
+
+// Odd radix R: the inputs j and R-j are combined as a sum and a difference,
+// which halves the multiplications. c holds cos(2 pi j*k/R) and d holds
+// flag*sin(2 pi j*k/R) for j, k = 1 to (R-1)/2; w the twiddles as for
+// butterfly4.
+template <class S, int R> SIMD_TARGET inline
+void butterfly_odd(const typename S::T* xr, const typename S::T* xi, typename S::T* yr, typename S::T* yi,
+		   long q, long m, long s, const typename S::V* c, const typename S::V* d, const typename S::V* w){
+  typedef typename S::V V;
+  const int H = (R-1)/2;
+  V a0r = S::load(xr+q), a0i = S::load(xi+q);
+  V sr[H], si[H], dr[H], di[H];
+  V y0r = a0r, y0i = a0i;
+  for(int j=0; j<H; j++){
+    V ar = S::load(xr+q+s*m*(j+1)),   ai = S::load(xi+q+s*m*(j+1));
+    V br = S::load(xr+q+s*m*(R-1-j)), bi = S::load(xi+q+s*m*(R-1-j));
+    sr[j] = S::add(ar, br);
+    si[j] = S::add(ai, bi);
+    dr[j] = S::sub(ar, br);
+    di[j] = S::sub(ai, bi);
+    y0r = S::add(y0r, sr[j]);
+    y0i = S::add(y0i, si[j]);
+  }
+  S::store(yr+q, y0r);
+  S::store(yi+q, y0i);
+
+  for(int k=0; k<H; k++){
+    V rr = a0r, ri = a0i, tr = S::zero(), ti = S::zero();
+    for(int j=0; j<H; j++){
+      rr = S::madd(c[H*j+k], sr[j], rr);
+      ri = S::madd(c[H*j+k], si[j], ri);
+      tr = S::madd(d[H*j+k], dr[j], tr);
+      ti = S::madd(d[H*j+k], di[j], ti);
+    }
+    // outputs k+1 and R-k-1 are r + i t and r - i t
+    V br = S::sub(rr, ti), bi = S::add(ri, tr);
+    cmul<S>(br, bi, w[3*k], w[3*k+1], w[3*k+2]);
+    S::store(yr+q+s*(k+1), br);
+    S::store(yi+q+s*(k+1), bi);
+    br = S::add(rr, ti);
+    bi = S::sub(ri, tr);
+    cmul<S>(br, bi, w[3*(R-2-k)], w[3*(R-2-k)+1], w[3*(R-2-k)+2]);
+    S::store(yr+q+s*(R-1-k), br);
+    S::store(yi+q+s*(R-1-k), bi);
+  }
+}
+
+template <class S, int R> SIMD_TARGET
+void pass_odd(const typename S::T* xr, const typename S::T* xi, typename S::T* yr, typename S::T* yi,
+	      long m, long s, int flag, const typename S::T* cs, const typename S::T* sn){
+  typedef typename S::T T;
+  typedef Generic<T> G;
+  const int H = (R-1)/2;
+  T cc[H*H], dd[H*H];
+  typename S::V vc[H*H], vd[H*H];
+  for(int j=0; j<H; j++){
+    for(int k=0; k<H; k++){
+      long t = ((j+1)*(k+1) % R)*m*s;
+      cc[H*j+k] = cs[t];
+      dd[H*j+k] = flag*sn[t];
+      vc[H*j+k] = S::set1(cc[H*j+k]);
+      vd[H*j+k] = S::set1(dd[H*j+k]);
+    }
+  }
+  for(long p=0; p<m; p++){
+    T ws[3*(R-1)];
+    for(int k=1; k<R; k++){
+      ws[3*k-3] = cs[p*k*s];
+      ws[3*k-2] = flag*sn[p*k*s];
+      ws[3*k-1] = -ws[3*k-2];
+    }
+    typename S::V w[3*(R-1)];
+    for(int i=0; i<3*(R-1); i++) w[i] = S::set1(ws[i]);
+    const T *x0r = xr+s*p, *x0i = xi+s*p;
+    T *y0r = yr+R*s*p, *y0i = yi+R*s*p;
+    long q = 0;
+    for(; q+S::W<=s; q+=S::W)
+      butterfly_odd<S,R>(x0r, x0i, y0r, y0i, q, m, s, vc, vd, w);
+    for(; q<s; q++)
+      butterfly_odd<G,R>(x0r, x0i, y0r, y0i, q, m, s, cc, dd, ws);
+  }
+}
+
+template <class S>
+void fill(Fft_kernels<typename S::T>& kernels){
+  kernels.pass[2] = pass2<S>;
+  kernels.pass[3] = pass_odd<S,3>;
+  kernels.pass[4] = pass4<S>;
+  kernels.pass[5] = pass_odd<S,5>;
+  kernels.pass[7] = pass_odd<S,7>;
+}
@@ -1,10 +1,285 @@
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
 #include "trm/subs.h"
 #include "trm/buffer2d.h"
+#include "trm/simd.h"
+#include "trm/thread_pool.h"
+
+namespace {
+
+  // Number of points accumulated into the normal equations at a time
+  const int NBLOCK = 128;
+
+  // Accumulates the lower triangle of the normal matrix alpha (nfunc by
+  // nfunc) and the vector beta. The points are taken NBLOCK at a time, with
+  // fill(i, v) setting the nfunc function values of point i in v. Each block
+  // is scaled by sqrt(weight) into a panel of one row per point, with y as an
+  // extra last column, and added as a rank-NBLOCK update by Simd::syrk, whose
+  // last row then gives beta.
+
+  // Space needed to form and solve the normal equations, kept by the batch
+  // version of llsqr from one data vector to the next
+  struct Workspace {
+    Workspace(int nfunc) : panel((nfunc+1)*NBLOCK), sums((nfunc+1)*(nfunc+1)), alpha(nfunc, nfunc), beta(nfunc), diag(nfunc) {}
+    Subs::Buffer1D<double> panel, sums;
+    Subs::Buffer2D<double> alpha;
+    Subs::Buffer1D<double> beta, diag;
+  };
+
+  template <class Fill>
+  void accumulate(int ndata, const double* y, const float* e, int nfunc, const Fill& fill, Workspace& work,
+		  double** alpha, double* beta){
+
+    const int ld = nfunc + 1;
+    double* p = work.panel.ptr();
+    double* c = work.sums.ptr();
+    for(int j=0; j<ld*ld; j++) c[j] = 0.;
+
+    int i = 0;
+    while(i < ndata){
+
+      // gather the next block of valid points
+      int nb = 0;
+      for(; i<ndata && nb<NBLOCK; i++){
+	if(e[i] > 0.){
+	  const double rw = 1./e[i];
+	  double* pr = p + nb*ld;
+	  fill(i, pr);
+	  for(int j=0; j<nfunc; j++) pr[j] *= rw;
+	  pr[nfunc] = rw*y[i];
+	  nb++;
+	}
+      }
+      if(nb == 0) break;
+
+      Subs::Simd::syrk(p, nb, ld, ld, c, ld);
+    }
+
+    for(int j=0; j<nfunc; j++){
+      const double* cj = c + j*ld;
+      for(int k=0; k<=j; k++)
+	alpha[j][k] = cj[k];
+      beta[j] = c[nfunc*ld+j];
+    }
+  }
+
+  // Factorises the normal matrix work.alpha by Cholesky, returning true. If
+  // it is not numerically positive definite, as when the functions are
+  // degenerate, it is instead inverted in place by gaussj, as llsqr did
+  // before, which copes unless rounding leaves a pivot of exactly zero. The
+  // normal equations are then solved at the same time, with work.beta
+  // returned as the solution, and false is returned.
+  bool factorise(int nfunc, Workspace& work){
+
+    // cholesky leaves the upper triangle alone, so that and the diagonal
+    // keep a copy of the matrix
+    double** alpha = work.alpha;
+    for(int j=0; j<nfunc; j++){
+      work.diag[j] = alpha[j][j];
+      for(int k=0; k<j; k++)
+	alpha[k][j] = alpha[j][k];
+    }
+    try{
+      Subs::cholesky(alpha, nfunc);
+      return true;
+    }
+    catch(const Subs::Subs_Error&){
+      Subs::Buffer2D<double> b(nfunc, 1);
+      for(int j=0; j<nfunc; j++){
+	alpha[j][j] = work.diag[j];
+	for(int k=0; k<j; k++)
+	  alpha[j][k] = alpha[k][j];
+	b[j][0] = work.beta[j];
+      }
+      Subs::gaussj(alpha, nfunc, b, 1);
+      for(int j=0; j<nfunc; j++)
+	work.beta[j] = b[j][0];
+      return false;
+    }
+  }
+
+  // Solves the normal equations in work, overwriting them. The covariances
+  // are computed only if covar is not NULL.
+  void solve(int nfunc, Workspace& work, double* coeff, double** covar){
+    const bool chol = factorise(nfunc, work);
+    for(int j=0; j<nfunc; j++)
+      coeff[j] = work.beta[j];
+    if(chol){
+      Subs::cholesky_solve(work.alpha, nfunc, coeff);
+      if(covar != NULL)
+	Subs::cholesky_invert(work.alpha, nfunc, covar);
+    }else if(covar != NULL){
+      for(int j=0; j<nfunc; j++)
+	for(int k=0; k<nfunc; k++)
+	  covar[j][k] = work.alpha[j][k];
+    }
+  }
+
+  // Fill for accumulate from precomputed functions, one row per point
+  class Row {
+  public:
+    Row(double** func, int nfunc) : func(func), nfunc(nfunc) {}
+    void operator()(int i, double* v) const {
+      const double* f = func[i];
+      for(int j=0; j<nfunc; j++) v[j] = f[j];
+    }
+  private:
+    double** func;
+    int nfunc;
+  };
+
+  // Number of data vectors whose right-hand sides are formed together when
+  // the weights are shared, so that each row of the functions is read once
+  // per group rather than once per vector
+  const int NGROUP = 8;
+
+  // Calls func(i1, i2) on ranges covering 0 to nvec-1, spread across threads
+  // if enabled
+  void for_vectors(int nvec, const std::function<void(int, int)>& func){
+    const int nthreads = Subs::get_nthreads();
+    if(nthreads > 1 && nvec > 1){
+      const int nchunk = std::min(nvec, 4*nthreads);
+      const int nper   = (nvec+nchunk-1)/nchunk;
+      Subs::parallel_run(nchunk, [&](int ichunk){
+	  const int i1 = ichunk*nper, i2 = std::min(nvec, i1+nper);
+	  if(i1 < i2) func(i1, i2);
+	});
+    }else{
+      func(0, nvec);
+    }
+  }
+
+  // Fits, then rejects points and refits until none are rejected or ncycle
+  // cycles have passed, with fill(i, v) giving the function values of point
+  // i as for accumulate. Points rejected are removed from the factorised
+  // normal equations by rank-one downdates; they are only formed again from
+  // scratch if a downdate fails or if more points go in one cycle than are
+  // left. If the normal matrix is not positive definite, factorise falls
+  // back to gaussj as llsqr does, and since there is then no factor to
+  // downdate the equations are formed and solved again each cycle. Returns
+  // the number rejected.
+  template <class Fill>
+  int clip(int ndata, const double* y, float* e, int nfunc, const Fill& fill, double thresh, bool slow, int ncycle,
+	   double* coeff, double** covar, const std::string& method){
+
+    Workspace work(nfunc);
+    double** l = work.alpha;
+    double* beta = work.beta.ptr();
+    accumulate(ndata, y, e, nfunc, fill, work, l, beta);
+    bool chol = factorise(nfunc, work);
+    for(int j=0; j<nfunc; j++) coeff[j] = beta[j];
+    if(chol) Subs::cholesky_solve(l, nfunc, coeff);
+
+    Subs::Buffer1D<double> v(nfunc), dev(ndata);
+    std::vector<int> reject;
+    int nrej = 0;
+    for(int icycle=0; icycle<ncycle; icycle++){
+
+      // deviations and reduced chi**2 of the current fit
+      double chisq = 0.;
+      int ndof = -nfunc;
+      for(int i=0; i<ndata; i++){
+	if(e[i] > 0.){
+	  fill(i, v.ptr());
+	  double ymodel = 0.;
+	  for(int j=0; j<nfunc; j++)
+	    ymodel += coeff[j]*v[j];
+	  dev[i] = fabs(y[i]-ymodel)/e[i];
+	  chisq += Subs::sqr(dev[i]);
+	  ndof++;
+	}
+      }
+      if(ndof < 1)
+	throw Subs::Subs_Error(method + " : < 1 degree of freedom");
+
+      const double limit = sqrt(chisq/ndof)*thresh;
+      reject.clear();
+      if(slow){
+	int iworst = -1;
+	double worst = limit;
+	for(int i=0; i<ndata; i++){
+	  if(e[i] > 0. && dev[i] > worst){
+	    worst  = dev[i];
+	    iworst = i;
+	  }
+	}
+	if(iworst >= 0) reject.push_back(iworst);
+      }else{
+	for(int i=0; i<ndata; i++)
+	  if(e[i] > 0. && dev[i] > limit) reject.push_back(i);
+      }
+      if(reject.empty()) break;
+
+      bool rebuild = !chol || 2*int(reject.size()) > ndof + nfunc;
+      for(size_t n=0; n<reject.size(); n++){
+	const int i = reject[n];
+	if(!rebuild){
+	  fill(i, v.ptr());
+	  const double rw = 1./e[i], wy = rw*rw*y[i];
+	  for(int j=0; j<nfunc; j++){
+	    beta[j] -= wy*v[j];
+	    v[j] *= rw;
+	  }
+	  rebuild = !Subs::cholesky_downdate(l, nfunc, v.ptr());
+	}
+	e[i] = -e[i];
+      }
+      nrej += reject.size();
+
+      if(rebuild){
+	accumulate(ndata, y, e, nfunc, fill, work, l, beta);
+	chol = factorise(nfunc, work);
+      }
+      for(int j=0; j<nfunc; j++) coeff[j] = beta[j];
+      if(chol) Subs::cholesky_solve(l, nfunc, coeff);
+    }
+
+    if(covar != NULL){
+      if(chol){
+	Subs::cholesky_invert(l, nfunc, covar);
+      }else{
+	for(int j=0; j<nfunc; j++)
+	  for(int k=0; k<nfunc; k++)
+	    covar[j][k] = l[j][k];
+      }
+    }
+    return nrej;
+  }
+
+}
+
+/** llsqr_normal forms the normal equations of a general linear least squares
+ * fit, alpha coeff = beta. The matrix is accumulated a block of points at a
+ * time as a cache-blocked rank-k update.
+ * \param ndata the number of data points
+ * \param y    the data
+ * \param e    uncertainties on the data, <= 0 to mask a point
+ * \param nfunc the number of functions
+ * \param func  the functions as the columns of a matrix, i.e. func[2][4] is the value of the 3rd pixel of the 5th function.
+ * Dimensions: ny=ndata, nx=nfunc
+ * \param alpha the normal matrix (nfunc by nfunc). Only the lower triangle, alpha[j][k] with k <= j, is set, as needed by cholesky.
+ * \param beta  the right-hand side (nfunc values)
+ */
+
+void Subs::llsqr_normal(int ndata, const double* y, const float* e, int nfunc, double** func, double** alpha, double* beta){
+
+  if(ndata < 1)
+    throw Subs_Error("Subs::llsqr_normal(int, const double*, const float*, int, double**, double**, double*) : < 1 data point");
+  if(nfunc < 1)
+    throw Subs_Error("Subs::llsqr_normal(int, const double*, const float*, int, double**, double**, double*) : < 1 function");
+
+  Workspace work(nfunc);
+  accumulate(ndata, y, e, nfunc, Row(func, nfunc), work, alpha, beta);
+}
 
 /** llsqr carries out a general linear least squares
  * fit. It uses the normal equations approach and thus is senstive to degeneracy
  * but fast. This version used precompted values of the functions so is memory hungry
- * but fast.
+ * but fast. The normal equations are formed by llsqr_normal and solved by
+ * Cholesky factorisation, or by Gauss-Jordan elimination if rounding makes
+ * them fail to be positive definite, as happens with degenerate functions.
  * \param ndata the number of data points
  * \param y    the data 
  * \param e    uncertainties on the data, <= 0 to mask a point
@@ -13,7 +288,8 @@
  * Dimensions: ny=ndata, nx=nfunc
  * \param coeff the fitted coefficients, i.e. the nfunc multipliers of the functions that lead to the
  * best (in a least squares sense) fit to the data (returned)
- * \param covar the covariance matrix (nfunc by nfunc), returned
+ * \param covar the covariance matrix (nfunc by nfunc), returned. NULL if not wanted, which saves
+ * the time needed to invert the normal matrix.
  */
 
 void Subs::llsqr(int ndata, const double* y, const float* e, int nfunc, double** func, double* coeff, double** covar){
@@ -23,40 +299,95 @@ void Subs::llsqr(int ndata, const double* y, const float* e, int nfunc, double**
   if(nfunc < 1)
     throw Subs_Error("Subs::llsqr(int, const double*, const float*, int, const double**, double*) : < 1 function");
 
-  Buffer2D<double> beta(nfunc, 1);
+  Workspace work(nfunc);
+  accumulate(ndata, y, e, nfunc, Row(func, nfunc), work, work.alpha, work.beta.ptr());
+  solve(nfunc, work, coeff, covar);
+}
 
-  // Intialise
-  for(int j=0; j<nfunc; j++){
-    beta[j][0] = 0.;
-    for(int k=0; k<nfunc; k++)
-      covar[j][k] = 0.;
-  }
+/** This version of llsqr fits many data vectors with the same functions, as
+ * when every column of a spectrum is fitted with one basis. If the
+ * uncertainties are shared by all vectors, e has a single row, and then the
+ * normal matrix is formed and factorised just once, leaving only the
+ * right-hand sides, O(ndata nfunc) each, and the back-substitutions to do
+ * per vector, so long as the matrix is positive definite. Otherwise, or if
+ * the functions are degenerate, each vector has its own normal equations, which are
+ * formed and solved on as many threads as set by set_nthreads, each thread
+ * reusing one workspace for all the vectors it is given.
+ * \param y     the data, one row of ndata values per vector
+ * \param e     uncertainties on the data, <= 0 to mask a point; either one row per
+ * vector or a single row shared by all of them
+ * \param nfunc the number of functions
+ * \param func  the functions as the columns of a matrix, i.e. func[2][4] is the value of the 3rd pixel of the 5th function.
+ * Dimensions: ny=ndata, nx=nfunc
+ * \param coeff the fitted coefficients, one row of nfunc values per vector (returned, resized if need be)
+ */
 
-  // Accumulate matrices
-  for(int i=0; i<ndata; i++){
-    if(e[i] > 0.){
-      double weight = 1./Subs::sqr(e[i]);
-      for(int j=0; j<nfunc; j++){
-	double wt = weight*func[i][j];
-	for(int k=0; k<=j; k++)
-	  covar[j][k] += wt*func[i][k];
-	beta[j][0] += wt*y[i];
-      } 
-    }
+void Subs::llsqr(const Buffer2D<double>& y, const Buffer2D<float>& e, int nfunc, double** func, Buffer2D<double>& coeff){
+
+  const int nvec = y.get_ny(), ndata = y.get_nx();
+  if(nvec < 1 || ndata < 1)
+    throw Subs_Error("Subs::llsqr(const Buffer2D<double>&, const Buffer2D<float>&, int, double**, Buffer2D<double>&) : no data");
+  if(nfunc < 1)
+    throw Subs_Error("Subs::llsqr(const Buffer2D<double>&, const Buffer2D<float>&, int, double**, Buffer2D<double>&) : < 1 function");
+  if(e.get_nx() != ndata || (e.get_ny() != 1 && e.get_ny() != nvec))
+    throw Subs_Error("Subs::llsqr(const Buffer2D<double>&, const Buffer2D<float>&, int, double**, Buffer2D<double>&) : "
+		     "uncertainties must have ndata values in 1 or nvec rows");
+
+  if(coeff.get_ny() != nvec || coeff.get_nx() != nfunc) coeff.resize(nvec, nfunc);
+
+  // one factorisation for all if the weights are shared, unless the
+  // normal matrix fails to be positive definite
+  bool shared = e.get_ny() == 1;
+  Workspace common(nfunc);
+  if(shared){
+    accumulate(ndata, y[0], e[0], nfunc, Row(func, nfunc), common, common.alpha, common.beta.ptr());
+    shared = factorise(nfunc, common);
   }
 
-  // fill rest of matric by symmetry
-  for(int j=1; j<nfunc; j++)
-    for(int k=0; k<j; k++)
-      covar[k][j] = covar[j][k];
+  if(shared){
+
+    const float* ev = e[0];
+    double** l = common.alpha;
 
-  // Solve normal equations
-  gaussj(covar, nfunc, beta, 1);
+    Buffer1D<double> w(ndata);
+    for(int i=0; i<ndata; i++)
+      w[i] = ev[i] > 0. ? 1./sqr(double(ev[i])) : 0.;
+
+    for_vectors(nvec, [&](int v1, int v2){
+	double wy[NGROUP];
+	for(int v0=v1; v0<v2; v0+=NGROUP){
+	  const int ng = std::min(NGROUP, v2-v0);
+	  for(int g=0; g<ng; g++){
+	    double* b = coeff[v0+g];
+	    for(int j=0; j<nfunc; j++) b[j] = 0.;
+	  }
+	  for(int i=0; i<ndata; i++){
+	    if(w[i] > 0.){
+	      const double* f = func[i];
+	      for(int g=0; g<ng; g++) wy[g] = w[i]*y[v0+g][i];
+	      for(int g=0; g<ng; g++){
+		double* b = coeff[v0+g];
+		const double a = wy[g];
+		for(int j=0; j<nfunc; j++) b[j] += a*f[j];
+	      }
+	    }
+	  }
+	  for(int g=0; g<ng; g++)
+	    cholesky_solve(l, nfunc, coeff[v0+g]);
+	}
+      });
 
-  // return for coefficients
-  for(int i=0; i<nfunc; i++)
-    coeff[i] = beta[i][0];
+  }else{
 
+    const bool one = e.get_ny() == 1;
+    for_vectors(nvec, [&](int v1, int v2){
+	Workspace work(nfunc);
+	for(int v=v1; v<v2; v++){
+	  accumulate(ndata, y[v], e[one ? 0 : v], nfunc, Row(func, nfunc), work, work.alpha, work.beta.ptr());
+	  solve(nfunc, work, coeff[v], NULL);
+	}
+      });
+  }
 }
 
 /** llsqr_eval calculates the fit to the data after a run of llsqr
@@ -210,6 +541,46 @@ int Subs::llsqr_reject(int ndata, const double* y, float* e, int nfunc, double**
 }
 
 
+/** llsqr_clip carries out a general linear least squares fit followed by
+ * cycles of rejection as by llsqr_reject and refitting, until no more points
+ * are rejected. Rather than forming and solving the normal equations again
+ * each cycle, which would cost O(ndata nfunc^2) per cycle, each point
+ * rejected is removed from the Cholesky factor of the normal matrix by a
+ * rank-one downdate costing O(nfunc^2), so the cost per cycle is dominated by
+ * the O(ndata nfunc) evaluation of the fit. If the functions are degenerate
+ * the normal equations are solved by gaussj as in llsqr, and are then formed
+ * and solved again each cycle. Data points
+ * are masked by making error bars negative.
+ *
+ * \param ndata the number of data points
+ * \param y    the data 
+ * \param e    uncertainties on the data, <= 0 to mask a point; rejected points are made negative
+ * \param nfunc the number of functions
+ * \param func  the functions as the columns of a matrix, i.e. func[2][4] is the value of the 3rd pixel of the 5th function. 
+ * Dimensions: ny=ndata, nx=nfunc
+ * \param thresh the threshold in terms of sigma for rejection.
+ * \param slow true to just reject the worst point each cycle, else all points above threshold will go
+ * \param ncycle the maximum number of rejection cycles
+ * \param coeff the fitted coefficients, i.e. the nfunc multipliers of the functions that lead to the
+ * best (in a least squares sense) fit to the points retained (returned)
+ * \param covar the covariance matrix (nfunc by nfunc), returned. NULL if not wanted.
+ * \return number of points rejected.
+ */
+
+int Subs::llsqr_clip(int ndata, const double* y, float* e, int nfunc, double** func, double thresh, bool slow, int ncycle,
+		     double* coeff, double** covar){
+
+  const std::string method = "Subs::llsqr_clip(int, const double*, float*, int, double**, double, bool, int, double*, double**)";
+  if(ndata < 1)
+    throw Subs_Error(method + " : < 1 data point");
+  if(nfunc < 1)
+    throw Subs_Error(method + " : < 1 function");
+  if(thresh <= 0.)
+    throw Subs_Error(method + " : thresh <= 0.");
+
+  return clip(ndata, y, e, nfunc, Row(func, nfunc), thresh, slow, ncycle, coeff, covar, method);
+}
+
 //! General linear least square fitter
 
 /** llsqr carries out a general linear least squares fit. It uses the normal equations 
@@ -224,7 +595,7 @@ int Subs::llsqr_reject(int ndata, const double* y, float* e, int nfunc, double**
  * 'int get_nfunc()' const which returns the number of functions.
  * \param coeff the fitted coefficients, i.e. the nfunc multipliers of the functions that lead to the
  * best (in a least squares sense) fit to the data (returned)
- * \param covar the covariance matrix (nfunc by nfunc), returned
+ * \param covar the covariance matrix (nfunc by nfunc), returned. NULL if not wanted.
  */
 
 void Subs::llsqr(int ndata, const double* x, const double* y, const float* e, const Llfunc& func, double* coeff, double** covar){
@@ -234,43 +605,10 @@ void Subs::llsqr(int ndata, const double* x, const double* y, const float* e, co
   if(func.get_nfunc() < 1)
     throw Subs_Error("Subs::llsqr(int, const double*, const double*, const float*, const Llfunc&, double*, double**) : < 1 function");
   
-  Buffer2D<double> beta(func.get_nfunc(), 1);
-  
-  // Intialise
-  for(int j=0; j<func.get_nfunc(); j++){
-    beta[j][0] = 0.;
-    for(int k=0; k<func.get_nfunc(); k++)
-      covar[j][k] = 0.;
-  }
-  
-  // Accumulate matrices
-  double* v = new double[func.get_nfunc()];
-  for(int i=0; i<ndata; i++){
-    if(e[i] > 0.){
-      double weight = 1./Subs::sqr(e[i]);
-      func.eval(x[i],v);
-      for(int j=0; j<func.get_nfunc(); j++){
-	double wt = weight*v[j];
-	for(int k=0; k<=j; k++)
-	  covar[j][k] += wt*v[k];
-	beta[j][0] += wt*y[i];
-      } 
-    }
-  }
-  delete[] v;
-  
-  // fill rest of matrix by symmetry
-  for(int j=1; j<func.get_nfunc(); j++)
-    for(int k=0; k<j; k++)
-      covar[k][j] = covar[j][k];
-  
-  // Solve normal equations
-  gaussj(covar, func.get_nfunc(), beta, 1);
-  
-  // return for coefficients
-  for(int i=0; i<func.get_nfunc(); i++)
-    coeff[i] = beta[i][0];
-  
+  const int nfunc = func.get_nfunc();
+  Workspace work(nfunc);
+  accumulate(ndata, y, e, nfunc, [&](int i, double* v){func.eval(x[i], v);}, work, work.alpha, work.beta.ptr());
+  solve(nfunc, work, coeff, covar);
 }
 
 /** llsqr_eval calculates the fit to the data after a run of the function object version of llsqr
@@ -433,4 +771,43 @@ int Subs::llsqr_reject(int ndata, const double* x, const double* y, float* e, co
     return nrej;
 }
 
-  
+/** llsqr_clip carries out a general linear least squares fit followed by
+ * cycles of rejection as by llsqr_reject and refitting, until no more points
+ * are rejected. Rather than forming and solving the normal equations again
+ * each cycle, which would cost O(ndata nfunc^2) per cycle, each point
+ * rejected is removed from the Cholesky factor of the normal matrix by a
+ * rank-one downdate costing O(nfunc^2), so the cost per cycle is dominated by
+ * the O(ndata nfunc) evaluation of the fit. If the functions are degenerate
+ * the normal equations are solved by gaussj as in llsqr, and are then formed
+ * and solved again each cycle. Data points
+ * are masked by making error bars negative.
+ *
+ * \param ndata the number of data points
+ * \param x    the X values
+ * \param y    the Y values
+ * \param e    uncertainties on the Y values, <= 0 to mask; rejected points are made negative
+ * \param func the functions in the form of a function object that has member functions of the form
+ * 'void eval(double x, double* v)' to evaluate the nfunc function values at x, returning them in v,  and 
+ * 'int get_nfunc()' const which returns the number of functions.
+ * \param thresh the threshold in terms of sigma for rejection.
+ * \param slow true to just reject the worst point each cycle, else all points above threshold will go
+ * \param ncycle the maximum number of rejection cycles
+ * \param coeff the fitted coefficients, i.e. the nfunc multipliers of the functions that lead to the
+ * best (in a least squares sense) fit to the points retained (returned)
+ * \param covar the covariance matrix (nfunc by nfunc), returned. NULL if not wanted.
+ * \return number of points rejected.
+ */
+
+int Subs::llsqr_clip(int ndata, const double* x, const double* y, float* e, const Llfunc& func, double thresh, bool slow, int ncycle,
+		     double* coeff, double** covar){
+
+  const std::string method = "Subs::llsqr_clip(int, const double*, const double*, float*, const Llfunc&, double, bool, int, double*, double**)";
+  if(ndata < 1)
+    throw Subs_Error(method + " : < 1 data point");
+  if(func.get_nfunc() < 1)
+    throw Subs_Error(method + " : < 1 function");
+  if(thresh <= 0.)
+    throw Subs_Error(method + " : thresh <= 0.");
+
+  return clip(ndata, y, e, func.get_nfunc(), [&](int i, double* v){func.eval(x[i], v);}, thresh, slow, ncycle, coeff, covar, method);
+}
@@ -0,0 +1,323 @@
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "trm/subs.h"
+#include "trm/thread_pool.h"
+#include "trm/period_search.h"
+
+namespace {
+
+  // Most values of bins kept by each thread between trials; larger buffers
+  // are released once a range of trials is done
+  const size_t WORK_KEEP = 1 << 20;
+
+  // Per-thread bins of at least n values, released when the guard goes out
+  // of scope if they have grown beyond WORK_KEEP values
+  class Work_guard {
+  public:
+    explicit Work_guard(size_t n) : work(buffer()) {
+      if(work.size() < n) work.resize(n);
+    }
+    ~Work_guard(){
+      if(work.capacity() > WORK_KEEP) std::vector<double>().swap(work);
+    }
+    double* ptr(){return &work[0];}
+  private:
+    static std::vector<double>& buffer(){
+      static thread_local std::vector<double> work;
+      return work;
+    }
+    std::vector<double>& work;
+  };
+
+  // Calls func(i1, i2) on ranges covering 0 to ntrial-1, spread across
+  // threads if enabled. Each trial costs O(N), so even a few are worth
+  // splitting.
+  void for_trials(int ntrial, const std::function<void(int, int)>& func){
+    const int nthreads = Subs::get_nthreads();
+    if(nthreads > 1 && ntrial > 1){
+      const int nchunk = std::min(ntrial, 4*nthreads);
+      const int nper   = (ntrial+nchunk-1)/nchunk;
+      Subs::parallel_run(nchunk, [&](int ichunk){
+	  const int i1 = ichunk*nper, i2 = std::min(ntrial, i1+nper);
+	  if(i1 < i2) func(i1, i2);
+	});
+    }else{
+      func(0, ntrial);
+    }
+  }
+
+  // The points used, as times since the first of them, dx, weights w and
+  // deviations d from the weighted mean. Returns the time of the first.
+  double prepare(const double* x, const float* y, const float* e, int n, const std::string& method,
+		 std::vector<double>& dx, std::vector<double>& w, std::vector<double>& d){
+    dx.clear();
+    w.clear();
+    d.clear();
+    double xref = DBL_MAX, wsum = 0., wy = 0.;
+    for(int i=0; i<n; i++){
+      if(e[i] > 0.){
+	if(x[i] < xref) xref = x[i];
+	w.push_back(1./(e[i]*e[i]));
+	wsum += w.back();
+	wy   += w.back()*y[i];
+      }
+    }
+    if(w.size() < 2)
+      throw Subs::Subs_Error(method + ": fewer than 2 points with uncertainties > 0");
+
+    const double ymean = wy/wsum;
+    for(int i=0; i<n; i++){
+      if(e[i] > 0.){
+	dx.push_back(x[i]-xref);
+	d.push_back(y[i]-ymean);
+      }
+    }
+    return xref;
+  }
+
+  // Phase bin of a point
+  inline int phase_bin(double dx, double f, int nbin){
+    double ph = dx*f;
+    ph -= std::floor(ph);
+    return std::min(int(nbin*ph), nbin-1);
+  }
+
+  // Cumulative sums c[0] = 0, c[i+1] = c[i] + b[i % nb] for i = 0 to 2 nb - 1,
+  // so that any run of bins, including those that wrap past phase 1, is a
+  // difference of two values.
+  void cumulate(const double* b, int nb, double* c){
+    c[0] = 0.;
+    for(int i=0; i<2*nb; i++)
+      c[i+1] = c[i] + b[i < nb ? i : i-nb];
+  }
+
+}
+
+/** Sets up the search
+ * \param fmin  lowest frequency, cycles/unit x
+ * \param fmax  highest frequency, cycles/unit x
+ * \param nfreq number of frequencies
+ * \param nbin  number of phase bins, which sets the resolution in phase
+ * \param qmin  narrowest box, fraction of a cycle
+ * \param qmax  widest box, fraction of a cycle
+ */
+Subs::Bls::Bls(double fmin, double fmax, int nfreq, int nbin, double qmin, double qmax) :
+  fmin(fmin), fmax(fmax), nfreq(nfreq), nbin(nbin) {
+  if(fmin <= 0. || fmax < fmin)
+    throw Subs_Error("Subs::Bls::Bls(double, double, int, int, double, double): need 0 < fmin <= fmax, but fmin = " +
+		     Subs::str(fmin) + ", fmax = " + Subs::str(fmax));
+  if(nfreq < 1)
+    throw Subs_Error("Subs::Bls::Bls(double, double, int, int, double, double): nfreq = " + Subs::str(nfreq) + " must be > 0");
+  if(nbin < 2)
+    throw Subs_Error("Subs::Bls::Bls(double, double, int, int, double, double): nbin = " + Subs::str(nbin) + " must be > 1");
+  if(qmin <= 0. || qmax < qmin || qmax >= 1.)
+    throw Subs_Error("Subs::Bls::Bls(double, double, int, int, double, double): need 0 < qmin <= qmax < 1, but qmin = " +
+		     Subs::str(qmin) + ", qmax = " + Subs::str(qmax));
+  kmin = std::max(1, int(qmin*nbin+0.5));
+  kmax = std::min(nbin-1, std::max(kmin, int(qmax*nbin+0.5)));
+}
+
+/** Searches one light curve for box-shaped dips
+ * \param x      X data
+ * \param y      Y data
+ * \param e      uncertainties, <= 0 to ignore
+ * \param n      the number of points
+ * \param result the best box at each frequency, nfreq values
+ */
+void Subs::Bls::compute(const double* x, const float* y, const float* e, int n, Box* result) const {
+
+  std::vector<double> dx, w, d;
+  const double xref = prepare(x, y, e, n, "Subs::Bls::compute", dx, w, d);
+  const int np = dx.size();
+  std::vector<double> wd(np);
+  double wsum = 0.;
+  for(int j=0; j<np; j++){
+    wsum += w[j];
+    wd[j] = w[j]*d[j];
+  }
+
+  for_trials(nfreq, [&](int i1, int i2){
+      Work_guard guard(2*nbin + 2*(2*nbin+1));
+      double* bw = guard.ptr();
+      double* bd = bw + nbin;
+      double* cw = bd + nbin;
+      double* cd = cw + 2*nbin + 1;
+
+      for(int i=i1; i<i2; i++){
+	const double f = frequency(i);
+	std::fill(bw, bw+2*nbin, 0.);
+	for(int j=0; j<np; j++){
+	  const int b = phase_bin(dx[j], f, nbin);
+	  bw[b] += w[j];
+	  bd[b] += wd[j];
+	}
+	cumulate(bw, nbin, cw);
+	cumulate(bd, nbin, cd);
+
+	// in-eclipse sums of weights r and weighted deviations s. The fit of
+	// separate levels in and out of the box improves chi**2 on a constant
+	// by wsum s^2/(r (wsum-r)); only dips, s < 0, are accepted.
+	Box best = {0., 0., xref, 0.};
+	int jbest = -1, kbest = 0;
+	for(int j=0; j<nbin; j++){
+	  for(int k=kmin; k<=kmax; k++){
+	    const double r = cw[j+k] - cw[j];
+	    const double s = cd[j+k] - cd[j];
+	    if(s < 0. && r > 0. && r < wsum){
+	      const double dchisq = wsum*s*s/(r*(wsum-r));
+	      if(dchisq > best.dchisq){
+		best.dchisq = dchisq;
+		best.depth  = -wsum*s/(r*(wsum-r));
+		jbest = j;
+		kbest = k;
+	      }
+	    }
+	  }
+	}
+	if(jbest >= 0){
+	  double pc = (jbest + kbest/2.)/nbin;
+	  if(pc >= 1.) pc -= 1.;
+	  best.t0    = xref + pc/f;
+	  best.width = double(kbest)/nbin;
+	}
+	result[i] = best;
+      }
+    });
+}
+
+/** Searches one light curve for box-shaped dips
+ * \param x      X data
+ * \param y      Y data
+ * \param e      uncertainties, <= 0 to ignore
+ * \param n      the number of points
+ * \param result the best box at each frequency, resized to nfreq values if need be
+ */
+void Subs::Bls::compute(const double* x, const float* y, const float* e, int n, Buffer1D<Box>& result) const {
+  if(result.size() != nfreq) result.resize(nfreq);
+  compute(x, y, e, n, result.ptr());
+}
+
+/** Returns the linear ephemeris with phase 0 at the middle of the box found
+ * at frequency i.
+ * \param i      the frequency index
+ * \param box    the box found at frequency i by compute
+ * \param tscale timescale of the data
+ */
+Subs::Ephem Subs::Bls::ephem(int i, const Box& box, Ephem::TSCALE tscale) const {
+  return Ephem(box.t0, 1./frequency(i), tscale);
+}
+
+std::ostream& Subs::operator<<(std::ostream& ost, const Bls::Box& box){
+  ost << box.dchisq << " " << box.depth << " " << box.t0 << " " << box.width;
+  return ost;
+}
+
+std::istream& Subs::operator>>(std::istream& ist, Bls::Box& box){
+  ist >> box.dchisq >> box.depth >> box.t0 >> box.width;
+  return ist;
+}
+
+/** Sets up the search
+ * \param fmin   lowest frequency, cycles/unit x
+ * \param fmax   highest frequency, cycles/unit x
+ * \param nfreq  number of frequencies
+ * \param nbin   number of phase bins per cycle
+ * \param ncover number of covers, i.e. sets of bins offset from each other
+ */
+Subs::Pdm::Pdm(double fmin, double fmax, int nfreq, int nbin, int ncover) :
+  fmin(fmin), fmax(fmax), nfreq(nfreq), nbin(nbin), ncover(ncover) {
+  if(fmin <= 0. || fmax < fmin)
+    throw Subs_Error("Subs::Pdm::Pdm(double, double, int, int, int): need 0 < fmin <= fmax, but fmin = " +
+		     Subs::str(fmin) + ", fmax = " + Subs::str(fmax));
+  if(nfreq < 1)
+    throw Subs_Error("Subs::Pdm::Pdm(double, double, int, int, int): nfreq = " + Subs::str(nfreq) + " must be > 0");
+  if(nbin < 2)
+    throw Subs_Error("Subs::Pdm::Pdm(double, double, int, int, int): nbin = " + Subs::str(nbin) + " must be > 1");
+  if(ncover < 1)
+    throw Subs_Error("Subs::Pdm::Pdm(double, double, int, int, int): ncover = " + Subs::str(ncover) + " must be > 0");
+}
+
+/** Computes the theta statistic of one light curve. Frequencies at which
+ * no bin holds more than one point return 1.
+ * \param x     X data
+ * \param y     Y data
+ * \param e     uncertainties, <= 0 to ignore
+ * \param n     the number of points
+ * \param theta returned statistic, nfreq values
+ */
+void Subs::Pdm::compute(const double* x, const float* y, const float* e, int n, double* theta) const {
+
+  std::vector<double> dx, w, d;
+  prepare(x, y, e, n, "Subs::Pdm::compute", dx, w, d);
+  const int np = dx.size();
+  std::vector<double> wd(np), wdd(np);
+  double total = 0.;
+  for(int j=0; j<np; j++){
+    wd[j]  = w[j]*d[j];
+    wdd[j] = wd[j]*d[j];
+    total += wdd[j];
+  }
+  if(total <= 0.){
+    std::fill(theta, theta+nfreq, 1.);
+    return;
+  }
+  const double var = total/(np-1);
+
+  const int nfine = nbin*ncover;
+  for_trials(nfreq, [&](int i1, int i2){
+      Work_guard guard(4*nfine + 4*(2*nfine+1));
+      double* bn  = guard.ptr();
+      double* bw  = bn + nfine;
+      double* bd  = bw + nfine;
+      double* bdd = bd + nfine;
+      double* cn  = bdd + nfine;
+      double* cw  = cn + 2*nfine + 1;
+      double* cd  = cw + 2*nfine + 1;
+      double* cdd = cd + 2*nfine + 1;
+
+      for(int i=i1; i<i2; i++){
+	const double f = frequency(i);
+	std::fill(bn, bn+4*nfine, 0.);
+	for(int j=0; j<np; j++){
+	  const int b = phase_bin(dx[j], f, nfine);
+	  bn[b]  += 1.;
+	  bw[b]  += w[j];
+	  bd[b]  += wd[j];
+	  bdd[b] += wdd[j];
+	}
+	cumulate(bn,  nfine, cn);
+	cumulate(bw,  nfine, cw);
+	cumulate(bd,  nfine, cd);
+	cumulate(bdd, nfine, cdd);
+
+	// each bin covers ncover fine bins, and there is one starting at
+	// every fine bin
+	double within = 0., dof = 0.;
+	for(int j=0; j<nfine; j++){
+	  const double s0 = cw[j+ncover] - cw[j];
+	  if(s0 > 0.){
+	    const double s1 = cd[j+ncover]  - cd[j];
+	    const double s2 = cdd[j+ncover] - cdd[j];
+	    within += std::max(0., s2 - s1*s1/s0);
+	    dof    += cn[j+ncover] - cn[j] - 1.;
+	  }
+	}
+	theta[i] = dof > 0.5 ? within/dof/var : 1.;
+      }
+    });
+}
+
+/** Computes the theta statistic of one light curve.
+ * \param x     X data
+ * \param y     Y data
+ * \param e     uncertainties, <= 0 to ignore
+ * \param n     the number of points
+ * \param theta returned statistic, resized to nfreq values if need be
+ */
+void Subs::Pdm::compute(const double* x, const float* y, const float* e, int n, Buffer1D<double>& theta) const {
+  if(theta.size() != nfreq) theta.resize(nfreq);
+  compute(x, y, e, n, theta.ptr());
+}
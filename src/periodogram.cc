@@ -0,0 +1,634 @@
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+#include "trm/subs.h"
+#include "trm/constants.h"
+#include "trm/thread_pool.h"
+#include "trm/simd.h"
+#include "trm/periodogram.h"
+
+namespace {
+
+  // Removes b from a until a is less than b
+  double dmod(double a, double b){
+    while(a >= b) a -= b;
+    return a;
+  }
+
+  // Number of points extirpolated at a time
+  const int NBLOCK = 256;
+
+  // Relative amount by which the oversampling may fall short of 1
+  const double OFAC_TOL = 1.e-9;
+
+  // Spreads values v[i] at positions u[i] (0 <= u[i] < ndim) over the 4
+  // nearest points of a grid by Lagrange extirpolation, as Press & Rybicki.
+  // The weights of a block of points are computed together by
+  // Simd::lagrange4; only the final accumulation is done point by point.
+  void extirpolate(const double* u, const double* v, int n, double* grid, int ndim){
+    if(n == 0) return;
+    int ilo[NBLOCK];
+    double t[NBLOCK] = {}, w0[NBLOCK], w1[NBLOCK], w2[NBLOCK], w3[NBLOCK];
+    for(int i=0; i<n; i++){
+      ilo[i] = std::min(std::max(int(u[i]-2.), 0), ndim-4);
+      t[i]   = u[i] - ilo[i];
+    }
+    Subs::Simd::lagrange4(t, n, w0, w1, w2, w3);
+    for(int i=0; i<n; i++){
+      double* g = grid + ilo[i];
+      g[0] += v[i]*w0[i];
+      g[1] += v[i]*w1[i];
+      g[2] += v[i]*w2[i];
+      g[3] += v[i]*w3[i];
+    }
+  }
+
+  // As extirpolate, for complex values (vr[i],vi[i]) onto a grid of complex
+  // values stored as alternate real and imaginary parts
+  void extirpolate(const double* u, const double* vr, const double* vi, int n, double* grid, int ndim){
+    if(n == 0) return;
+    int ilo[NBLOCK];
+    double t[NBLOCK] = {}, w0[NBLOCK], w1[NBLOCK], w2[NBLOCK], w3[NBLOCK];
+    for(int i=0; i<n; i++){
+      ilo[i] = std::min(std::max(int(u[i]-2.), 0), ndim-4);
+      t[i]   = u[i] - ilo[i];
+    }
+    Subs::Simd::lagrange4(t, n, w0, w1, w2, w3);
+    for(int i=0; i<n; i++){
+      double* g = grid + 2*ilo[i];
+      g[0] += vr[i]*w0[i];
+      g[1] += vi[i]*w0[i];
+      g[2] += vr[i]*w1[i];
+      g[3] += vi[i]*w1[i];
+      g[4] += vr[i]*w2[i];
+      g[5] += vi[i]*w2[i];
+      g[6] += vr[i]*w3[i];
+      g[7] += vi[i]*w3[i];
+    }
+  }
+
+  // Lomb-Scargle power from the sum wsum of the weights, (hr,hi), the sum of
+  // w y exp(i omega x), and (gr,gi), the sum of w exp(2 i omega x)
+  double ls_power(double wsum, double hr, double hi, double gr, double gi){
+    using Subs::sqr;
+    const double hypo  = sqrt(sqr(gr)+sqr(gi));
+    const double hc2wt = 0.5*gr/hypo;
+    const double hs2wt = 0.5*gi/hypo;
+    const double cwt   = sqrt(0.5+hc2wt);
+    const double swt   = Subs::sign(sqrt(0.5-hc2wt),hs2wt);
+    const double den   = 0.5*wsum+hc2wt*gr+hs2wt*gi;
+    const double cterm = sqr(cwt*hr+swt*hi)/den;
+    const double sterm = sqr(cwt*hi-swt*hr)/(wsum-den);
+    return (cterm+sterm)/2.;
+  }
+
+  // Amplitude of the best-fit sinusoid, from the same sums as ls_power
+  double amplitude(double wsum, double hr, double hi, double gr, double gi){
+    using Subs::sqr;
+    const double hypo  = sqrt(sqr(gr)+sqr(gi));
+    const double hc2wt = 0.5*gr/hypo;
+    const double hs2wt = 0.5*gi/hypo;
+    const double ac = (0.5*wsum-hc2wt)*hr - hs2wt*hi;
+    const double as = -hs2wt*hr + (0.5*wsum+hc2wt)*hi;
+    return sqrt(ac*ac + as*as)/(sqr(0.5*wsum) - sqr(hc2wt) - sqr(hs2wt));
+  }
+
+  // Generalised Lomb-Scargle power of a fit of a constant plus nharm
+  // harmonics, Zechmeister & Kuerster's normalisation. hr[m-1]+i hi[m-1] is
+  // the sum of w y exp(i m omega x), m = 1 to nharm, gr[m-1]+i gi[m-1] the
+  // sum of w exp(i m omega x), m = 1 to 2 nharm; wsum, wy and wyy are the
+  // sums of w, w y and w y^2. work needs 2 nharm (2 nharm + 1) values.
+  double gls_power(int nharm, double wsum, double wy, double wyy, const double* hr, const double* hi,
+		   const double* gr, const double* gi, double* work){
+
+    // weighted means, and the variance of y about its mean
+    const int nf = 2*nharm;
+    const double ymean = wy/wsum;
+    const double yvar  = wyy/wsum - ymean*ymean;
+    if(yvar <= 0.) return 0.;
+
+    // sums of w exp(i j omega x) / wsum, j = 0 to 2 nharm
+    auto cw = [&](int j){return j == 0 ? 1. : gr[j-1]/wsum;};
+    auto sw = [&](int j){return j == 0 ? 0. : (j > 0 ? gi[j-1]/wsum : -gi[-j-1]/wsum);};
+
+    // covariances of cos(m omega x), sin(m omega x) with each other and with
+    // y, about their means, in a[nf*nf] and b[nf]
+    double* a = work;
+    double* b = a + nf*nf;
+    for(int m=1; m<=nharm; m++){
+      const int ic = 2*m-2, is = ic+1;
+      const double cm = cw(m), sm = sw(m);
+      b[ic] = hr[m-1]/wsum - ymean*cm;
+      b[is] = hi[m-1]/wsum - ymean*sm;
+      for(int l=1; l<=m; l++){
+	const int jc = 2*l-2, js = jc+1;
+	const double cl = cw(l), sl = sw(l);
+	a[nf*ic+jc] = (cw(m-l) + cw(m+l))/2. - cm*cl;
+	a[nf*is+js] = (cw(m-l) - cw(m+l))/2. - sm*sl;
+	a[nf*is+jc] = (sw(m+l) + sw(m-l))/2. - sm*cl;
+	a[nf*ic+js] = (sw(m+l) - sw(m-l))/2. - cm*sl;
+      }
+    }
+
+    // Cholesky factorisation of the lower triangle, then the reduction in
+    // chi**2 = b^T a^-1 b by forward substitution
+    double chisq = 0.;
+    for(int j=0; j<nf; j++){
+      double* aj = a + nf*j;
+      for(int k=0; k<j; k++){
+	const double* ak = a + nf*k;
+	double sum = aj[k];
+	for(int l=0; l<k; l++) sum -= aj[l]*ak[l];
+	aj[k] = sum/ak[k];
+      }
+      double diag = aj[j];
+      for(int l=0; l<j; l++) diag -= aj[l]*aj[l];
+      if(diag <= 0. || diag <= 1.e-12*aj[j]) return 0.;
+      aj[j] = sqrt(diag);
+      double sum = b[j];
+      for(int l=0; l<j; l++) sum -= aj[l]*b[l];
+      b[j] = sum/aj[j];
+      chisq += b[j]*b[j];
+    }
+    return chisq/yvar;
+  }
+
+  // Most values of workspace kept by each thread between spectra; larger
+  // buffers are released once the spectrum is computed
+  const size_t WORK_KEEP = 1 << 20;
+
+  // Per-thread workspace of at least n values, released when the guard goes
+  // out of scope if it has grown beyond WORK_KEEP values
+  class Work_guard {
+  public:
+    explicit Work_guard(size_t n) : work(buffer()) {
+      if(work.size() < n) work.resize(n);
+    }
+    ~Work_guard(){
+      if(work.capacity() > WORK_KEEP) std::vector<double>().swap(work);
+    }
+    double* ptr(){return &work[0];}
+  private:
+    static std::vector<double>& buffer(){
+      static thread_local std::vector<double> work;
+      return work;
+    }
+    std::vector<double>& work;
+  };
+
+}
+
+/** Sets up the frequency grid
+ * \param fmax  maximum frequency, cycles/unit x
+ * \param nfreq number of frequencies
+ * \param type  type of spectrum
+ * \param nharm number of harmonics fitted by GENERALISED; ignored otherwise
+ */
+Subs::Periodogram::Periodogram(double fmax, int nfreq, TYPE type, int nharm) : fmax(fmax), nfreq(nfreq), type(type), nharm(nharm) {
+  if(fmax <= 0.)
+    throw Subs_Error("Subs::Periodogram::Periodogram(double, int, TYPE, int): fmax = " + Subs::str(fmax) + " must be > 0");
+  if(nfreq < 1)
+    throw Subs_Error("Subs::Periodogram::Periodogram(double, int, TYPE, int): nfreq = " + Subs::str(nfreq) + " must be > 0");
+  if(type == GENERALISED && nharm < 1)
+    throw Subs_Error("Subs::Periodogram::Periodogram(double, int, TYPE, int): nharm = " + Subs::str(nharm) + " must be > 0");
+
+  // the grid must extend to twice the highest frequency, and more for
+  // accuracy. It is rounded up to a power of 2 as in the original fasper,
+  // since the margin this leaves keeps the extirpolation accurate up to fmax.
+  const int nfreqt = 2*MACC*nfreq;
+  int nf = 64;
+  while(nf < nfreqt) nf <<= 1;
+  ndim = nf << 1;
+  plan = Fft_plan<double>::get(nf);
+
+  // the sums needed: w y exp(i omega x) and w exp(2 i omega x) for the
+  // classic forms; w y exp(i m omega x), m = 1 to nharm, and w exp(i m omega
+  // x), m = 1 to 2 nharm, for the generalised form.
+  if(type == GENERALISED){
+    for(int m=1; m<=nharm; m++)   layout.push_back(Grid{m, true});
+    for(int m=1; m<=2*nharm; m++) layout.push_back(Grid{m, false});
+    maxharm = 2*nharm;
+    nwork = 2*layout.size() + 2*nharm*(2*nharm+1);
+  }else{
+    this->nharm = 1;
+    layout.push_back(Grid{1, true});
+    layout.push_back(Grid{2, false});
+    maxharm = 2;
+    nwork = 2*layout.size();
+  }
+}
+
+// Returns the lowest X of the points used, checking the oversampling
+double Subs::Periodogram::start(const double* x, const float* e, int n) const {
+  double xmin = DBL_MAX, xmax = -DBL_MAX;
+  for(int i=0; i<n; i++){
+    if(e[i] > 0.){
+      if(x[i] < xmin) xmin = x[i];
+      if(x[i] > xmax) xmax = x[i];
+    }
+  }
+  const double xdif = xmax-xmin;
+  // fasper with ofac = 1 can come out a little below 1 through rounding
+  const double ofac = nfreq/(xdif*fmax);
+  if(ofac < 1. - OFAC_TOL)
+    throw Subs_Error("Subs::Periodogram::compute: oversampling factor = " + Subs::str(ofac) +
+		     " and is < 1. Need more frequencies or a smaller maximum frequency.");
+  return xmin;
+}
+
+// Extirpolates a block of n points at grid positions u with weights w and
+// weighted data wy onto real grids of size ndim each, one per element of
+// layout, each at ndim values from the last.
+void Subs::Periodogram::spread(const double* u, const double* w, const double* wy, int n, double* grid) const {
+  double ut[NBLOCK];
+  const double dndim = double(ndim);
+  for(size_t g=0; g<layout.size(); g++){
+    const int m = layout[g].harm;
+    if(m == 1){
+      extirpolate(u, layout[g].data ? wy : w, n, grid + g*ndim, ndim);
+    }else{
+      for(int i=0; i<n; i++)
+	ut[i] = dmod(m*u[i], dndim);
+      extirpolate(ut, layout[g].data ? wy : w, n, grid + g*ndim, ndim);
+    }
+  }
+}
+
+// As spread, for the complex grids of mdim points of the band version,
+// with the values of harmonic m multiplied by the phasors
+// (cp[(m-1)*NBLOCK+i], sp[(m-1)*NBLOCK+i]).
+void Subs::Periodogram::spread(const double* u, const double* w, const double* wy, const double* cp, const double* sp,
+			       int n, double* grid, int mdim) const {
+  double ut[NBLOCK], vr[NBLOCK], vi[NBLOCK];
+  const double dmdim = double(mdim);
+  for(size_t g=0; g<layout.size(); g++){
+    const int m = layout[g].harm;
+    const double* v = layout[g].data ? wy : w;
+    const double* c = cp + (m-1)*NBLOCK;
+    const double* s = sp + (m-1)*NBLOCK;
+    for(int i=0; i<n; i++){
+      ut[i] = m == 1 ? u[i] : dmod(m*u[i], dmdim);
+      vr[i] = v[i]*c[i];
+      vi[i] = v[i]*s[i];
+    }
+    extirpolate(ut, vr, vi, n, grid + 2*g*mdim, mdim);
+  }
+}
+
+// Returns the spectrum given the sums (sr[g],si[g]) of each grid at one
+// frequency, and the sums of w, w y and w y^2
+double Subs::Periodogram::spectrum(double wsum, double wy, double wyy, const double* sr, const double* si, double* work) const {
+  switch(type){
+  case LOMB_SCARGLE:
+    return ls_power(wsum, sr[0], si[0], sr[1], si[1]);
+  case AMPLITUDE:
+    return amplitude(wsum, sr[0], si[0], sr[1], si[1]);
+  default:
+    return gls_power(nharm, wsum, wy, wyy, sr, si, sr+nharm, si+nharm, work);
+  }
+}
+
+/** Computes the spectrum of one light curve
+ * \param x     X data
+ * \param y     Y data
+ * \param e     uncertainties. Set equal to sample RMS for standard normalisation, <= 0 to ignore
+ * \param n     the number of points
+ * \param power returned spectrum, nfreq values
+ */
+void Subs::Periodogram::compute(const double* x, const float* y, const float* e, int n, double* power) const {
+
+  const double xmin = start(x, e, n);
+
+  const int ngrid = layout.size();
+  Work_guard guard(ngrid*ndim + nwork);
+  double* wk = guard.ptr();
+  double* sr = wk + ngrid*ndim;
+  double* si = sr + ngrid;
+  double* work = si + ngrid;
+  std::fill(wk, wk+ngrid*ndim, 0.);
+
+  const double fac   = ndim*(fmax/nfreq);
+  const double dndim = double(ndim);
+
+  // "Extirpolate" into large arrays, a block of points at a time
+  double u[NBLOCK], w[NBLOCK], wy[NBLOCK];
+  double wsum = 0., wysum = 0., wyysum = 0.;
+  int nblock = 0;
+  for(int i=0; i<n; i++){
+    if(e[i] > 0.){
+      w[nblock]  = 1./(e[i]*e[i]);
+      wy[nblock] = w[nblock]*y[i];
+      wsum   += w[nblock];
+      wysum  += wy[nblock];
+      wyysum += wy[nblock]*y[i];
+      u[nblock]  = dmod(fac*(x[i]-xmin), dndim);
+      if(++nblock == NBLOCK){
+	spread(u, w, wy, nblock, wk);
+	nblock = 0;
+      }
+    }
+  }
+  spread(u, w, wy, nblock, wk);
+
+  for(int g=0; g<ngrid; g++)
+    plan->fftr(wk + g*ndim, 1);
+
+  for(int i=0,k=2; i<nfreq; i++,k+=2){
+    for(int g=0; g<ngrid; g++){
+      sr[g] = wk[g*ndim+k];
+      si[g] = wk[g*ndim+k+1];
+    }
+    power[i] = spectrum(wsum, wysum, wyysum, sr, si, work);
+  }
+}
+
+/** Computes the spectrum of one light curve
+ * \param x     X data
+ * \param y     Y data
+ * \param e     uncertainties. Set equal to sample RMS for standard normalisation, <= 0 to ignore
+ * \param n     the number of points
+ * \param power returned spectrum, resized to nfreq values if need be
+ */
+void Subs::Periodogram::compute(const double* x, const float* y, const float* e, int n, Buffer1D<double>& power) const {
+  if(power.size() != nfreq) power.resize(nfreq);
+  compute(x, y, e, n, power.ptr());
+}
+
+/** Computes the spectra of a batch of light curves, spread over threads if
+ * enabled with set_nthreads.
+ * \param ncurve the number of light curves
+ * \param x      X data of each light curve
+ * \param y      Y data of each light curve
+ * \param e      uncertainties of each light curve, <= 0 to ignore
+ * \param n      the number of points of each light curve
+ * \param power  returned spectra, one row of nfreq values per light curve,
+ * resized if need be
+ */
+void Subs::Periodogram::compute(int ncurve, const double* const* x, const float* const* y, const float* const* e,
+				const int* n, Buffer2D<double>& power) const {
+  if(power.get_ny() != ncurve || power.get_nx() != nfreq) power.resize(ncurve, nfreq);
+  if(get_nthreads() > 1){
+    parallel_run(ncurve, [&](int ic){
+	compute(x[ic], y[ic], e[ic], n[ic], power[ic]);
+      });
+  }else{
+    for(int ic=0; ic<ncurve; ic++)
+      compute(x[ic], y[ic], e[ic], n[ic], power[ic]);
+  }
+}
+
+/** Computes the spectrum of one light curve in bands of nband frequencies,
+ * using memory set by nband rather than the total number of frequencies.
+ * The results match those of the other versions of compute to within the
+ * accuracy of the extirpolation.
+ * \param x     X data
+ * \param y     Y data
+ * \param e     uncertainties. Set equal to sample RMS for standard normalisation, <= 0 to ignore
+ * \param n     the number of points
+ * \param nband the number of frequencies per band
+ * \param func  called as func(i1, i2, power) for each band in order of
+ * frequency with power[i-i1] the spectrum at frequency(i), i = i1 to i2-1.
+ * The pointer is only valid during the call.
+ */
+void Subs::Periodogram::compute(const double* x, const float* y, const float* e, int n, int nband,
+				const std::function<void(int, int, const double*)>& func) const {
+
+  if(nband < 1)
+    throw Subs_Error("void Subs::Periodogram::compute(const double*, const float*, const float*, int, int, "
+		     "const std::function<void(int, int, const double*)>&) const: nband = " + Subs::str(nband) + " must be > 0");
+  nband = std::min(nband, nfreq);
+
+  const double xmin = start(x, e, n);
+
+  // complex grids of mdim points. Offsets from the centre of a band reach
+  // nband/2, half the fraction of the grid that the highest frequencies of
+  // the full transform reach. The extirpolation error falls as the fourth
+  // power of this, so strong peaks anywhere in a band come out about as
+  // well as they do at low frequencies in the full transform.
+  const int mdim = int(fft_size(std::max(64, 4*MACC*nband)));
+  std::shared_ptr<const Fft_plan<double> > bplan = Fft_plan<double>::get(mdim);
+  const int ngrid = layout.size();
+  Work_guard guard(2*ngrid*mdim + 2*maxharm*NBLOCK + nwork);
+  double* wk   = guard.ptr();
+  double* cp   = wk + 2*ngrid*mdim;
+  double* sp   = cp + maxharm*NBLOCK;
+  double* sr   = sp + maxharm*NBLOCK;
+  double* si   = sr + ngrid;
+  double* work = si + ngrid;
+  std::vector<double> power(nband);
+
+  const double df    = fmax/nfreq;
+  const double fac   = mdim*df;
+  const double dmdim = double(mdim);
+
+  double u[NBLOCK], w[NBLOCK], wy[NBLOCK];
+  for(int i1=0; i1<nfreq; i1+=nband){
+    const int i2 = std::min(nfreq, i1+nband);
+
+    // frequency(ic) is at the centre of the band
+    const int ic = i1 + 1 + (i2-i1)/2;
+    const double f0 = df*ic;
+
+    std::fill(wk, wk+2*ngrid*mdim, 0.);
+    double wsum = 0., wysum = 0., wyysum = 0.;
+    int nblock = 0;
+    for(int i=0; i<n; i++){
+      if(e[i] > 0.){
+	w[nblock]  = 1./(e[i]*e[i]);
+	wy[nblock] = w[nblock]*y[i];
+	wsum   += w[nblock];
+	wysum  += wy[nblock];
+	wyysum += wy[nblock]*y[i];
+	const double dx = x[i]-xmin;
+	u[nblock] = dmod(fac*dx, dmdim);
+
+	// heterodyne harmonic m by m f0
+	double phase = f0*dx;
+	phase -= std::floor(phase);
+	const double c = std::cos(Constants::TWOPI*phase), s = std::sin(Constants::TWOPI*phase);
+	cp[nblock] = c;
+	sp[nblock] = s;
+	for(int m=1; m<maxharm; m++){
+	  const double cm = cp[(m-1)*NBLOCK+nblock], sm = sp[(m-1)*NBLOCK+nblock];
+	  cp[m*NBLOCK+nblock] = cm*c - sm*s;
+	  sp[m*NBLOCK+nblock] = sm*c + cm*s;
+	}
+	if(++nblock == NBLOCK){
+	  spread(u, w, wy, cp, sp, nblock, wk, mdim);
+	  nblock = 0;
+	}
+      }
+    }
+    spread(u, w, wy, cp, sp, nblock, wk, mdim);
+
+    for(int g=0; g<ngrid; g++)
+      bplan->fft(wk + 2*g*mdim, 1);
+
+    // the grids of harmonic m have positions multiplied by m, so the same
+    // index gives m times the frequency
+    for(int i=i1; i<i2; i++){
+      int k = i + 1 - ic;
+      if(k < 0) k += mdim;
+      k *= 2;
+      for(int g=0; g<ngrid; g++){
+	sr[g] = wk[2*g*mdim+k];
+	si[g] = wk[2*g*mdim+k+1];
+      }
+      power[i-i1] = spectrum(wsum, wysum, wyysum, sr, si, work);
+    }
+    func(i1, i2, &power[0]);
+  }
+}
+
+/** Sets up the frequency grid, as Periodogram
+ * \param fmax  maximum frequency, cycles/unit x
+ * \param nfreq number of frequencies
+ * \param type  type of spectrum
+ * \param nharm number of harmonics fitted by GENERALISED; ignored otherwise
+ */
+Subs::Incremental_periodogram::Incremental_periodogram(double fmax, int nfreq, Periodogram::TYPE type, int nharm) :
+  pgram(fmax, nfreq, type, nharm) {
+  reset();
+}
+
+void Subs::Incremental_periodogram::reset(){
+  grid.assign(pgram.layout.size()*pgram.ndim, 0.);
+  x0     = 0.;
+  xmin   = DBL_MAX;
+  xmax   = -DBL_MAX;
+  wsum   = wysum = wyysum = 0.;
+  npoint = 0;
+}
+
+/** Adds points to the grids. Points with uncertainties <= 0 are ignored.
+ * \param x X data
+ * \param y Y data
+ * \param e uncertainties. Set equal to sample RMS for standard normalisation, <= 0 to ignore
+ * \param n the number of points
+ */
+void Subs::Incremental_periodogram::add(const double* x, const float* y, const float* e, int n){
+
+  const double fac   = pgram.ndim*(pgram.fmax/pgram.nfreq);
+  const double dndim = double(pgram.ndim);
+
+  double u[NBLOCK], w[NBLOCK], wy[NBLOCK];
+  int nblock = 0;
+  for(int i=0; i<n; i++){
+    if(e[i] > 0.){
+      if(npoint == 0) x0 = x[i];
+      npoint++;
+      if(x[i] < xmin) xmin = x[i];
+      if(x[i] > xmax) xmax = x[i];
+      w[nblock]  = 1./(e[i]*e[i]);
+      wy[nblock] = w[nblock]*y[i];
+      wsum   += w[nblock];
+      wysum  += wy[nblock];
+      wyysum += wy[nblock]*y[i];
+
+      // positions wrap, so points before the first are just as good
+      double ui = fac*(x[i]-x0);
+      if(ui < 0.) ui += dndim*std::ceil(-ui/dndim);
+      u[nblock] = dmod(ui, dndim);
+      if(++nblock == NBLOCK){
+	pgram.spread(u, w, wy, nblock, &grid[0]);
+	nblock = 0;
+      }
+    }
+  }
+  pgram.spread(u, w, wy, nblock, &grid[0]);
+}
+
+/** Computes the spectrum of all the points added so far. The oversampling
+ * condition of Periodogram applies to their span.
+ * \param power returned spectrum, nfreq values
+ */
+void Subs::Incremental_periodogram::compute(double* power) const {
+
+  const double ofac = pgram.nfreq/((xmax-xmin)*pgram.fmax);
+  if(npoint < 2 || ofac < 1. - OFAC_TOL)
+    throw Subs_Error("void Subs::Incremental_periodogram::compute(double*) const: " + Subs::str(npoint) +
+		     " points, oversampling factor = " + Subs::str(ofac) + "; need at least 2 points and a factor >= 1");
+
+  const int ndim  = pgram.ndim;
+  const int ngrid = pgram.layout.size();
+  Work_guard guard(ngrid*ndim + pgram.nwork);
+  double* wk = guard.ptr();
+  double* sr = wk + ngrid*ndim;
+  double* si = sr + ngrid;
+  double* work = si + ngrid;
+  std::copy(grid.begin(), grid.end(), wk);
+
+  for(int g=0; g<ngrid; g++)
+    pgram.plan->fftr(wk + g*ndim, 1);
+
+  for(int i=0,k=2; i<pgram.nfreq; i++,k+=2){
+    for(int g=0; g<ngrid; g++){
+      sr[g] = wk[g*ndim+k];
+      si[g] = wk[g*ndim+k+1];
+    }
+    power[i] = pgram.spectrum(wsum, wysum, wyysum, sr, si, work);
+  }
+}
+
+/** Computes the spectrum of all the points added so far.
+ * \param power returned spectrum, resized to nfreq values if need be
+ */
+void Subs::Incremental_periodogram::compute(Buffer1D<double>& power) const {
+  if(power.size() != pgram.nfreq) power.resize(pgram.nfreq);
+  compute(power.ptr());
+}
+
+/** Constructor
+ * \param npeak the number of peaks to keep
+ */
+Subs::Top_peaks::Top_peaks(int npeak) : npeak(npeak) {
+  if(npeak < 1)
+    throw Subs_Error("Subs::Top_peaks::Top_peaks(int): npeak = " + Subs::str(npeak) + " must be > 0");
+  reset();
+}
+
+void Subs::Top_peaks::reset(){
+  heap.clear();
+  last = before = -DBL_MAX;
+  ilast = -1;
+}
+
+void Subs::Top_peaks::add(int index, double power){
+  auto higher = [](const Peak& a, const Peak& b){return a.power > b.power;};
+  if(int(heap.size()) < npeak){
+    heap.push_back(Peak{index, power});
+    std::push_heap(heap.begin(), heap.end(), higher);
+  }else if(power > heap.front().power){
+    std::pop_heap(heap.begin(), heap.end(), higher);
+    heap.back() = Peak{index, power};
+    std::push_heap(heap.begin(), heap.end(), higher);
+  }
+}
+
+/** Adds a band of values, which should follow on from those added before;
+ * call reset to start on a new spectrum. NaNs are skipped.
+ * \param i1    index of the first value
+ * \param i2    one more than the index of the last value
+ * \param power the values
+ */
+void Subs::Top_peaks::operator()(int i1, int i2, const double* power){
+  for(int i=i1; i<i2; i++){
+    const double p = power[i-i1];
+    if(p != p) continue;
+    if(ilast >= 0 && last > before && last >= p) add(ilast, last);
+    before = last;
+    last   = p;
+    ilast  = i;
+  }
+}
+
+std::vector<Subs::Top_peaks::Peak> Subs::Top_peaks::peaks() const {
+  Top_peaks copy(*this);
+
+  // the last point has no neighbour after it
+  if(ilast >= 0 && last > before) copy.add(ilast, last);
+
+  std::sort(copy.heap.begin(), copy.heap.end(), [](const Peak& a, const Peak& b){return a.power > b.power;});
+  return copy.heap;
+}
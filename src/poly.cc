@@ -27,6 +27,22 @@ Subs::Poly::Poly(bool normal, double xs, double xe, const std::vector<double>& c
 
 Subs::Poly::Poly(const Poly& obj) : Array1D<double>(obj), norm(obj.norm), middle(obj.middle), hrange(obj.hrange) {}
 
+Subs::Poly& Subs::Poly::operator=(const Poly& obj){
+  Array1D<double>::operator=(obj);
+  norm   = obj.norm;
+  middle = obj.middle;
+  hrange = obj.hrange;
+  return *this;
+}
+
+Subs::Poly& Subs::Poly::operator=(Poly&& obj) noexcept {
+  Array1D<double>::operator=(std::move(obj));
+  norm   = obj.norm;
+  middle = obj.middle;
+  hrange = obj.hrange;
+  return *this;
+}
+
 Subs::Poly::Poly(int npoly, bool normal, double xs, double xe) : 
   Array1D<double>(npoly), norm(normal), middle((xs+xe)/2.), hrange(abs(xe-xs)/2.) {}
 
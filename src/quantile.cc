@@ -0,0 +1,151 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "trm/subs.h"
+#include "trm/constants.h"
+#include "trm/quantile.h"
+
+/** Constructs an empty sketch
+ * \param compression controls the trade between accuracy and memory. The number
+ * of centroids is of order compression; the rank error of order 1/compression.
+ */
+Subs::Quantile_sketch::Quantile_sketch(double compression) :
+  compression(compression), vmin(std::numeric_limits<double>::infinity()),
+  vmax(-std::numeric_limits<double>::infinity()) {
+  if(compression < 10.)
+    throw Subs_Error("Subs::Quantile_sketch::Quantile_sketch(double): compression = " +
+		     Subs::str(compression) + " is too small (< 10)");
+  nbuffer = int(5*compression);
+  buffer.reserve(nbuffer);
+  centroids.reserve(int(compression)+1);
+}
+
+/** The centroids of the other sketch are treated as weighted values. Merging is
+ * exact in the sense that the result is what would have been obtained had
+ * all the values gone into one sketch, to within the accuracy of the sketch.
+ * \param sketch the sketch to merge in; it is unchanged.
+ */
+void Subs::Quantile_sketch::merge(const Quantile_sketch& sketch){
+  sketch.compress();
+  for(size_t i=0; i<sketch.centroids.size(); i++){
+    if(int(buffer.size()) >= nbuffer) compress();
+    buffer.push_back(sketch.centroids[i]);
+  }
+  vmin = std::min(vmin, sketch.vmin);
+  vmax = std::max(vmax, sketch.vmax);
+}
+
+/** The buffered values and the current centroids are sorted together and then
+ * merged in one pass. Neighbours are combined for as long as the total weight
+ * spans no more than one unit of the scale function
+ * k(q) = compression/(2 pi) asin(2q-1), which is what keeps centroids small
+ * near q = 0 and 1.
+ */
+void Subs::Quantile_sketch::compress() const {
+  if(buffer.empty()) return;
+
+  buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+  std::sort(buffer.begin(), buffer.end());
+
+  double total = 0.;
+  for(size_t i=0; i<buffer.size(); i++)
+    total += buffer[i].weight;
+
+  const double norm = compression/Constants::TWOPI;
+  const double kmax = compression/4.;
+  centroids.clear();
+
+  Centroid cur = buffer[0];
+  double wsofar = 0., qlimit;
+  double k = norm*std::asin(-1.) + 1.;
+  qlimit = k >= kmax ? 1. : (std::sin(k/norm)+1.)/2.;
+
+  for(size_t i=1; i<buffer.size(); i++){
+    const Centroid& next = buffer[i];
+    if((wsofar + cur.weight + next.weight)/total <= qlimit){
+      cur.weight += next.weight;
+      cur.mean   += (next.mean-cur.mean)*next.weight/cur.weight;
+    }else{
+      wsofar += cur.weight;
+      centroids.push_back(cur);
+      k = norm*std::asin(std::min(1., 2.*wsofar/total-1.)) + 1.;
+      qlimit = k >= kmax ? 1. : (std::sin(k/norm)+1.)/2.;
+      cur = next;
+    }
+  }
+  centroids.push_back(cur);
+  buffer.clear();
+}
+
+/** The quantile is interpolated linearly between the centres of the
+ * centroids, each taken to lie at the middle of the range of ranks it
+ * covers. Beyond the outermost centroids it is interpolated towards the
+ * exact minimum and maximum.
+ * \param frac the quantile wanted, from 0 to 1
+ * \return the estimated value of the quantile
+ */
+double Subs::Quantile_sketch::quantile(double frac) const {
+  compress();
+  if(centroids.empty())
+    throw Subs_Error("double Subs::Quantile_sketch::quantile(double): no values in sketch");
+
+  if(frac <= 0.) return vmin;
+  if(frac >= 1.) return vmax;
+  if(centroids.size() == 1) return centroids[0].mean;
+
+  double total = 0.;
+  for(size_t i=0; i<centroids.size(); i++)
+    total += centroids[i].weight;
+  const double index = frac*total;
+
+  // left tail
+  const Centroid& first = centroids[0];
+  if(index < first.weight/2.)
+    return vmin + index/(first.weight/2.)*(first.mean-vmin);
+
+  double wsofar = first.weight/2.;
+  for(size_t i=0; i<centroids.size()-1; i++){
+    const double dw = (centroids[i].weight+centroids[i+1].weight)/2.;
+    if(wsofar + dw > index)
+      return centroids[i].mean +
+	(index-wsofar)/dw*(centroids[i+1].mean-centroids[i].mean);
+    wsofar += dw;
+  }
+
+  // right tail
+  const Centroid& last = centroids.back();
+  return last.mean + std::min(1., (index-wsofar)/(last.weight/2.))*(vmax-last.mean);
+}
+
+double Subs::Quantile_sketch::count() const {
+  double total = 0.;
+  for(size_t i=0; i<centroids.size(); i++)
+    total += centroids[i].weight;
+  for(size_t i=0; i<buffer.size(); i++)
+    total += buffer[i].weight;
+  return total;
+}
+
+double Subs::Quantile_sketch::min() const {
+  if(count() == 0.)
+    throw Subs_Error("double Subs::Quantile_sketch::min(): no values in sketch");
+  return vmin;
+}
+
+double Subs::Quantile_sketch::max() const {
+  if(count() == 0.)
+    throw Subs_Error("double Subs::Quantile_sketch::max(): no values in sketch");
+  return vmax;
+}
+
+int Subs::Quantile_sketch::size() const {
+  compress();
+  return centroids.size();
+}
+
+void Subs::Quantile_sketch::reset(){
+  centroids.clear();
+  buffer.clear();
+  vmin = std::numeric_limits<double>::infinity();
+  vmax = -std::numeric_limits<double>::infinity();
+}
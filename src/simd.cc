@@ -0,0 +1,264 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "trm/subs.h"
+#include "trm/simd.h"
+#include "simd_ops.h"
+
+namespace {
+
+  // Table of kernels for one element type and one instruction set
+  template <class X>
+  struct Table {
+    const char* name;
+    void   (*add)(X*, const X*, int);
+    void   (*sub)(X*, const X*, int);
+    void   (*mul)(X*, const X*, int);
+    void   (*div)(X*, const X*, int);
+    void   (*add_const)(X*, X, int);
+    void   (*sub_const)(X*, X, int);
+    void   (*mul_const)(X*, X, int);
+    void   (*div_const)(X*, X, int);
+    void   (*sqrt)(X*, int);
+    void   (*step)(X*, int, X);
+    X      (*sum)(const X*, int);
+    double (*sum_double)(const X*, int);
+    X      (*sumsq)(const X*, int);
+    double (*sumsq_dev)(const X*, int, double);
+    X      (*max)(const X*, int);
+    X      (*min)(const X*, int);
+    void   (*lagrange4)(const X*, int, X*, X*, X*, X*);
+    void   (*syrk)(const X*, int, int, int, X*, int);
+    void   (*gram)(const X*, const X*, int, X*);
+    void   (*rotate)(X*, X*, int, X, X);
+  };
+
+  namespace kgeneric {
+#define SIMD_TARGET
+#include "simd_kernels.h"
+#undef SIMD_TARGET
+  }
+
+#ifdef TRM_SIMD_X86
+
+  namespace kavx2 {
+#define SIMD_TARGET TRM_AVX2
+#include "simd_kernels.h"
+#undef SIMD_TARGET
+  }
+
+  namespace kavx512 {
+#define SIMD_TARGET TRM_AVX512
+#include "simd_kernels.h"
+#undef SIMD_TARGET
+  }
+
+#endif
+
+  // Instruction set to use: 0 = generic, 1 = AVX2, 2 = AVX-512
+  int choose_level(){
+    int level = 0;
+#ifdef TRM_SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) level = 1;
+    if(level == 1 && __builtin_cpu_supports("avx512f")) level = 2;
+#endif
+    const char* cap = std::getenv("SUBS_SIMD");
+    if(cap != NULL){
+      if(std::strcmp(cap, "generic") == 0)
+	level = 0;
+      else if(std::strcmp(cap, "avx2") == 0 && level > 1)
+	level = 1;
+    }
+    return level;
+  }
+
+  template <class X>
+  Table<X> make_table(){
+    static const int level = choose_level();
+    Table<X> table;
+#ifdef TRM_SIMD_X86
+    if(level == 2){
+      kavx512::fill<Avx512<X> >(table, "avx512f");
+      return table;
+    }else if(level == 1){
+      kavx2::fill<Avx2<X> >(table, "avx2");
+      return table;
+    }
+#endif
+    kgeneric::fill<Generic<X> >(table, "generic");
+    return table;
+  }
+
+  // The kernels are chosen once, on first use
+  template <class X>
+  const Table<X>& table(){
+    static const Table<X> tab = make_table<X>();
+    return tab;
+  }
+
+}
+
+const char* Subs::Simd::isa(){
+  return table<float>().name;
+}
+
+void Subs::Simd::add(float* a, const float* b, int n){
+  table<float>().add(a, b, n);
+}
+
+void Subs::Simd::add(double* a, const double* b, int n){
+  table<double>().add(a, b, n);
+}
+
+void Subs::Simd::sub(float* a, const float* b, int n){
+  table<float>().sub(a, b, n);
+}
+
+void Subs::Simd::sub(double* a, const double* b, int n){
+  table<double>().sub(a, b, n);
+}
+
+void Subs::Simd::mul(float* a, const float* b, int n){
+  table<float>().mul(a, b, n);
+}
+
+void Subs::Simd::mul(double* a, const double* b, int n){
+  table<double>().mul(a, b, n);
+}
+
+void Subs::Simd::div(float* a, const float* b, int n){
+  table<float>().div(a, b, n);
+}
+
+void Subs::Simd::div(double* a, const double* b, int n){
+  table<double>().div(a, b, n);
+}
+
+void Subs::Simd::add_const(float* a, float c, int n){
+  table<float>().add_const(a, c, n);
+}
+
+void Subs::Simd::add_const(double* a, double c, int n){
+  table<double>().add_const(a, c, n);
+}
+
+void Subs::Simd::sub_const(float* a, float c, int n){
+  table<float>().sub_const(a, c, n);
+}
+
+void Subs::Simd::sub_const(double* a, double c, int n){
+  table<double>().sub_const(a, c, n);
+}
+
+void Subs::Simd::mul_const(float* a, float c, int n){
+  table<float>().mul_const(a, c, n);
+}
+
+void Subs::Simd::mul_const(double* a, double c, int n){
+  table<double>().mul_const(a, c, n);
+}
+
+void Subs::Simd::div_const(float* a, float c, int n){
+  table<float>().div_const(a, c, n);
+}
+
+void Subs::Simd::div_const(double* a, double c, int n){
+  table<double>().div_const(a, c, n);
+}
+
+void Subs::Simd::sqrt(float* a, int n){
+  table<float>().sqrt(a, n);
+}
+
+void Subs::Simd::sqrt(double* a, int n){
+  table<double>().sqrt(a, n);
+}
+
+void Subs::Simd::step(float* a, int n, float thresh){
+  table<float>().step(a, n, thresh);
+}
+
+void Subs::Simd::step(double* a, int n, double thresh){
+  table<double>().step(a, n, thresh);
+}
+
+float Subs::Simd::sum(const float* a, int n){
+  return table<float>().sum(a, n);
+}
+
+double Subs::Simd::sum(const double* a, int n){
+  return table<double>().sum(a, n);
+}
+
+double Subs::Simd::sum_double(const float* a, int n){
+  return table<float>().sum_double(a, n);
+}
+
+double Subs::Simd::sum_double(const double* a, int n){
+  return table<double>().sum_double(a, n);
+}
+
+float Subs::Simd::sumsq(const float* a, int n){
+  return table<float>().sumsq(a, n);
+}
+
+double Subs::Simd::sumsq(const double* a, int n){
+  return table<double>().sumsq(a, n);
+}
+
+double Subs::Simd::sumsq_dev(const float* a, int n, double m){
+  return table<float>().sumsq_dev(a, n, m);
+}
+
+double Subs::Simd::sumsq_dev(const double* a, int n, double m){
+  return table<double>().sumsq_dev(a, n, m);
+}
+
+float Subs::Simd::max(const float* a, int n){
+  return table<float>().max(a, n);
+}
+
+double Subs::Simd::max(const double* a, int n){
+  return table<double>().max(a, n);
+}
+
+float Subs::Simd::min(const float* a, int n){
+  return table<float>().min(a, n);
+}
+
+double Subs::Simd::min(const double* a, int n){
+  return table<double>().min(a, n);
+}
+
+void Subs::Simd::lagrange4(const float* t, int n, float* w0, float* w1, float* w2, float* w3){
+  table<float>().lagrange4(t, n, w0, w1, w2, w3);
+}
+
+void Subs::Simd::lagrange4(const double* t, int n, double* w0, double* w1, double* w2, double* w3){
+  table<double>().lagrange4(t, n, w0, w1, w2, w3);
+}
+
+void Subs::Simd::syrk(const float* p, int n, int m, int ld, float* c, int ldc){
+  table<float>().syrk(p, n, m, ld, c, ldc);
+}
+
+void Subs::Simd::syrk(const double* p, int n, int m, int ld, double* c, int ldc){
+  table<double>().syrk(p, n, m, ld, c, ldc);
+}
+
+void Subs::Simd::gram(const float* a, const float* b, int n, float* g){
+  table<float>().gram(a, b, n, g);
+}
+
+void Subs::Simd::gram(const double* a, const double* b, int n, double* g){
+  table<double>().gram(a, b, n, g);
+}
+
+void Subs::Simd::rotate(float* a, float* b, int n, float c, float s){
+  table<float>().rotate(a, b, n, c, s);
+}
+
+void Subs::Simd::rotate(double* a, double* b, int n, double c, double s){
+  table<double>().rotate(a, b, n, c, s);
+}
@@ -0,0 +1,353 @@
+// Kernels of simd.cc, written once in terms of a class S of vector
+// operations and compiled for each instruction set by including this file
+// in a separate namespace with SIMD_TARGET defined to the matching target
+// attribute. S supplies the element type T, the vector type V of width W,
+// and the double precision vector VD used by the double accumulations.
+// Do not include this anywhere else.
+
+template <class S> SIMD_TARGET
+void add(typename S::T* a, const typename S::T* b, int n){
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::add(S::load(a+i), S::load(b+i)));
+  for(; i<n; i++) a[i] += b[i];
+}
+
+template <class S> SIMD_TARGET
+void sub(typename S::T* a, const typename S::T* b, int n){
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::sub(S::load(a+i), S::load(b+i)));
+  for(; i<n; i++) a[i] -= b[i];
+}
+
+template <class S> SIMD_TARGET
+void mul(typename S::T* a, const typename S::T* b, int n){
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::mul(S::load(a+i), S::load(b+i)));
+  for(; i<n; i++) a[i] *= b[i];
+}
+
+template <class S> SIMD_TARGET
+void div(typename S::T* a, const typename S::T* b, int n){
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::div(S::load(a+i), S::load(b+i)));
+  for(; i<n; i++) a[i] /= b[i];
+}
+
+template <class S> SIMD_TARGET
+void add_const(typename S::T* a, typename S::T c, int n){
+  const typename S::V vc = S::set1(c);
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::add(S::load(a+i), vc));
+  for(; i<n; i++) a[i] += c;
+}
+
+template <class S> SIMD_TARGET
+void sub_const(typename S::T* a, typename S::T c, int n){
+  const typename S::V vc = S::set1(c);
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::sub(S::load(a+i), vc));
+  for(; i<n; i++) a[i] -= c;
+}
+
+template <class S> SIMD_TARGET
+void mul_const(typename S::T* a, typename S::T c, int n){
+  const typename S::V vc = S::set1(c);
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::mul(S::load(a+i), vc));
+  for(; i<n; i++) a[i] *= c;
+}
+
+template <class S> SIMD_TARGET
+void div_const(typename S::T* a, typename S::T c, int n){
+  const typename S::V vc = S::set1(c);
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::div(S::load(a+i), vc));
+  for(; i<n; i++) a[i] /= c;
+}
+
+template <class S> SIMD_TARGET
+void sqrt(typename S::T* a, int n){
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::sqrt(S::load(a+i)));
+  for(; i<n; i++) a[i] = std::sqrt(a[i]);
+}
+
+template <class S> SIMD_TARGET
+void step(typename S::T* a, int n, typename S::T thresh){
+  const typename S::V vt = S::set1(thresh);
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W)
+    S::store(a+i, S::step(S::load(a+i), vt));
+  for(; i<n; i++) a[i] = a[i] > thresh ? 1 : 0;
+}
+
+// The reductions run two accumulators to hide the latency of the additions
+
+template <class S> SIMD_TARGET
+typename S::T sum(const typename S::T* a, int n){
+  typename S::V s0 = S::zero(), s1 = S::zero();
+  int i = 0;
+  for(; i+2*S::W<=n; i+=2*S::W){
+    s0 = S::add(s0, S::load(a+i));
+    s1 = S::add(s1, S::load(a+i+S::W));
+  }
+  for(; i+S::W<=n; i+=S::W)
+    s0 = S::add(s0, S::load(a+i));
+  typename S::T t = S::hsum(S::add(s0, s1));
+  for(; i<n; i++) t += a[i];
+  return t;
+}
+
+template <class S> SIMD_TARGET
+double sum_double(const typename S::T* a, int n){
+  typename S::VD s0 = S::dzero(), s1 = S::dzero();
+  int i = 0;
+  for(; i+2*S::W<=n; i+=2*S::W){
+    S::dsum(S::load(a+i), s0);
+    S::dsum(S::load(a+i+S::W), s1);
+  }
+  for(; i+S::W<=n; i+=S::W)
+    S::dsum(S::load(a+i), s0);
+  double t = S::dhsum(S::dadd(s0, s1));
+  for(; i<n; i++) t += double(a[i]);
+  return t;
+}
+
+template <class S> SIMD_TARGET
+typename S::T sumsq(const typename S::T* a, int n){
+  typename S::V s0 = S::zero(), s1 = S::zero();
+  int i = 0;
+  for(; i+2*S::W<=n; i+=2*S::W){
+    typename S::V v0 = S::load(a+i), v1 = S::load(a+i+S::W);
+    s0 = S::madd(v0, v0, s0);
+    s1 = S::madd(v1, v1, s1);
+  }
+  for(; i+S::W<=n; i+=S::W){
+    typename S::V v0 = S::load(a+i);
+    s0 = S::madd(v0, v0, s0);
+  }
+  typename S::T t = S::hsum(S::add(s0, s1));
+  for(; i<n; i++) t += a[i]*a[i];
+  return t;
+}
+
+template <class S> SIMD_TARGET
+double sumsq_dev(const typename S::T* a, int n, double m){
+  const typename S::VD vm = S::dset1(m);
+  typename S::VD s0 = S::dzero(), s1 = S::dzero();
+  int i = 0;
+  for(; i+2*S::W<=n; i+=2*S::W){
+    S::dsumsq(S::load(a+i), vm, s0);
+    S::dsumsq(S::load(a+i+S::W), vm, s1);
+  }
+  for(; i+S::W<=n; i+=S::W)
+    S::dsumsq(S::load(a+i), vm, s0);
+  double t = S::dhsum(S::dadd(s0, s1));
+  for(; i<n; i++) t += (a[i]-m)*(a[i]-m);
+  return t;
+}
+
+template <class S> SIMD_TARGET
+typename S::T max(const typename S::T* a, int n){
+  int i = 0;
+  typename S::T t = a[0];
+  if(n >= S::W){
+    typename S::V vm = S::load(a);
+    for(i=S::W; i+S::W<=n; i+=S::W)
+      vm = S::max(vm, S::load(a+i));
+    t = S::hmax(vm);
+  }
+  for(; i<n; i++) t = t < a[i] ? a[i] : t;
+  return t;
+}
+
+template <class S> SIMD_TARGET
+typename S::T min(const typename S::T* a, int n){
+  int i = 0;
+  typename S::T t = a[0];
+  if(n >= S::W){
+    typename S::V vm = S::load(a);
+    for(i=S::W; i+S::W<=n; i+=S::W)
+      vm = S::min(vm, S::load(a+i));
+    t = S::hmin(vm);
+  }
+  for(; i<n; i++) t = t > a[i] ? a[i] : t;
+  return t;
+}
+
+template <class S> SIMD_TARGET
+void lagrange4(const typename S::T* t, int n, typename S::T* w0, typename S::T* w1,
+	       typename S::T* w2, typename S::T* w3){
+  typedef typename S::T T;
+  typedef typename S::V V;
+  const V one = S::set1(T(1)), two = S::set1(T(2)), three = S::set1(T(3));
+  const V m6 = S::set1(T(-1)/T(6)), p2 = S::set1(T(1)/T(2));
+  const V m2 = S::set1(T(-1)/T(2)), p6 = S::set1(T(1)/T(6));
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W){
+    V a0 = S::load(t+i), a1 = S::sub(a0, one), a2 = S::sub(a0, two), a3 = S::sub(a0, three);
+    V p01 = S::mul(a0, a1), p23 = S::mul(a2, a3);
+    S::store(w0+i, S::mul(m6, S::mul(a1, p23)));
+    S::store(w1+i, S::mul(p2, S::mul(a0, p23)));
+    S::store(w2+i, S::mul(m2, S::mul(p01, a3)));
+    S::store(w3+i, S::mul(p6, S::mul(p01, a2)));
+  }
+  for(; i<n; i++){
+    T a0 = t[i], a1 = a0-1, a2 = a0-2, a3 = a0-3;
+    T p01 = a0*a1, p23 = a2*a3;
+    w0[i] = (T(-1)/T(6))*(a1*p23);
+    w1[i] = (T(1)/T(2))*(a0*p23);
+    w2[i] = (T(-1)/T(2))*(p01*a3);
+    w3[i] = (T(1)/T(6))*(p01*a2);
+  }
+}
+
+template <class S> SIMD_TARGET
+void gram(const typename S::T* a, const typename S::T* b, int n, typename S::T* g){
+  typename S::V saa = S::zero(), sbb = S::zero(), sab = S::zero();
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W){
+    typename S::V va = S::load(a+i), vb = S::load(b+i);
+    saa = S::madd(va, va, saa);
+    sbb = S::madd(vb, vb, sbb);
+    sab = S::madd(va, vb, sab);
+  }
+  typename S::T taa = S::hsum(saa), tbb = S::hsum(sbb), tab = S::hsum(sab);
+  for(; i<n; i++){
+    taa += a[i]*a[i];
+    tbb += b[i]*b[i];
+    tab += a[i]*b[i];
+  }
+  g[0] = taa;
+  g[1] = tbb;
+  g[2] = tab;
+}
+
+template <class S> SIMD_TARGET
+void rotate(typename S::T* a, typename S::T* b, int n, typename S::T c, typename S::T s){
+  const typename S::V vc = S::set1(c), vs = S::set1(s);
+  int i = 0;
+  for(; i+S::W<=n; i+=S::W){
+    typename S::V va = S::load(a+i), vb = S::load(b+i);
+    S::store(a+i, S::sub(S::mul(vc, va), S::mul(vs, vb)));
+    S::store(b+i, S::madd(vs, va, S::mul(vc, vb)));
+  }
+  for(; i<n; i++){
+    const typename S::T ta = a[i], tb = b[i];
+    a[i] = c*ta - s*tb;
+    b[i] = s*ta + c*tb;
+  }
+}
+
+// Lower triangle of c += p^T p, p having n rows of m values ld apart and c
+// rows ldc apart. Rows of c are taken 4 at a time against columns 2 vectors
+// at a time, keeping 8 vector sums in registers while running down the rows
+// of p; then single vectors, then single columns. Rows beyond m in the last
+// block are computed as copies of its first row, j0, and are not stored.
+
+template <class S> SIMD_TARGET
+void syrk(const typename S::T* p, int n, int m, int ld, typename S::T* c, int ldc){
+  typedef typename S::T T;
+  typedef typename S::V V;
+  T buff[2*S::W];
+  for(int j0=0; j0<m; j0+=4){
+    const int nj = m-j0 < 4 ? m-j0 : 4;
+    const int j1 = j0 + (nj > 1 ? 1 : 0), j2 = j0 + (nj > 2 ? 2 : 0), j3 = j0 + (nj > 3 ? 3 : 0);
+    const int kend = j0 + nj;
+    int k0 = 0;
+    for(; k0+2*S::W<=kend; k0+=2*S::W){
+      V s00 = S::zero(), s01 = S::zero(), s10 = S::zero(), s11 = S::zero();
+      V s20 = S::zero(), s21 = S::zero(), s30 = S::zero(), s31 = S::zero();
+      for(int i=0; i<n; i++){
+	const T* pi = p + i*ld;
+	const V b0 = S::load(pi+k0), b1 = S::load(pi+k0+S::W);
+	V a = S::set1(pi[j0]);
+	s00 = S::madd(a, b0, s00);
+	s01 = S::madd(a, b1, s01);
+	a = S::set1(pi[j1]);
+	s10 = S::madd(a, b0, s10);
+	s11 = S::madd(a, b1, s11);
+	a = S::set1(pi[j2]);
+	s20 = S::madd(a, b0, s20);
+	s21 = S::madd(a, b1, s21);
+	a = S::set1(pi[j3]);
+	s30 = S::madd(a, b0, s30);
+	s31 = S::madd(a, b1, s31);
+      }
+      const V* s[4][2] = {{&s00, &s01}, {&s10, &s11}, {&s20, &s21}, {&s30, &s31}};
+      for(int r=0; r<nj; r++){
+	T* cr = c + (j0+r)*ldc + k0;
+	if(k0+2*S::W-1 <= j0+r){
+	  S::store(cr, S::add(S::load(cr), *s[r][0]));
+	  S::store(cr+S::W, S::add(S::load(cr+S::W), *s[r][1]));
+	}else{
+	  S::store(buff, *s[r][0]);
+	  S::store(buff+S::W, *s[r][1]);
+	  for(int k=0; k0+k<=j0+r; k++) cr[k] += buff[k];
+	}
+      }
+    }
+    for(; k0+S::W<=kend; k0+=S::W){
+      V s0 = S::zero(), s1 = S::zero(), s2 = S::zero(), s3 = S::zero();
+      for(int i=0; i<n; i++){
+	const T* pi = p + i*ld;
+	const V b = S::load(pi+k0);
+	s0 = S::madd(S::set1(pi[j0]), b, s0);
+	s1 = S::madd(S::set1(pi[j1]), b, s1);
+	s2 = S::madd(S::set1(pi[j2]), b, s2);
+	s3 = S::madd(S::set1(pi[j3]), b, s3);
+      }
+      const V* s[4] = {&s0, &s1, &s2, &s3};
+      for(int r=0; r<nj; r++){
+	T* cr = c + (j0+r)*ldc + k0;
+	S::store(buff, *s[r]);
+	for(int k=0; k<S::W && k0+k<=j0+r; k++) cr[k] += buff[k];
+      }
+    }
+    for(; k0<kend; k0++){
+      for(int r=0; r<nj; r++){
+	if(k0 <= j0+r){
+	  T sum = 0;
+	  for(int i=0; i<n; i++) sum += p[i*ld+j0+r]*p[i*ld+k0];
+	  c[(j0+r)*ldc+k0] += sum;
+	}
+      }
+    }
+  }
+}
+
+// Fills a table with the kernels for S
+
+template <class S>
+void fill(Table<typename S::T>& table, const char* name){
+  table.name       = name;
+  table.add        = &add<S>;
+  table.sub        = &sub<S>;
+  table.mul        = &mul<S>;
+  table.div        = &div<S>;
+  table.add_const  = &add_const<S>;
+  table.sub_const  = &sub_const<S>;
+  table.mul_const  = &mul_const<S>;
+  table.div_const  = &div_const<S>;
+  table.sqrt       = &sqrt<S>;
+  table.step       = &step<S>;
+  table.sum        = &sum<S>;
+  table.sum_double = &sum_double<S>;
+  table.sumsq      = &sumsq<S>;
+  table.sumsq_dev  = &sumsq_dev<S>;
+  table.max        = &max<S>;
+  table.min        = &min<S>;
+  table.lagrange4  = &lagrange4<S>;
+  table.syrk       = &syrk<S>;
+  table.gram       = &gram<S>;
+  table.rotate     = &rotate<S>;
+}
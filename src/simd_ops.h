@@ -0,0 +1,304 @@
+// Classes of vector operations used by the explicitly vectorised kernels
+// of simd.cc and fft.cc. Each supplies the element type T, the vector type V
+// of width W, and the double precision vector VD used by double accumulations.
+// Generic works one element at a time and is always available; Avx2 and
+// Avx512 exist when TRM_SIMD_X86 is defined and their member functions can
+// only be called from code compiled for the matching target. Do not include
+// this anywhere else.
+
+#ifndef TRM_SUBS_SIMD_OPS
+#define TRM_SUBS_SIMD_OPS
+
+#include <cmath>
+
+// The explicitly vectorised kernels need GCC-style target attributes and
+// the x86 intrinsics. Elsewhere only the generic kernels are compiled.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRM_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+  // Portable operations, one element at a time
+  template <class X>
+  struct Generic {
+    typedef X T;
+    typedef X V;
+    typedef double VD;
+    static const int W = 1;
+    static V load(const T* p){return *p;}
+    static void store(T* p, V v){*p = v;}
+    static V set1(T c){return c;}
+    static V zero(){return T(0);}
+    static V add(V a, V b){return a+b;}
+    static V sub(V a, V b){return a-b;}
+    static V mul(V a, V b){return a*b;}
+    static V div(V a, V b){return a/b;}
+    static V madd(V a, V b, V c){return a*b+c;}
+    static V sqrt(V a){return std::sqrt(a);}
+    static V step(V a, V t){return a > t ? T(1) : T(0);}
+    static V max(V a, V b){return a < b ? b : a;}
+    static V min(V a, V b){return a > b ? b : a;}
+    static T hsum(V a){return a;}
+    static T hmax(V a){return a;}
+    static T hmin(V a){return a;}
+    static VD dzero(){return 0.;}
+    static VD dset1(double c){return c;}
+    static VD dadd(VD a, VD b){return a+b;}
+    static double dhsum(VD a){return a;}
+    static void dsum(V a, VD& acc){acc += double(a);}
+    static void dsumsq(V a, VD m, VD& acc){double d = a-m; acc += d*d;}
+  };
+
+#ifdef TRM_SIMD_X86
+
+#define TRM_AVX2   __attribute__((target("avx2,fma")))
+#define TRM_AVX512 __attribute__((target("avx512f")))
+
+  template <class X> struct Avx2;
+  template <class X> struct Avx512;
+
+  // AVX2: 8 floats per vector
+  template <>
+  struct Avx2<float> {
+    typedef float T;
+    typedef __m256 V;
+    typedef __m256d VD;
+    static const int W = 8;
+    TRM_AVX2 static V load(const T* p){return _mm256_loadu_ps(p);}
+    TRM_AVX2 static void store(T* p, V v){_mm256_storeu_ps(p, v);}
+    TRM_AVX2 static V set1(T c){return _mm256_set1_ps(c);}
+    TRM_AVX2 static V zero(){return _mm256_setzero_ps();}
+    TRM_AVX2 static V add(V a, V b){return _mm256_add_ps(a, b);}
+    TRM_AVX2 static V sub(V a, V b){return _mm256_sub_ps(a, b);}
+    TRM_AVX2 static V mul(V a, V b){return _mm256_mul_ps(a, b);}
+    TRM_AVX2 static V div(V a, V b){return _mm256_div_ps(a, b);}
+    TRM_AVX2 static V madd(V a, V b, V c){return _mm256_fmadd_ps(a, b, c);}
+    TRM_AVX2 static V sqrt(V a){return _mm256_sqrt_ps(a);}
+    TRM_AVX2 static V step(V a, V t){return _mm256_and_ps(_mm256_cmp_ps(a, t, _CMP_GT_OQ), _mm256_set1_ps(1.f));}
+    TRM_AVX2 static V max(V a, V b){return _mm256_max_ps(a, b);}
+    TRM_AVX2 static V min(V a, V b){return _mm256_min_ps(a, b);}
+    TRM_AVX2 static T hsum(V a){
+      __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+      s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+      s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+      return _mm_cvtss_f32(s);
+    }
+    TRM_AVX2 static T hmax(V a){
+      __m128 s = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+      s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+      s = _mm_max_ss(s, _mm_shuffle_ps(s, s, 1));
+      return _mm_cvtss_f32(s);
+    }
+    TRM_AVX2 static T hmin(V a){
+      __m128 s = _mm_min_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+      s = _mm_min_ps(s, _mm_movehl_ps(s, s));
+      s = _mm_min_ss(s, _mm_shuffle_ps(s, s, 1));
+      return _mm_cvtss_f32(s);
+    }
+    TRM_AVX2 static VD dzero(){return _mm256_setzero_pd();}
+    TRM_AVX2 static VD dset1(double c){return _mm256_set1_pd(c);}
+    TRM_AVX2 static VD dadd(VD a, VD b){return _mm256_add_pd(a, b);}
+    TRM_AVX2 static double dhsum(VD a){
+      __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+      s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+      return _mm_cvtsd_f64(s);
+    }
+    TRM_AVX2 static void dsum(V a, VD& acc){
+      acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_castps256_ps128(a)));
+      acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)));
+    }
+    TRM_AVX2 static void dsumsq(V a, VD m, VD& acc){
+      VD lo = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(a)), m);
+      VD hi = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)), m);
+      acc = _mm256_fmadd_pd(lo, lo, acc);
+      acc = _mm256_fmadd_pd(hi, hi, acc);
+    }
+  };
+
+  // AVX2: 4 doubles per vector
+  template <>
+  struct Avx2<double> {
+    typedef double T;
+    typedef __m256d V;
+    typedef __m256d VD;
+    static const int W = 4;
+    TRM_AVX2 static V load(const T* p){return _mm256_loadu_pd(p);}
+    TRM_AVX2 static void store(T* p, V v){_mm256_storeu_pd(p, v);}
+    TRM_AVX2 static V set1(T c){return _mm256_set1_pd(c);}
+    TRM_AVX2 static V zero(){return _mm256_setzero_pd();}
+    TRM_AVX2 static V add(V a, V b){return _mm256_add_pd(a, b);}
+    TRM_AVX2 static V sub(V a, V b){return _mm256_sub_pd(a, b);}
+    TRM_AVX2 static V mul(V a, V b){return _mm256_mul_pd(a, b);}
+    TRM_AVX2 static V div(V a, V b){return _mm256_div_pd(a, b);}
+    TRM_AVX2 static V madd(V a, V b, V c){return _mm256_fmadd_pd(a, b, c);}
+    TRM_AVX2 static V sqrt(V a){return _mm256_sqrt_pd(a);}
+    TRM_AVX2 static V step(V a, V t){return _mm256_and_pd(_mm256_cmp_pd(a, t, _CMP_GT_OQ), _mm256_set1_pd(1.));}
+    TRM_AVX2 static V max(V a, V b){return _mm256_max_pd(a, b);}
+    TRM_AVX2 static V min(V a, V b){return _mm256_min_pd(a, b);}
+    TRM_AVX2 static T hsum(V a){
+      __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+      s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+      return _mm_cvtsd_f64(s);
+    }
+    TRM_AVX2 static T hmax(V a){
+      __m128d s = _mm_max_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+      s = _mm_max_sd(s, _mm_unpackhi_pd(s, s));
+      return _mm_cvtsd_f64(s);
+    }
+    TRM_AVX2 static T hmin(V a){
+      __m128d s = _mm_min_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+      s = _mm_min_sd(s, _mm_unpackhi_pd(s, s));
+      return _mm_cvtsd_f64(s);
+    }
+    TRM_AVX2 static VD dzero(){return _mm256_setzero_pd();}
+    TRM_AVX2 static VD dset1(double c){return _mm256_set1_pd(c);}
+    TRM_AVX2 static VD dadd(VD a, VD b){return _mm256_add_pd(a, b);}
+    TRM_AVX2 static double dhsum(VD a){return hsum(a);}
+    TRM_AVX2 static void dsum(V a, VD& acc){acc = _mm256_add_pd(acc, a);}
+    TRM_AVX2 static void dsumsq(V a, VD m, VD& acc){
+      VD d = _mm256_sub_pd(a, m);
+      acc = _mm256_fmadd_pd(d, d, acc);
+    }
+  };
+
+  // Some versions of gcc warn spuriously about the _mm512_undefined_* values
+  // used inside the AVX-512 intrinsics
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+  // AVX-512: 16 floats per vector
+  template <>
+  struct Avx512<float> {
+    typedef float T;
+    typedef __m512 V;
+    typedef __m512d VD;
+    static const int W = 16;
+    TRM_AVX512 static V load(const T* p){return _mm512_loadu_ps(p);}
+    TRM_AVX512 static void store(T* p, V v){_mm512_storeu_ps(p, v);}
+    TRM_AVX512 static V set1(T c){return _mm512_set1_ps(c);}
+    TRM_AVX512 static V zero(){return _mm512_setzero_ps();}
+    TRM_AVX512 static V add(V a, V b){return _mm512_add_ps(a, b);}
+    TRM_AVX512 static V sub(V a, V b){return _mm512_sub_ps(a, b);}
+    TRM_AVX512 static V mul(V a, V b){return _mm512_mul_ps(a, b);}
+    TRM_AVX512 static V div(V a, V b){return _mm512_div_ps(a, b);}
+    TRM_AVX512 static V madd(V a, V b, V c){return _mm512_fmadd_ps(a, b, c);}
+    TRM_AVX512 static V sqrt(V a){return _mm512_sqrt_ps(a);}
+    TRM_AVX512 static V step(V a, V t){
+      return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, t, _CMP_GT_OQ), _mm512_set1_ps(1.f));
+    }
+    TRM_AVX512 static V max(V a, V b){return _mm512_max_ps(a, b);}
+    TRM_AVX512 static V min(V a, V b){return _mm512_min_ps(a, b);}
+    TRM_AVX512 static T hsum(V a){
+      alignas(64) T b[W];
+      _mm512_store_ps(b, a);
+      T t = b[0];
+      for(int i=1; i<W; i++) t += b[i];
+      return t;
+    }
+    TRM_AVX512 static T hmax(V a){
+      alignas(64) T b[W];
+      _mm512_store_ps(b, a);
+      T t = b[0];
+      for(int i=1; i<W; i++) t = t < b[i] ? b[i] : t;
+      return t;
+    }
+    TRM_AVX512 static T hmin(V a){
+      alignas(64) T b[W];
+      _mm512_store_ps(b, a);
+      T t = b[0];
+      for(int i=1; i<W; i++) t = t > b[i] ? b[i] : t;
+      return t;
+    }
+    TRM_AVX512 static VD dzero(){return _mm512_setzero_pd();}
+    TRM_AVX512 static VD dset1(double c){return _mm512_set1_pd(c);}
+    TRM_AVX512 static VD dadd(VD a, VD b){return _mm512_add_pd(a, b);}
+    TRM_AVX512 static double dhsum(VD a){
+      alignas(64) double b[8];
+      _mm512_store_pd(b, a);
+      double t = b[0];
+      for(int i=1; i<8; i++) t += b[i];
+      return t;
+    }
+    TRM_AVX512 static __m256 upper(V a){
+      return _mm512_castps512_ps256(_mm512_shuffle_f32x4(a, a, _MM_SHUFFLE(3,2,3,2)));
+    }
+    TRM_AVX512 static void dsum(V a, VD& acc){
+      acc = _mm512_add_pd(acc, _mm512_cvtps_pd(_mm512_castps512_ps256(a)));
+      acc = _mm512_add_pd(acc, _mm512_cvtps_pd(upper(a)));
+    }
+    TRM_AVX512 static void dsumsq(V a, VD m, VD& acc){
+      VD lo = _mm512_sub_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(a)), m);
+      VD hi = _mm512_sub_pd(_mm512_cvtps_pd(upper(a)), m);
+      acc = _mm512_fmadd_pd(lo, lo, acc);
+      acc = _mm512_fmadd_pd(hi, hi, acc);
+    }
+  };
+
+  // AVX-512: 8 doubles per vector
+  template <>
+  struct Avx512<double> {
+    typedef double T;
+    typedef __m512d V;
+    typedef __m512d VD;
+    static const int W = 8;
+    TRM_AVX512 static V load(const T* p){return _mm512_loadu_pd(p);}
+    TRM_AVX512 static void store(T* p, V v){_mm512_storeu_pd(p, v);}
+    TRM_AVX512 static V set1(T c){return _mm512_set1_pd(c);}
+    TRM_AVX512 static V zero(){return _mm512_setzero_pd();}
+    TRM_AVX512 static V add(V a, V b){return _mm512_add_pd(a, b);}
+    TRM_AVX512 static V sub(V a, V b){return _mm512_sub_pd(a, b);}
+    TRM_AVX512 static V mul(V a, V b){return _mm512_mul_pd(a, b);}
+    TRM_AVX512 static V div(V a, V b){return _mm512_div_pd(a, b);}
+    TRM_AVX512 static V madd(V a, V b, V c){return _mm512_fmadd_pd(a, b, c);}
+    TRM_AVX512 static V sqrt(V a){return _mm512_sqrt_pd(a);}
+    TRM_AVX512 static V step(V a, V t){
+      return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a, t, _CMP_GT_OQ), _mm512_set1_pd(1.));
+    }
+    TRM_AVX512 static V max(V a, V b){return _mm512_max_pd(a, b);}
+    TRM_AVX512 static V min(V a, V b){return _mm512_min_pd(a, b);}
+    TRM_AVX512 static T hsum(V a){
+      alignas(64) T b[W];
+      _mm512_store_pd(b, a);
+      T t = b[0];
+      for(int i=1; i<W; i++) t += b[i];
+      return t;
+    }
+    TRM_AVX512 static T hmax(V a){
+      alignas(64) T b[W];
+      _mm512_store_pd(b, a);
+      T t = b[0];
+      for(int i=1; i<W; i++) t = t < b[i] ? b[i] : t;
+      return t;
+    }
+    TRM_AVX512 static T hmin(V a){
+      alignas(64) T b[W];
+      _mm512_store_pd(b, a);
+      T t = b[0];
+      for(int i=1; i<W; i++) t = t > b[i] ? b[i] : t;
+      return t;
+    }
+    TRM_AVX512 static VD dzero(){return _mm512_setzero_pd();}
+    TRM_AVX512 static VD dset1(double c){return _mm512_set1_pd(c);}
+    TRM_AVX512 static VD dadd(VD a, VD b){return _mm512_add_pd(a, b);}
+    TRM_AVX512 static double dhsum(VD a){return hsum(a);}
+    TRM_AVX512 static void dsum(V a, VD& acc){acc = _mm512_add_pd(acc, a);}
+    TRM_AVX512 static void dsumsq(V a, VD m, VD& acc){
+      VD d = _mm512_sub_pd(a, m);
+      acc = _mm512_fmadd_pd(d, d, acc);
+    }
+  };
+
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include "trm/subs.h"
+#include "trm/simd.h"
+#include "trm/thread_pool.h"
+
+namespace {
+
+  // Maximum number of sweeps; convergence normally takes 6 to 10
+  const int MAXSWEEP = 60;
+
+  // Makes columns ap and aq (m values each) orthogonal by a rotation, applied
+  // also to columns vp and vq of V (n values each). Returns false if they
+  // were already orthogonal to within tol.
+  bool orthogonalise(int m, int n, double* ap, double* aq, double* vp, double* vq, double tol){
+    double g[3];
+    Subs::Simd::gram(ap, aq, m, g);
+    const double alpha = g[0], beta = g[1], gamma = g[2];
+    if(gamma == 0. || fabs(gamma) <= tol*sqrt(alpha*beta)) return false;
+
+    // the smaller root of t^2 + 2 zeta t - 1 = 0
+    const double zeta = (beta-alpha)/(2.*gamma);
+    const double t = (zeta >= 0. ? 1. : -1.)/(fabs(zeta) + sqrt(1.+zeta*zeta));
+    const double c = 1./sqrt(1.+t*t), s = c*t;
+    Subs::Simd::rotate(ap, aq, m, c, s);
+    Subs::Simd::rotate(vp, vq, n, c, s);
+    return true;
+  }
+
+}
+
+/**
+ * svd_jacobi computes the singular value decomposition A = U W V^T of an M
+ * x N matrix with M >= N by one-sided Jacobi rotations (Hestenes' method):
+ * pairs of columns of A are rotated until all are mutually orthogonal, when
+ * their lengths are the singular values and, once normalised, they are the
+ * columns of U. The accumulated rotations give V. Matrices are held by
+ * column, so every rotation runs along two contiguous columns, and the
+ * pairs are taken in round-robin order, N/2 disjoint pairs at a time, which
+ * are spread across the thread pool set up by set_nthreads when the matrix
+ * is large enough. The singular values are accurate relative to their own
+ * size rather than to the largest one, and come out unsorted, as from
+ * svdcmp. Columns of U for singular values at rounding level are replaced
+ * by unit vectors orthogonal to the others, so U always has orthonormal
+ * columns.
+ * \param m number of rows of A
+ * \param n number of columns of A, <= m
+ * \param a M x N matrix A by column, i.e. a[j*m+i] is A(i,j); returned with U in the same form
+ * \param w returned with the N singular values
+ * \param v returned with the N x N matrix V by column, i.e. v[j*n+i] is V(i,j)
+ * \exception Throws Subs::Subs_Error if m < n or the rotations fail to converge.
+ */
+
+void Subs::svd_jacobi(int m, int n, double* a, double* w, double* v){
+
+  if(n < 1 || m < n)
+    throw Subs_Error("void Subs::svd_jacobi(int, int, double*, double*, double*): need m >= n >= 1, but m = " +
+		     Subs::str(m) + ", n = " + Subs::str(n));
+
+  for(int j=0; j<n; j++)
+    for(int i=0; i<n; i++)
+      v[j*n+i] = i == j ? 1. : 0.;
+
+  // round-robin ordering: position 0 stays put while the others cycle, so
+  // that each pair meets once per sweep. An odd column count gets a dummy.
+  const int npos = n + n % 2, npair = npos/2;
+  std::vector<int> pos(npos);
+  for(int i=0; i<npos; i++) pos[i] = i;
+  std::vector<char> rotated(npair);
+
+  const double tol = sqrt(double(m))*DBL_EPSILON;
+  const bool parallel = get_nthreads() > 1 && npair > 1 && double(m+n)*npair >= PARALLEL_MIN;
+
+  auto rotate_pair = [&](int ip){
+    const int p = pos[ip], q = pos[npos-1-ip];
+    rotated[ip] = p < n && q < n && orthogonalise(m, n, a+p*m, a+q*m, v+p*n, v+q*n, tol);
+  };
+
+  int sweep;
+  for(sweep=0; sweep<MAXSWEEP; sweep++){
+    bool any = false;
+    for(int step=0; step<npos-1; step++){
+      if(parallel){
+	parallel_run(npair, rotate_pair);
+      }else{
+	for(int ip=0; ip<npair; ip++) rotate_pair(ip);
+      }
+      for(int ip=0; ip<npair; ip++)
+	if(rotated[ip]) any = true;
+
+      const int last = pos[npos-1];
+      for(int i=npos-1; i>1; i--) pos[i] = pos[i-1];
+      pos[1] = last;
+    }
+    if(!any) break;
+  }
+  if(sweep == MAXSWEEP)
+    throw Subs_Error("void Subs::svd_jacobi(int, int, double*, double*, double*): no convergence in " +
+		     Subs::str(MAXSWEEP) + " sweeps");
+
+  double wmax = 0.;
+  for(int j=0; j<n; j++){
+    w[j] = sqrt(Simd::sumsq(a+j*m, m));
+    if(w[j] > wmax) wmax = w[j];
+  }
+
+  const double wmin = tol*wmax;
+  std::vector<char> good(n);
+  int ngood = 0;
+  for(int j=0; j<n; j++){
+    good[j] = w[j] > wmin;
+    if(good[j]){
+      Simd::mul_const(a+j*m, 1./w[j], m);
+      ngood++;
+    }
+  }
+
+  // complete U by Gram-Schmidt, twice over, of unit vectors against the
+  // columns already orthonormal. The squared lengths left of all m unit
+  // vectors sum to the m - ngood dimensions left, so one at least keeps a
+  // length of sqrt((m-ngood)/m), half of which is accepted.
+  int next = 0;
+  for(int j=0; j<n; j++){
+    if(good[j]) continue;
+    double* uj = a + j*m;
+    for(; next<m; next++){
+      for(int i=0; i<m; i++) uj[i] = i == next ? 1. : 0.;
+      for(int pass=0; pass<2; pass++){
+	for(int k=0; k<n; k++){
+	  if(good[k]){
+	    const double* uk = a + k*m;
+	    double dot = 0.;
+	    for(int i=0; i<m; i++) dot += uk[i]*uj[i];
+	    for(int i=0; i<m; i++) uj[i] -= dot*uk[i];
+	  }
+	}
+      }
+      const double norm = sqrt(Simd::sumsq(uj, m));
+      if(norm > 0.5*sqrt(double(m-ngood)/m)){
+	Simd::mul_const(uj, 1./norm, m);
+	good[j] = true;
+	ngood++;
+	next++;
+	break;
+      }
+    }
+  }
+}
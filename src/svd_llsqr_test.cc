@@ -0,0 +1,265 @@
+// test program to check llsqr against the normal equations solved by
+// gaussj and svdfit, and svdcmp for orthonormality, reconstruction and
+// singular values, including rank deficient matrices and ones with fewer
+// rows than columns. Prints the worst errors and returns 1 if any check fails.
+#include <cmath>
+#include <cfloat>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "trm/subs.h"
+#include "trm/buffer2d.h"
+
+namespace {
+
+  bool ok = true;
+
+  void report(const std::string& what, double err, double tol){
+    std::cout << what << ": " << err << (err <= tol ? "" : "  *** FAIL") << std::endl;
+    if(!(err <= tol)) ok = false;
+  }
+
+  // Largest deviation of the columns of the m x n matrix a from
+  // orthonormality, ignoring those for which w[j] <= wmin
+  double orthonormality(const Subs::Buffer2D<double>& a, const Subs::Buffer1D<double>& w, double wmin){
+    const int m = a.nrow(), n = a.ncol();
+    double err = 0.;
+    for(int j=0; j<n; j++){
+      if(w[j] <= wmin) continue;
+      for(int k=0; k<=j; k++){
+	if(w[k] <= wmin) continue;
+	double sum = 0.;
+	for(int i=0; i<m; i++) sum += a[i][j]*a[i][k];
+	err = std::max(err, fabs(sum - (j == k ? 1. : 0.)));
+      }
+    }
+    return err;
+  }
+
+  // Decomposes a by svdcmp and checks U, V and U W V^T, and the singular
+  // values against svdcmp_gr once both are sorted. With fewer rows than
+  // columns only the columns of U for non-zero singular values are set.
+  void check_svd(const std::string& name, const Subs::Buffer2D<double>& a, int nzero){
+
+    const int m = a.nrow(), n = a.ncol();
+    Subs::Buffer2D<double> u = a, v, ugr = a, vgr;
+    Subs::Buffer1D<double> w, wgr;
+    Subs::svdcmp(u, w, v);
+    Subs::svdcmp_gr(ugr, wgr, vgr);
+
+    double anorm = 0., rerr = 0.;
+    for(int i=0; i<m; i++){
+      for(int j=0; j<n; j++){
+	double sum = 0.;
+	for(int k=0; k<n; k++) sum += u[i][k]*w[k]*v[j][k];
+	rerr  = std::max(rerr, fabs(sum-a[i][j]));
+	anorm = std::max(anorm, fabs(a[i][j]));
+      }
+    }
+
+    std::vector<double> ws(n), wsgr(n);
+    for(int j=0; j<n; j++){
+      ws[j]   = w[j];
+      wsgr[j] = wgr[j];
+    }
+    std::sort(ws.begin(), ws.end());
+    std::sort(wsgr.begin(), wsgr.end());
+    double werr = 0.;
+    for(int j=0; j<n; j++)
+      werr = std::max(werr, fabs(ws[j]-wsgr[j]));
+
+    const double tol = 100.*std::max(m,n)*DBL_EPSILON;
+    std::cout << name << " (" << m << " x " << n << ")" << std::endl;
+    report("  U^T U - I", orthonormality(u, w, m < n ? tol*ws[n-1] : -1.), tol);
+    report("  V^T V - I", orthonormality(v, w, -1.), tol);
+    report("  |U W V^T - A|/|A|", rerr/anorm, tol);
+    report("  |w - w_gr|/w_max", werr/ws[n-1], tol);
+    report("  " + Subs::str(nzero) + " smallest w relative to w_max", nzero > 0 ? ws[nzero-1]/ws[n-1] : 0., tol);
+  }
+
+  // Reference solution of the normal equations by gaussj, as llsqr had
+  // before it used Cholesky factorisation. Returns false if gaussj fails.
+  bool reference(int ndata, const double* y, const float* e, int nfunc, double** func, double* coeff, double** covar){
+    Subs::Buffer2D<double> beta(nfunc, 1);
+    for(int j=0; j<nfunc; j++){
+      beta[j][0] = 0.;
+      for(int k=0; k<nfunc; k++)
+	covar[j][k] = 0.;
+    }
+    for(int i=0; i<ndata; i++){
+      if(e[i] > 0.){
+	const double weight = 1./Subs::sqr(e[i]);
+	for(int j=0; j<nfunc; j++){
+	  const double wt = weight*func[i][j];
+	  for(int k=0; k<nfunc; k++)
+	    covar[j][k] += wt*func[i][k];
+	  beta[j][0] += wt*y[i];
+	}
+      }
+    }
+    try{
+      Subs::gaussj(covar, nfunc, beta, 1);
+    }
+    catch(const Subs::Subs_Error& err){
+      return false;
+    }
+    for(int j=0; j<nfunc; j++)
+      coeff[j] = beta[j][0];
+    return true;
+  }
+
+  // Fits by llsqr, the reference and svdfit, whose covariances are V W^-2
+  // V^T. The normal equations solved by gaussj lose more accuracy than
+  // Cholesky factorisation, so the comparison with them is the looser of
+  // the two. If the functions are degenerate (rank < nfunc) the
+  // coefficients are not unique, but llsqr must still reach the minimum
+  // chi**2 found by svdfit, as must the batch version.
+  void check_llsqr(const std::string& name, int ndata, const double* y, const float* e, int nfunc, double** func, int rank){
+
+    std::vector<double> coeff(nfunc), cref(nfunc);
+    Subs::Buffer2D<double> covar(nfunc,nfunc), cvref(nfunc,nfunc);
+
+    Subs::Buffer1D<Subs::ddat> data(ndata);
+    Subs::Buffer2D<double> vect(ndata,nfunc), u, v;
+    Subs::Buffer1D<double> a(nfunc), w;
+    for(int i=0; i<ndata; i++){
+      data[i].x = i;
+      data[i].y = y[i];
+      data[i].z = e[i];
+      for(int j=0; j<nfunc; j++)
+	vect[i][j] = func[i][j];
+    }
+    const double chisvd = Subs::svdfit(data, a, vect, u, v, w);
+
+    std::cout << name << " (" << ndata << " points, " << nfunc << " functions, rank " << rank << ")" << std::endl;
+    try{
+      Subs::llsqr(ndata, y, e, nfunc, func, &coeff[0], covar);
+    }
+    catch(const Subs::Subs_Error& err){
+      std::cout << "  llsqr: " << err << std::endl;
+      report("  llsqr failed", 1., 0.);
+      return;
+    }
+
+    Subs::Buffer2D<double> yb(3,ndata), cb;
+    Subs::Buffer2D<float> eb(1,ndata);
+    for(int i=0; i<ndata; i++){
+      for(int k=0; k<3; k++) yb[k][i] = y[i];
+      eb[0][i] = e[i];
+    }
+    Subs::llsqr(yb, eb, nfunc, func, cb);
+    double berr = 0.;
+    for(int k=0; k<3; k++)
+      berr = std::max(berr, fabs(Subs::llsqr_chisq(ndata, y, e, nfunc, func, cb[k])/chisvd-1.));
+    report("  batch llsqr chi**2 relative to svdfit - 1", berr, 1.e-10);
+
+    if(rank < nfunc){
+      const double chisq = Subs::llsqr_chisq(ndata, y, e, nfunc, func, &coeff[0]);
+      report("  chi**2 relative to svdfit - 1", fabs(chisq/chisvd-1.), 1.e-10);
+      return;
+    }
+
+    if(!reference(ndata, y, e, nfunc, func, &cref[0], cvref)){
+      report("  reference failed on a full rank problem", 1., 0.);
+      return;
+    }
+
+    double cerr = 0., serr = 0., verr = 0., vserr = 0., cmax = 0., vmax = 0.;
+    for(int j=0; j<nfunc; j++){
+      cerr = std::max(cerr, fabs(coeff[j]-cref[j]));
+      serr = std::max(serr, fabs(coeff[j]-a[j]));
+      cmax = std::max(cmax, fabs(a[j]));
+      for(int k=0; k<nfunc; k++){
+	double csvd = 0.;
+	for(int i=0; i<nfunc; i++)
+	  csvd += v[j][i]*v[k][i]/Subs::sqr(w[i]);
+	verr  = std::max(verr, fabs(covar[j][k]-cvref[j][k]));
+	vserr = std::max(vserr, fabs(covar[j][k]-csvd));
+	vmax  = std::max(vmax, fabs(csvd));
+      }
+    }
+    const double chisq = Subs::llsqr_chisq(ndata, y, e, nfunc, func, &coeff[0]);
+    report("  coefficients, relative to svdfit", serr/cmax, 1.e-10);
+    report("  covariances, relative to svdfit", vserr/vmax, 1.e-10);
+    report("  coefficients, relative to gaussj", cerr/cmax, 1.e-6);
+    report("  covariances, relative to gaussj", verr/vmax, 1.e-6);
+    report("  chi**2 relative to svdfit - 1", fabs(chisq/chisvd-1.), 1.e-10);
+  }
+
+}
+
+int main(){
+
+  int seed = -363787;
+
+  // svdcmp: full rank, square, rank deficient through a linear combination
+  // and a zero column, and fewer rows than columns, with and without
+  // further degeneracy
+  {
+    Subs::Buffer2D<double> a(200,10);
+    for(int i=0; i<200; i++)
+      for(int j=0; j<10; j++)
+	a[i][j] = Subs::gauss2(seed);
+    check_svd("svdcmp, full rank", a, 0);
+
+    for(int i=0; i<200; i++){
+      a[i][7] = a[i][2] - 3.*a[i][5];
+      a[i][9] = 0.;
+    }
+    check_svd("svdcmp, rank 8", a, 2);
+
+    Subs::Buffer2D<double> b(10,10);
+    for(int i=0; i<10; i++)
+      for(int j=0; j<10; j++)
+	b[i][j] = Subs::gauss2(seed);
+    check_svd("svdcmp, square", b, 0);
+
+    Subs::Buffer2D<double> c(6,10);
+    for(int i=0; i<6; i++)
+      for(int j=0; j<10; j++)
+	c[i][j] = Subs::gauss2(seed);
+    check_svd("svdcmp, M < N", c, 4);
+
+    for(int j=0; j<10; j++)
+      c[4][j] = 2.*c[1][j];
+    check_svd("svdcmp, M < N, rank 5", c, 5);
+  }
+
+  // llsqr: Chebyshev polynomials fitted to a ramp with a bump, as
+  // svd_test, then with one function a combination of two others
+  const int NPOLY = 10;
+  const int NDATA = 2000;
+
+  double *y = new double[NDATA];
+  float  *e = new float[NDATA];
+  double **func = new double*[NDATA];
+  for(int i=0; i<NDATA; i++){
+    func[i] = new double[NPOLY];
+    y[i] = 1 + 0.001*i + 0.11*Subs::gauss2(seed);
+    if(i > 500 && i < 550)
+      y[i] += sin(6.28*(i-500)/50);
+    e[i] = i % 37 == 0 ? -1. : 0.1 + 0.05*(i % 3);
+
+    const double xtrans = (2.*i-(NDATA-1))/(NDATA-1);
+    func[i][0] = 1;
+    func[i][1] = xtrans;
+    for(int j=2; j<NPOLY; j++)
+      func[i][j] = 2*xtrans*func[i][j-1] - func[i][j-2];
+  }
+
+  check_llsqr("llsqr, Chebyshev polynomials", NDATA, y, e, NPOLY, func, NPOLY);
+
+  for(int i=0; i<NDATA; i++)
+    func[i][6] = func[i][1] + 0.5*func[i][3];
+  check_llsqr("llsqr, degenerate functions", NDATA, y, e, NPOLY, func, NPOLY-1);
+
+  for(int i=0; i<NDATA; i++)
+    delete[] func[i];
+  delete[] func;
+  delete[] e;
+  delete[] y;
+
+  std::cout << (ok ? "All checks passed" : "Some checks FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
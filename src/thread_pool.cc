@@ -0,0 +1,171 @@
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "trm/subs.h"
+#include "trm/thread_pool.h"
+
+namespace {
+
+  // A fixed set of worker threads which, together with the caller, work
+  // through the tasks of one job at a time.
+  class Thread_pool {
+
+  public:
+
+    Thread_pool() : job(NULL), ntask(0), next(0), nactive(0), generation(0), quit(false) {}
+
+    ~Thread_pool(){
+      stop();
+    }
+
+    // Changes the number of worker threads
+    void resize(int nworker){
+      std::lock_guard<std::mutex> excl(run_mutex);
+      stop();
+      quit = false;
+      for(int i=0; i<nworker; i++)
+	workers.push_back(std::thread(&Thread_pool::work, this));
+    }
+
+    // Runs task(0) .. task(ntask-1), returning when all are done. The
+    // first exception thrown by a task is re-thrown.
+    void run(int ntask_, const std::function<void(int)>& task){
+
+      std::unique_lock<std::mutex> excl(run_mutex, std::try_to_lock);
+      if(in_task || !excl.owns_lock() || workers.empty()){
+	for(int i=0; i<ntask_; i++) task(i);
+	return;
+      }
+
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	job     = &task;
+	ntask   = ntask_;
+	next    = 0;
+	error   = NULL;
+	nactive = workers.size();
+	generation++;
+      }
+      wake.notify_all();
+
+      execute();
+
+      std::exception_ptr err;
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this]{return nactive == 0;});
+	job = NULL;
+	err = error;
+	error = NULL;
+      }
+      if(err) std::rethrow_exception(err);
+    }
+
+  private:
+
+    // Works through tasks until there are none left
+    void execute(){
+      in_task = true;
+      int i;
+      while((i = next++) < ntask){
+	try{
+	  (*job)(i);
+	}
+	catch(...){
+	  std::lock_guard<std::mutex> lock(mutex);
+	  if(!error) error = std::current_exception();
+	  next = ntask;
+	}
+      }
+      in_task = false;
+    }
+
+    // Worker thread loop
+    void work(){
+      unsigned long int seen = 0;
+      for(;;){
+	{
+	  std::unique_lock<std::mutex> lock(mutex);
+	  wake.wait(lock, [&]{return quit || generation != seen;});
+	  if(quit) return;
+	  seen = generation;
+	}
+	execute();
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  if(--nactive == 0) done.notify_one();
+	}
+      }
+    }
+
+    // Joins all workers
+    void stop(){
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	quit = true;
+      }
+      wake.notify_all();
+      for(size_t i=0; i<workers.size(); i++)
+	workers[i].join();
+      workers.clear();
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex run_mutex, mutex;
+    std::condition_variable wake, done;
+    const std::function<void(int)>* job;
+    int ntask;
+    std::atomic<int> next;
+    int nactive;
+    unsigned long int generation;
+    bool quit;
+    std::exception_ptr error;
+
+    static thread_local bool in_task;
+  };
+
+  thread_local bool Thread_pool::in_task = false;
+
+  Thread_pool& pool(){
+    static Thread_pool tpool;
+    return tpool;
+  }
+
+  std::atomic<int> nthreads_used(1);
+
+}
+
+/** Sets the number of threads used by parallel operations on arrays. The
+ * default is 1, i.e. everything runs in the calling thread.
+ * \param nthreads number of threads including the calling thread; 0 means
+ * one per hardware thread.
+ */
+void Subs::set_nthreads(int nthreads){
+  if(nthreads < 0)
+    throw Subs_Error("void Subs::set_nthreads(int): number of threads = " + Subs::str(nthreads) + " < 0");
+  if(nthreads == 0)
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  if(nthreads != nthreads_used){
+    pool().resize(nthreads-1);
+    nthreads_used = nthreads;
+  }
+}
+
+/** Returns the number of threads used by parallel operations on arrays
+ */
+int Subs::get_nthreads(){
+  return nthreads_used;
+}
+
+/** Runs a set of independent tasks, spread over the thread pool set up by
+ * set_nthreads. The calling thread takes part and the routine returns once all
+ * tasks are complete. If any task throws an exception, remaining tasks are
+ * skipped and the first exception is re-thrown. Calls from within a task run serially.
+ * \param ntask number of tasks
+ * \param task  function called as task(itask) for itask = 0 to ntask-1
+ */
+void Subs::parallel_run(int ntask, const std::function<void(int)>& task){
+  pool().run(ntask, task);
+}